@@ -0,0 +1,46 @@
+#pragma once
+
+// Fixed-point animation clock.
+//
+// Effects advance by elapsed microseconds instead of by "one step per tick",
+// so animation speed no longer depends on loop jitter or on how long show()
+// takes, and a late frame simply lands further along the animation. Tempo is a
+// Q16.16 multiplier (Q16_ONE = 1.0x); no floats are used per tick.
+
+#include <Arduino.h>
+
+static constexpr uint32_t Q16_ONE = 1u << 16;
+
+// Compile-time conversion for constants only (e.g. tempo limits)
+constexpr uint32_t q16FromFloat(float f) { return (uint32_t)(f * Q16_ONE + 0.5f); }
+
+inline uint32_t q16Mul(uint32_t a, uint32_t b) { return (uint32_t)(((uint64_t)a * b) >> 16); }
+
+// Q16.16 phase accumulator: the integer part counts whole animation steps.
+class PhaseAccumulator {
+ public:
+  // stepUs is the duration of one whole step at tempo 1.0. The rate is cached
+  // as a 0.32 fraction of a step per microsecond, so advance() is a multiply.
+  void setRate(uint32_t stepUs, uint32_t tempoQ16) {
+    rateQ32_ = (uint32_t)((((uint64_t)tempoQ16) << 16) / stepUs);
+  }
+
+  // Returns the Q16.16 increment for dtUs (also added to the phase)
+  uint32_t advance(uint32_t dtUs) {
+    uint32_t inc = (uint32_t)(((uint64_t)dtUs * rateQ32_) >> 16);
+    phase_ += inc;
+    return inc;
+  }
+
+  // Unwrapped phase a clock running at the current rate since time 0 would
+  // have at timeUs. Devices sharing a clock get the same value.
+  uint64_t phaseAt(uint32_t timeUs) const { return ((uint64_t)timeUs * rateQ32_) >> 16; }
+
+  void reset(uint32_t phaseQ16 = 0) { phase_ = phaseQ16; }
+  uint32_t phase() const { return phase_; }
+  uint32_t steps() const { return phase_ >> 16; }
+
+ private:
+  uint32_t phase_ = 0;
+  uint32_t rateQ32_ = 0;
+};
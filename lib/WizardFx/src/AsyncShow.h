@@ -0,0 +1,132 @@
+#pragma once
+
+// Non-blocking FastLED.show().
+//
+// FastLED.show() returns only after the last pixel is clocked out, which on a
+// 750-LED strand is over 20 ms of dead time for the caller. AsyncShow moves
+// the call onto a small output task: start() hands the current buffers over
+// and returns immediately, and the caller is notified (task notification plus
+// optional callback) when the transfer is done. The buffers must not be
+// written while busy(); callers either skip work until then or waitDone().
+//
+// Time spent waiting for a transfer is accumulated as blocked time, so the
+// gain over a plain FastLED.show() can be read off stats().
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+
+#include "FrameProfile.h"
+
+class AsyncShow {
+ public:
+  static constexpr uint32_t TASK_STACK = 4096;
+  static constexpr UBaseType_t PRIORITY = 3;  // above loop() and the render task
+  using DoneCallback = void (*)();
+
+  struct Stats {
+    uint32_t shows;      // transfers completed
+    uint32_t showUs;     // total time inside FastLED.show()
+    uint32_t blockedUs;  // total time callers waited for a transfer
+  };
+
+  // Create the output task. onDone (may be null) runs on the output task after
+  // every transfer. Until begin() succeeds, start() falls back to a blocking show.
+  bool begin(BaseType_t core = 0, DoneCallback onDone = nullptr) {
+    if (task_) return true;
+    onDone_ = onDone;
+    return xTaskCreatePinnedToCore(outputTask, "ledOutput", TASK_STACK, this, PRIORITY, &task_,
+                                   core) == pdPASS;
+  }
+
+  bool running() const { return task_ != nullptr; }
+  bool busy() const { return busy_.load(std::memory_order_acquire); }
+
+  // Start clocking out the current buffers and return. If the previous
+  // transfer is still on the wire this waits for it first.
+  void start() {
+    waitDone();
+    if (!task_) {
+      const uint32_t t = micros();
+      FastLED.show();
+      const uint32_t dt = micros() - t;
+      showUs_ += dt;
+      blockedUs_ += dt;  // synchronous: the caller waited for all of it
+      shows_++;
+#if FRAME_PROFILE
+      showTimes_.add(dt);
+#endif
+      return;
+    }
+    waiter_ = xTaskGetCurrentTaskHandle();
+    busy_.store(true, std::memory_order_release);
+    xTaskNotifyGive(task_);
+  }
+
+  // Block until the transfer in flight (if any) completes. Returns false on timeout.
+  bool waitDone(TickType_t timeout = portMAX_DELAY) {
+    if (!busy()) return true;
+    const uint32_t t = micros();
+    // Loop: a notification left over from an earlier, unawaited transfer
+    // wakes us once without the current one being done
+    while (busy()) {
+      if (!ulTaskNotifyTake(pdTRUE, timeout)) break;
+    }
+    blockedUs_ += micros() - t;
+    return !busy();
+  }
+
+  Stats stats() const { return {shows_, showUs_, blockedUs_}; }
+
+  // Stats accumulated since the previous call, for periodic reports
+  Stats takeInterval() {
+    const Stats now = stats();
+    const Stats d = {now.shows - last_.shows, now.showUs - last_.showUs, now.blockedUs - last_.blockedUs};
+    last_ = now;
+    return d;
+  }
+
+  // Duration of the most recent FastLED.show()
+  uint32_t lastShowUs() const { return lastShowUs_; }
+
+#if FRAME_PROFILE
+  // Every FastLED.show(), synchronous or on the output task
+  TimingHistogram& showTimes() { return showTimes_; }
+#endif
+
+ private:
+  static void outputTask(void* arg) { static_cast<AsyncShow*>(arg)->outputLoop(); }
+
+  void outputLoop() {
+    for (;;) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      const uint32_t t = micros();
+      FastLED.show();
+      lastShowUs_ = micros() - t;
+      showUs_ += lastShowUs_;
+      shows_++;
+#if FRAME_PROFILE
+      showTimes_.add(lastShowUs_);
+#endif
+      busy_.store(false, std::memory_order_release);
+      if (onDone_) onDone_();
+      if (waiter_) xTaskNotifyGive(waiter_);
+    }
+  }
+
+  TaskHandle_t task_ = nullptr;
+  TaskHandle_t waiter_ = nullptr;  // task that started the transfer in flight
+  DoneCallback onDone_ = nullptr;
+  std::atomic<bool> busy_{false};
+  volatile uint32_t shows_ = 0;
+  volatile uint32_t showUs_ = 0;
+  volatile uint32_t blockedUs_ = 0;
+  volatile uint32_t lastShowUs_ = 0;
+  Stats last_ = {0, 0, 0};  // snapshot for takeInterval()
+#if FRAME_PROFILE
+  TimingHistogram showTimes_;
+#endif
+};
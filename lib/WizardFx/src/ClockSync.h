@@ -0,0 +1,111 @@
+#pragma once
+
+// Shared animation clock across devices.
+//
+// The staff is the clock master: every SYNC_BEACON_INTERVAL_MS it broadcasts a
+// SyncBeacon stamped with its esp_timer time right before esp_now_send().
+// Receivers stamp each beacon with their own esp_timer time in the receive
+// callback and feed the pair to a ClockSync, which tracks the master clock as
+//   shared = refMaster + dt + dt * drift,   dt = local - refLocal
+// with a small phase/frequency loop: each beacon corrects a quarter of the
+// prediction error and nudges the drift estimate. A prediction error above
+// STEP_THRESHOLD_US (first beacon, staff reboot, long radio gap) re-anchors
+// the clock instead, and the caller realigns running effects.
+//
+// Radio and callback latency are not compensated. They are roughly the same
+// for every receiver, so receivers agree with each other to well under a frame
+// and trail the staff by that latency (typically below a millisecond).
+//
+// The low 32 bits of the shared clock are in the same units as micros(), so
+// EffectEngine::tick() takes it directly. On the staff, micros() is the master
+// clock. Single-threaded: feed and read it from the task that owns the engine.
+
+#include <Arduino.h>
+
+#include "SpellPacket.h"
+#include "SpellQueue.h"
+
+struct ClockSample {
+  uint64_t masterUs;  // staff clock from the beacon
+  uint64_t localUs;   // receiver esp_timer_get_time() when it arrived
+};
+
+// Validate one ESP-NOW payload as a sync beacon and fill s from it (only on
+// success). Inlined for the receive callback, like decodeSpell().
+__attribute__((always_inline)) inline bool decodeSync(const uint8_t* data, int len, uint64_t rxUs,
+                                                      ClockSample& s) {
+  const SyncBeacon* b = nullptr;
+  if (parseFrame(data, len, SPELL_MSG_SYNC, &b) != SPELL_OK_V2) return false;
+  s = {b->hdr.senderUs, rxUs};
+  return true;
+}
+
+// Beacons arrive once a second; a few slots cover a stalled consumer
+using SyncQueue = SpscRing<ClockSample, 8>;
+
+class ClockSync {
+ public:
+  static constexpr int64_t STEP_THRESHOLD_US = 20000;  // larger errors re-anchor
+  static constexpr int32_t MAX_DRIFT_PPB = 200000;     // crystals are within +-200 ppm
+
+  // Apply one beacon. Returns true if the clock was (re)anchored, i.e. the
+  // shared time jumped and running effects should be realigned.
+  bool addSample(const ClockSample& s) {
+    beacons_++;
+    if (!synced_) {
+      anchor(s);
+      synced_ = true;
+      return true;
+    }
+    const int64_t dt = (int64_t)(s.localUs - refLocal_);
+    const int64_t predicted = toShared(s.localUs);
+    const int64_t err = (int64_t)s.masterUs - predicted;
+    lastErrorUs_ = (int32_t)err;
+    if (dt <= 0 || err > STEP_THRESHOLD_US || err < -STEP_THRESHOLD_US) {
+      anchor(s);
+      steps_++;
+      return true;
+    }
+    // Frequency: 1/32 of the drift this error implies over dt. Beacon latency
+    // jitter (a few hundred us) would make larger gains wander by 100 ppm.
+    int64_t drift = driftPpb_ + err * 1000000000LL / dt / 32;
+    if (drift > MAX_DRIFT_PPB) drift = MAX_DRIFT_PPB;
+    if (drift < -MAX_DRIFT_PPB) drift = -MAX_DRIFT_PPB;
+    driftPpb_ = (int32_t)drift;
+    // Phase: take a quarter of the error now, which averages out the jitter
+    refMaster_ = (uint64_t)(predicted + err / 4);
+    refLocal_ = s.localUs;
+    return false;
+  }
+
+  // Master time for a local esp_timer_get_time() value. Before the first beacon
+  // the local clock stands in, so callers never have to special-case it.
+  uint64_t toShared(uint64_t localUs) const {
+    if (!synced_) return localUs;
+    const int64_t dt = (int64_t)(localUs - refLocal_);
+    return refMaster_ + dt + dt * driftPpb_ / 1000000000LL;
+  }
+
+  bool synced() const { return synced_; }
+  // Shared minus local clock at localUs
+  int64_t offsetUs(uint64_t localUs) const { return (int64_t)(toShared(localUs) - localUs); }
+  int32_t driftPpb() const { return driftPpb_; }
+  int32_t lastErrorUs() const { return lastErrorUs_; }  // prediction error of the last beacon
+  uint32_t beacons() const { return beacons_; }
+  uint32_t steps() const { return steps_; }            // re-anchors after the first lock
+
+ private:
+  void anchor(const ClockSample& s) {
+    refMaster_ = s.masterUs;
+    refLocal_ = s.localUs;
+    lastErrorUs_ = 0;
+  }
+
+  bool synced_ = false;
+  uint64_t refMaster_ = 0;
+  uint64_t refLocal_ = 0;
+  int32_t driftPpb_ = 0;  // local clock rate error, parts per billion
+  int32_t lastErrorUs_ = 0;
+  uint32_t beacons_ = 0;
+  uint32_t steps_ = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+// Lookup tables for the rainbow kernels.
+//
+// HueRamp<N>: compile-time per-index hue offsets (i * 256 / N) for a strand of
+// N pixels, so the render loop never divides. One table is emitted per distinct
+// strand length, shared by every strand of that length.
+//
+// ColorWheel: the 256 fully saturated rainbow colors at the most recently
+// requested value. Changing the value re-converts 256 entries with FastLED's
+// own CHSV->CRGB, so the table matches a per-pixel conversion whatever the
+// library's scale8 settings; rendering a frame is then one table lookup per
+// pixel instead of a conversion (256 per value change vs. 1500 per frame).
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+template <uint16_t N>
+struct HueRamp {
+  static_assert(N > 0, "HueRamp needs at least one pixel");
+  uint8_t offset[N];
+};
+
+template <uint16_t N>
+constexpr HueRamp<N> makeHueRamp() {
+  HueRamp<N> ramp{};
+  for (uint32_t i = 0; i < N; i++) {
+    ramp.offset[i] = (uint8_t)(i * 256u / N);
+  }
+  return ramp;
+}
+
+template <uint16_t N>
+inline constexpr HueRamp<N> kHueRamp = makeHueRamp<N>();
+
+class ColorWheel {
+ public:
+  // Colors for CHSV(hue, 255, value), indexed by hue.
+  const CRGB* at(uint8_t value) {
+    if (!ready_ || value != value_) {
+      for (uint16_t h = 0; h < 256; h++) {
+        wheel_[h] = CHSV((uint8_t)h, 255, value);
+      }
+      value_ = value;
+      ready_ = true;
+    }
+    return wheel_;
+  }
+
+ private:
+  CRGB wheel_[256];
+  uint8_t value_ = 0;
+  bool ready_ = false;
+};
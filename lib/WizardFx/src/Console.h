@@ -0,0 +1,98 @@
+#pragma once
+
+// Line commands for the NetSerial telnet console (port 23).
+//
+// NetSerial hands every line the client types to the firmware, on its drain
+// task. runConsoleLine() splits the line into words and runs the entry of the
+// firmware's command table named by the first one; "help" lists the table.
+//
+// Commands that only read (stats, prof, dump) answer straight away. Commands
+// that change something post a ConsoleOp to a ConsoleQueue, which the task
+// that owns the engine drains before its next frame, the same way spells
+// arrive from onRecv. So a new brightness or frame rate takes effect on the
+// next frame and never races a render.
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SpellQueue.h"  // SpscRing
+
+struct ConsoleArgs {
+  static constexpr uint8_t kMaxArgs = 6;
+  static constexpr size_t kMaxLine = 64;
+
+  // Split on spaces; returns false for an empty line
+  bool parse(const char* line) {
+    strncpy(buf_, line, sizeof(buf_) - 1);
+    buf_[sizeof(buf_) - 1] = '\0';
+    argc = 0;
+    char* save = nullptr;
+    for (char* p = strtok_r(buf_, " \t", &save); p && argc < kMaxArgs; p = strtok_r(nullptr, " \t", &save)) {
+      argv[argc++] = p;
+    }
+    return argc > 0;
+  }
+
+  // Argument i as an integer in [lo, hi]
+  bool toInt(uint8_t i, long lo, long hi, long& out) const {
+    if (i >= argc) return false;
+    char* end = nullptr;
+    const long v = strtol(argv[i], &end, 0);
+    if (*end || v < lo || v > hi) return false;
+    out = v;
+    return true;
+  }
+
+  bool toFloat(uint8_t i, float lo, float hi, float& out) const {
+    if (i >= argc) return false;
+    char* end = nullptr;
+    const float v = strtof(argv[i], &end);
+    if (*end || !(v >= lo && v <= hi)) return false;
+    out = v;
+    return true;
+  }
+
+  const char* argv[kMaxArgs] = {};
+  uint8_t argc = 0;
+
+ private:
+  char buf_[kMaxLine];
+};
+
+struct ConsoleCommand {
+  const char* name;
+  const char* usage;  // shown by "help", e.g. "brightness <0-255>"
+  void (*run)(const ConsoleArgs& args);
+};
+
+// Run one line against the table. print sends replies to the client.
+template <size_t N>
+inline void runConsoleLine(const ConsoleCommand (&table)[N], const char* line, void (*print)(const char*)) {
+  ConsoleArgs args;
+  if (!args.parse(line)) return;
+  for (const ConsoleCommand& c : table) {
+    if (strcmp(args.argv[0], c.name) == 0) {
+      c.run(args);
+      return;
+    }
+  }
+  if (strcmp(args.argv[0], "help") != 0) {
+    print("Unknown command (try \"help\")\r\n");
+    return;
+  }
+  for (const ConsoleCommand& c : table) {
+    print("  ");
+    print(c.usage);
+    print("\r\n");
+  }
+}
+
+// A deferred change: the firmware defines the codes
+struct ConsoleOp {
+  uint8_t code;
+  int32_t value;
+};
+
+// Console task produces, the engine owner consumes
+using ConsoleQueue = SpscRing<ConsoleOp, 8>;
@@ -0,0 +1,408 @@
+#pragma once
+
+// E1.31 (sACN) and Art-Net pixel input.
+//
+// A lighting desk or PC sends DMX universes over UDP; DmxInput maps them onto
+// LED strands, 170 RGB pixels (510 slots) per universe. Each strand starts on
+// a fresh universe: five 250-pixel strands from universe 1 use 1-10.
+//
+// parseDmxPacket() validates a datagram in place and points at its slot data;
+// DmxInput copies those slots straight into a flat RGB frame (CRGB layout,
+// strands back to back). Complete frames are handed to the reader through a
+// triple buffer, so the network task never blocks the renderer and the
+// renderer always sees whole frames:
+//   - no sync: a frame is published once every mapped universe arrived, or
+//     when a universe repeats first (the sender skips some universes)
+//   - universe sync (sACN sync packets, ArtSync): data is held until the next
+//     sync. Without a sync for DMX_SYNC_TIMEOUT_MS, back to unsynced mode.
+// Sequence numbers are tracked per universe. Gaps are counted; a packet up to
+// 20 behind the last one is a reordered straggler and dropped (E1.31 6.7.2).
+//
+// No Arduino dependency: the same code runs on Linux, where DmxSocket uses
+// POSIX sockets instead of lwIP, so it can be tried against a local sACN
+// sender (see tools/dmx_listen.cpp).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <unistd.h>  // close()
+
+#if defined(ARDUINO)
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+
+static constexpr uint16_t SACN_PORT = 5568;
+static constexpr uint16_t ARTNET_PORT = 6454;
+static constexpr uint16_t DMX_PIXELS_PER_UNIVERSE = 170;
+static constexpr uint32_t DMX_SYNC_TIMEOUT_MS = 4000;  // Art-Net's rule, used for both
+static constexpr size_t DMX_MAX_PACKET = 638;          // sACN header + start code + 512 slots
+
+enum DmxProtocol : uint8_t {
+  DMX_SACN = 0,
+  DMX_ARTNET = 1,
+};
+
+enum DmxPacketKind : uint8_t {
+  DMX_NONE = 0,  // not sACN/Art-Net, malformed, or a type we do not use
+  DMX_DATA = 1,
+  DMX_SYNC = 2,
+};
+
+struct DmxPacket {
+  DmxPacketKind kind;
+  DmxProtocol protocol;
+  uint16_t universe;     // DMX_DATA: universe; sACN DMX_SYNC: sync address
+  uint16_t syncAddress;  // sACN data: hold for this sync address (0 = show now)
+  uint8_t sequence;      // Art-Net 0 = sequencing disabled
+  bool preview;          // sACN preview data: not for live output
+  bool terminated;       // sACN stream terminated
+  const uint8_t* slots;  // into the datagram, after the start code
+  uint16_t slotCount;
+};
+
+namespace dmxwire {
+
+inline uint16_t be16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+inline uint32_t be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static constexpr uint8_t ACN_ID[12] = {'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0};
+static constexpr uint8_t ARTNET_ID[8] = {'A', 'r', 't', '-', 'N', 'e', 't', 0};
+
+// E1.31-2018 offsets
+static constexpr uint32_t VECTOR_ROOT_DATA = 0x00000004;
+static constexpr uint32_t VECTOR_ROOT_EXTENDED = 0x00000008;
+static constexpr uint32_t VECTOR_FRAMING_DATA = 0x00000002;
+static constexpr uint32_t VECTOR_FRAMING_SYNC = 0x00000001;
+static constexpr size_t SACN_SYNC_LEN = 49;
+static constexpr size_t SACN_SLOTS_AT = 126;  // first slot after the start code
+
+// Art-Net 4 op codes (little-endian on the wire)
+static constexpr uint16_t OP_DMX = 0x5000;
+static constexpr uint16_t OP_SYNC = 0x5200;
+static constexpr size_t ARTDMX_HEADER = 18;
+
+inline DmxPacketKind parseSacn(const uint8_t* d, size_t len, DmxPacket& p) {
+  if (len < SACN_SYNC_LEN || be16(d) != 0x0010 || be16(d + 2) != 0 || memcmp(d + 4, ACN_ID, 12) != 0) {
+    return DMX_NONE;
+  }
+  p.protocol = DMX_SACN;
+  const uint32_t root = be32(d + 18);
+  if (root == VECTOR_ROOT_EXTENDED && be32(d + 40) == VECTOR_FRAMING_SYNC) {
+    p.sequence = d[44];
+    p.universe = be16(d + 45);
+    return p.kind = DMX_SYNC;
+  }
+  if (root != VECTOR_ROOT_DATA || len <= SACN_SLOTS_AT - 1 || be32(d + 40) != VECTOR_FRAMING_DATA) return DMX_NONE;
+  if (d[117] != 0x02 || d[118] != 0xA1) return DMX_NONE;  // DMP set property, 1-byte data
+  const uint16_t count = be16(d + 123);                    // start code + slots
+  if (count < 1 || count > 513 || SACN_SLOTS_AT - 1 + count > len) return DMX_NONE;
+  if (d[125] != 0) return DMX_NONE;  // alternate start codes (per-address priority, RDM)
+  p.universe = be16(d + 113);
+  if (p.universe == 0) return DMX_NONE;
+  p.syncAddress = be16(d + 109);
+  p.sequence = d[111];
+  p.preview = (d[112] & 0x80) != 0;
+  p.terminated = (d[112] & 0x40) != 0;
+  p.slots = d + SACN_SLOTS_AT;
+  p.slotCount = count - 1;
+  return p.kind = DMX_DATA;
+}
+
+inline DmxPacketKind parseArtNet(const uint8_t* d, size_t len, DmxPacket& p) {
+  if (len < 14 || memcmp(d, ARTNET_ID, 8) != 0) return DMX_NONE;
+  p.protocol = DMX_ARTNET;
+  const uint16_t op = (uint16_t)(d[8] | (d[9] << 8));
+  if (op == OP_SYNC) {
+    p.universe = 0;
+    return p.kind = DMX_SYNC;
+  }
+  if (op != OP_DMX || len < ARTDMX_HEADER) return DMX_NONE;
+  const uint16_t count = be16(d + 16);
+  if (count > 512 || ARTDMX_HEADER + count > len) return DMX_NONE;
+  p.universe = (uint16_t)(((d[15] & 0x7F) << 8) | d[14]);  // 15-bit port-address
+  p.sequence = d[12];
+  p.slots = d + ARTDMX_HEADER;
+  p.slotCount = count;
+  return p.kind = DMX_DATA;
+}
+
+}  // namespace dmxwire
+
+// Validate one UDP payload (either protocol) in place. On DMX_DATA, p.slots
+// points into data, so data must outlive p.
+inline DmxPacketKind parseDmxPacket(const uint8_t* data, size_t len, DmxPacket& p) {
+  p = {};
+  if (dmxwire::parseSacn(data, len, p) != DMX_NONE) return p.kind;
+  if (dmxwire::parseArtNet(data, len, p) != DMX_NONE) return p.kind;
+  p.kind = DMX_NONE;
+  return DMX_NONE;
+}
+
+// Universe -> pixel mapping, sequence tracking, sync and the frame handoff.
+// onPacket() runs on the network task, frame() on the engine owner.
+template <uint16_t MaxPixels, uint8_t MaxUniverses = 16>
+class DmxInput {
+  static_assert(MaxUniverses <= 32, "pending mask holds at most 32 universes");
+
+ public:
+  struct UniverseStats {
+    uint16_t universe;
+    uint32_t packets;     // accepted data packets
+    uint32_t gaps;        // packets missing according to the sequence number
+    uint32_t outOfOrder;  // stragglers dropped
+  };
+
+  struct Stats {
+    uint32_t frames;       // frames published
+    uint32_t syncs;        // sync packets that published a frame
+    uint32_t unmapped;     // data for universes we do not drive
+    uint32_t ignored;      // preview, terminated or unparseable datagrams
+  };
+
+  // Map strands (pixel counts, back to back in the frame) onto consecutive
+  // universes from firstUniverse, each strand starting on a fresh universe.
+  // Returns false if they need more than MaxPixels or MaxUniverses.
+  bool begin(const uint16_t* strandPixels, uint8_t strands, uint16_t firstUniverse) {
+    universes_ = 0;
+    uint32_t offset = 0;
+    uint16_t universe = firstUniverse;
+    for (uint8_t s = 0; s < strands; s++) {
+      for (uint16_t done = 0; done < strandPixels[s]; done += DMX_PIXELS_PER_UNIVERSE) {
+        if (universes_ == MaxUniverses) return false;
+        Slot& u = map_[universes_++];
+        u.universe = universe++;
+        u.offset = (uint16_t)(offset + done);
+        const uint16_t left = strandPixels[s] - done;
+        u.pixels = left < DMX_PIXELS_PER_UNIVERSE ? left : DMX_PIXELS_PER_UNIVERSE;
+        u.stats = {u.universe, 0, 0, 0};
+        u.seqValid = false;
+      }
+      offset += strandPixels[s];
+    }
+    if (offset > MaxPixels) return false;
+    bytes_ = offset * 3;
+    allMask_ = universes_ == 32 ? 0xFFFFFFFFu : ((1u << universes_) - 1u);
+    return true;
+  }
+
+  // Writer side (network task): apply one datagram. Returns true if it
+  // published a frame.
+  bool onPacket(const uint8_t* data, size_t len, uint32_t nowMs) {
+    DmxPacket p;
+    switch (parseDmxPacket(data, len, p)) {
+      case DMX_DATA:
+        return onData(p, nowMs);
+      case DMX_SYNC:
+        return onSync(p, nowMs);
+      default:
+        stats_.ignored++;
+        return false;
+    }
+  }
+
+  // Reader side (engine owner): the latest complete frame, RGB bytes for
+  // every mapped pixel. *fresh is set if it changed since the last call.
+  const uint8_t* frame(bool* fresh) {
+    *fresh = false;
+    if (state_.load(std::memory_order_acquire) & FRESH) {
+      frontIdx_ = state_.exchange(frontIdx_, std::memory_order_acq_rel) & INDEX;
+      *fresh = true;
+    }
+    return frames_[frontIdx_];
+  }
+
+  // True while frames keep arriving (any task)
+  bool active(uint32_t nowMs, uint32_t timeoutMs) const {
+    return stats_.frames != 0 && nowMs - lastFrameMs_.load(std::memory_order_relaxed) < timeoutMs;
+  }
+
+  bool synced() const { return syncMode_; }
+  uint8_t universes() const { return universes_; }
+  UniverseStats universeStats(uint8_t i) const { return map_[i].stats; }
+  Stats stats() const { return stats_; }
+
+ private:
+  static constexpr uint8_t INDEX = 0x3;
+  static constexpr uint8_t FRESH = 0x4;
+
+  struct Slot {
+    uint16_t universe;
+    uint16_t offset;  // first pixel in the frame
+    uint16_t pixels;
+    uint8_t lastSeq;
+    bool seqValid;
+    UniverseStats stats;
+  };
+
+  Slot* find(uint16_t universe) {
+    for (uint8_t i = 0; i < universes_; i++) {
+      if (map_[i].universe == universe) return &map_[i];
+    }
+    return nullptr;
+  }
+
+  // False for a straggler; counts sequence gaps
+  static bool checkSequence(Slot& u, const DmxPacket& p) {
+    if (p.protocol == DMX_ARTNET && p.sequence == 0) return true;  // sequencing disabled
+    // sACN counts 0-255; Art-Net 1-255 then wraps to 1
+    const int cycle = p.protocol == DMX_SACN ? 256 : 255;
+    const int seq = p.protocol == DMX_SACN ? p.sequence : p.sequence - 1;
+    if (u.seqValid) {
+      int diff = (seq - u.lastSeq + cycle) % cycle;
+      if (diff > cycle / 2) diff -= cycle;
+      if (diff <= 0 && diff > -20) {
+        u.stats.outOfOrder++;
+        return false;
+      }
+      if (diff > 1) u.stats.gaps += diff - 1;
+    }
+    u.lastSeq = (uint8_t)seq;
+    u.seqValid = true;
+    return true;
+  }
+
+  bool onData(const DmxPacket& p, uint32_t nowMs) {
+    if (p.preview || p.terminated) {
+      stats_.ignored++;
+      return false;
+    }
+    Slot* u = find(p.universe);
+    if (!u) {
+      stats_.unmapped++;
+      return false;
+    }
+    if (!checkSequence(*u, p)) return false;
+    u->stats.packets++;
+
+    if (syncMode_ && nowMs - lastSyncMs_ >= DMX_SYNC_TIMEOUT_MS) syncMode_ = false;  // sender stopped syncing
+    // sACN data asks for sync per packet; Art-Net holds everything once ArtSync is seen
+    const bool held = syncMode_ && (p.protocol == DMX_ARTNET || p.syncAddress != 0);
+    if (p.protocol == DMX_SACN) syncAddress_ = p.syncAddress;
+
+    const uint32_t bit = 1u << (u - map_);
+    bool published = false;
+    if (!held && (pending_ & bit)) published = publish(nowMs);  // repeat before the set was complete
+
+    uint16_t n = p.slotCount / 3;
+    if (n > u->pixels) n = u->pixels;
+    memcpy(frames_[backIdx_] + u->offset * 3, p.slots, n * 3);
+    pending_ |= bit;
+    if (!held && pending_ == allMask_) published = publish(nowMs);
+    return published;
+  }
+
+  bool onSync(const DmxPacket& p, uint32_t nowMs) {
+    // sACN: only our sync address (learned from the data packets)
+    if (p.protocol == DMX_SACN && p.universe != syncAddress_) {
+      stats_.ignored++;
+      return false;
+    }
+    syncMode_ = true;
+    lastSyncMs_ = nowMs;
+    if (!pending_) return false;
+    stats_.syncs++;
+    return publish(nowMs);
+  }
+
+  // Hand the back frame to the reader. The new back frame starts as a copy,
+  // so universes the next frame does not resend keep their pixels.
+  bool publish(uint32_t nowMs) {
+    const uint8_t done = backIdx_;
+    backIdx_ = state_.exchange(done | FRESH, std::memory_order_acq_rel) & INDEX;
+    memcpy(frames_[backIdx_], frames_[done], bytes_);
+    pending_ = 0;
+    stats_.frames++;
+    lastFrameMs_.store(nowMs, std::memory_order_relaxed);
+    return true;
+  }
+
+  uint8_t frames_[3][MaxPixels * 3] = {};
+  std::atomic<uint8_t> state_{1};  // ready frame index | FRESH
+  uint8_t frontIdx_ = 0;           // reader's frame
+  uint8_t backIdx_ = 2;            // writer's frame
+  std::atomic<uint32_t> lastFrameMs_{0};
+
+  Slot map_[MaxUniverses] = {};
+  uint8_t universes_ = 0;
+  uint32_t bytes_ = 0;
+  uint32_t allMask_ = 0;
+  uint32_t pending_ = 0;  // universes written since the last publish
+
+  bool syncMode_ = false;
+  uint32_t lastSyncMs_ = 0;
+  uint16_t syncAddress_ = 0;
+  Stats stats_ = {0, 0, 0, 0};
+};
+
+// UDP listener for both protocols: one socket per port, sACN multicast groups
+// joined per universe (unicast senders work too). Blocking receive with a
+// timeout, meant for a dedicated task.
+class DmxSocket {
+ public:
+  bool begin() {
+    sacn_ = openUdp(SACN_PORT);
+    artnet_ = openUdp(ARTNET_PORT);
+    return sacn_ >= 0 || artnet_ >= 0;
+  }
+
+  // sACN multicast group 239.255.<hi>.<lo> for one universe
+  bool joinUniverse(uint16_t universe) {
+    if (sacn_ < 0) return false;
+    struct ip_mreq mreq = {};
+    mreq.imr_multiaddr.s_addr = htonl(0xEFFF0000u | universe);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    return setsockopt(sacn_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0;
+  }
+
+  // Wait up to timeoutMs for a datagram on either port. Returns its length,
+  // 0 on timeout, -1 on error.
+  int receive(uint8_t* buf, size_t cap, uint32_t timeoutMs) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    int maxFd = -1;
+    if (sacn_ >= 0) FD_SET(sacn_, &fds), maxFd = sacn_;
+    if (artnet_ >= 0) FD_SET(artnet_, &fds), maxFd = artnet_ > maxFd ? artnet_ : maxFd;
+    if (maxFd < 0) return -1;
+    struct timeval tv = {(long)(timeoutMs / 1000), (long)(timeoutMs % 1000) * 1000};
+    const int ready = select(maxFd + 1, &fds, nullptr, nullptr, &tv);
+    if (ready <= 0) return ready;
+    const int fd = (sacn_ >= 0 && FD_ISSET(sacn_, &fds)) ? sacn_ : artnet_;
+    return (int)recv(fd, buf, cap, 0);
+  }
+
+  void end() {
+    if (sacn_ >= 0) close(sacn_);
+    if (artnet_ >= 0) close(artnet_);
+    sacn_ = artnet_ = -1;
+  }
+
+ private:
+  static int openUdp(uint16_t port) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) return -1;
+    const int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  int sacn_ = -1;
+  int artnet_ = -1;
+};
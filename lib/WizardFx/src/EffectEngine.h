@@ -0,0 +1,467 @@
+#pragma once
+
+// Shared background-effect engine for the hat, cape, staff and receiver.
+// Every firmware used to carry its own copy of the rainbow/breathing render
+// switch; this header is now the single place those kernels live.
+//
+// Usage (per firmware):
+//   using Layout = StrandLayout<NUM_LEDS, NUM_LEDS_STOLE>;
+//   EffectEngine<Layout> engine({ledsA, ledsStole});
+//   loop(): poll input -> engine.applySpell(id) ... engine.tick(micros()) -> engine.show()
+//
+// The engine keeps a dirty bit per strand. Anything that writes pixels (render,
+// clear, packet flash) sets it, and show() only calls FastLED.show() when at
+// least one strand changed, so idle loops and the gaps between effect ticks
+// cost no output time. Pixels are only written inside tick() (and clear()), so
+// code that overlaps output with other work (AsyncShow, FramePipeline) only has
+// to hold off tick() while a transfer is reading the buffers.
+//
+// Effects are phase-aligned to the clock passed to tick(): a (re)started
+// effect takes its phase from the time itself, not from when it was selected.
+// Devices ticking from a shared clock (ClockSync.h) therefore show the same
+// frame no matter when each one received the spell.
+
+#include <Arduino.h>
+#include <FastLED.h>
+
+#include "AnimClock.h"
+#include "ColorTables.h"
+#include "FrameProfile.h"
+
+// A strand can mirror another strand of the same length instead of being
+// rendered on its own. With no transform the two strands are aliased: both
+// FastLED controllers read the source buffer, so the mirror costs no render
+// time and no memory. With a transform the mirror keeps its own buffer and is
+// filled from the source's hue ramp by table lookup (no second HSV pass).
+struct StrandMirror {
+  int8_t source;     // strand to mirror, or -1 for an independently rendered strand
+  bool reverse;      // pixel i shows source pixel (n - 1 - i)
+  uint16_t offset;   // rotate along the strand by this many pixels
+  uint8_t hueShift;  // added to the hue of ramp-rendered effects
+
+  constexpr bool aliased() const { return source >= 0 && !reverse && offset == 0 && hueShift == 0; }
+};
+
+inline constexpr StrandMirror kNoMirror = {-1, false, 0, 0};
+
+// Compile-time description of the strands a firmware drives. Each entry is the
+// pixel count of one strand, listed in the same order the strands are
+// registered with FastLED.addLeds(). To mirror strands, derive from the layout
+// and shadow kMirror, e.g.
+//   struct HatLayout : StrandLayout<750, 750> {
+//     static constexpr StrandMirror kMirror[kStrands] = {kNoMirror, {0, false, 0, 0}};
+//   };
+template <uint16_t... Lengths>
+struct StrandLayout {
+  static constexpr uint8_t kStrands = sizeof...(Lengths);
+  static constexpr uint16_t kLength[kStrands] = {Lengths...};
+  static constexpr uint32_t kTotalPixels = (0u + ... + Lengths);
+  // Per-strand hue offset tables (see ColorTables.h)
+  static constexpr const uint8_t* kHueOffset[kStrands] = {kHueRamp<Lengths>.offset...};
+  static constexpr StrandMirror kMirror[kStrands] = {((void)Lengths, kNoMirror)...};
+  static_assert(kStrands > 0, "StrandLayout needs at least one strand");
+};
+
+// Background effects selectable by spells 1-4 (spells 0/3/4 all mean "off")
+enum BackgroundEffect : uint8_t {
+  FX_OFF = 0,
+  FX_RAINBOW = 1,
+  FX_BREATHING = 2,
+};
+
+// Everything needed to reproduce the running effect elsewhere: parameters
+// plus the animation phase as of atUs (the clock passed to tick()).
+struct EffectState {
+  uint8_t effect;         // BackgroundEffect
+  uint8_t brightness;
+  uint32_t tempoQ16;
+  uint32_t phaseQ16;      // hue phase
+  uint32_t breathPosQ16;  // position on the breathing triangle
+  uint32_t atUs;
+};
+
+template <class Layout>
+class EffectEngine {
+ public:
+  static constexpr uint8_t kStrands = Layout::kStrands;
+  static_assert(kStrands <= 32, "dirty mask holds at most 32 strands");
+  static constexpr uint32_t kAllStrands = (kStrands == 32) ? 0xFFFFFFFFu : ((1u << kStrands) - 1u);
+
+  // Mirrors must reference an independently rendered strand of equal length
+  static constexpr bool mirrorsValid() {
+    for (uint8_t s = 0; s < kStrands; s++) {
+      const StrandMirror& m = Layout::kMirror[s];
+      if (m.source < 0) continue;
+      if (m.source >= kStrands || Layout::kMirror[m.source].source >= 0) return false;
+      if (Layout::kLength[m.source] != Layout::kLength[s]) return false;
+    }
+    return true;
+  }
+  static_assert(mirrorsValid(), "invalid StrandMirror in layout");
+
+  // Tempo control (Q16.16 multiplier, applies to all background effects)
+  static constexpr uint32_t TEMPO_MIN = q16FromFloat(0.25f);   // 0.25x (very slow)
+  static constexpr uint32_t TEMPO_MAX = q16FromFloat(4.0f);    // 4x (very fast)
+  static constexpr uint32_t TEMPO_DOWN = q16FromFloat(0.85f);  // spell 5: ~15% slower
+  static constexpr uint32_t TEMPO_UP = q16FromFloat(1.15f);    // spell 6: ~15% faster
+  static constexpr uint8_t BRIGHTNESS_STEP = 16;  // Step used by spells 7/8
+
+  // Time per animation step at 1.0x tempo
+  static constexpr uint32_t RAINBOW_STEP_US = 20000;  // one hue step
+  static constexpr uint32_t BREATH_STEP_US = 15000;   // one hue step + BREATH_STEP brightness
+  static constexpr uint8_t BREATH_STEP = 4;
+  static constexpr uint32_t PACKET_FLASH_US = 120000;
+  // A longer gap between ticks (clock step, stalled loop) realigns the effect
+  static constexpr uint32_t MAX_TICK_GAP_US = 1000000;
+
+  explicit EffectEngine(CRGB* const (&strands)[kStrands]) {
+    attach(strands);
+    stale_ = false;
+  }
+
+  // Render into a different buffer set (double buffering). The new buffers
+  // hold an older frame, so the next output is always a full repaint.
+  void attach(CRGB* const (&strands)[kStrands]) {
+    for (uint8_t s = 0; s < kStrands; s++) {
+      // Aliased mirrors always point at their source buffer
+      const StrandMirror& m = Layout::kMirror[s];
+      strands_[s] = m.aliased() ? strands[m.source] : strands[s];
+    }
+    stale_ = true;
+  }
+
+  // Spells mapping:
+  // 0/3/4: off, 1: rainbow, 2: breathing
+  // 5: tempo down, 6: tempo up, 7: brightness down, 8: brightness up
+  // Anything else is ignored here (receivers may still flash on it).
+  void applySpell(int spell) {
+    switch (spell) {
+      case 0:
+      case 3:
+      case 4:
+        setEffect(FX_OFF);
+        break;
+      case 1:
+        setEffect(FX_RAINBOW);
+        break;
+      case 2:
+        setEffect(FX_BREATHING);
+        break;
+      case 5:
+        setTempoQ16(q16Mul(tempoQ16_, TEMPO_DOWN));
+        break;
+      case 6:
+        setTempoQ16(q16Mul(tempoQ16_, TEMPO_UP));
+        break;
+      case 7: {
+        uint16_t b = brightness_;
+        if (b > BRIGHTNESS_STEP) b -= BRIGHTNESS_STEP; else b = 1;
+        setBrightness((uint8_t)b);
+      } break;
+      case 8: {
+        uint16_t b = brightness_;
+        b = (b + BRIGHTNESS_STEP > 255) ? 255 : (b + BRIGHTNESS_STEP);
+        setBrightness((uint8_t)b);
+      } break;
+      default:
+        break;
+    }
+  }
+
+  // Select a background effect. Re-selecting the running effect keeps its phase.
+  void setEffect(BackgroundEffect fx) {
+    if (fx == effect_) return;
+    effect_ = fx;
+    switch (fx) {
+      case FX_RAINBOW:
+        hue_.setRate(RAINBOW_STEP_US, tempoQ16_);
+        restart_ = true;  // phase is aligned to the clock on the next tick
+        break;
+      case FX_BREATHING:
+        hue_.setRate(BREATH_STEP_US, tempoQ16_);
+        restart_ = true;
+        break;
+      default:
+        effect_ = FX_OFF;
+        restart_ = true;  // cleared by the next tick, not while a show may be reading
+        break;
+    }
+  }
+
+  void setBrightness(uint8_t b) {
+    brightness_ = b;
+    FastLED.setBrightness(brightness_);
+    dirty_ = kAllStrands;  // output scaling changed even if pixels did not
+  }
+
+  // Tempo as a Q16.16 multiplier (Q16_ONE = normal speed), clamped to limits
+  void setTempoQ16(uint32_t tempo) {
+    if (tempo < TEMPO_MIN) tempo = TEMPO_MIN;
+    if (tempo > TEMPO_MAX) tempo = TEMPO_MAX;
+    tempoQ16_ = tempo;
+    // Phase is kept, so a tempo change never jumps the animation
+    hue_.setRate(effect_ == FX_BREATHING ? BREATH_STEP_US : RAINBOW_STEP_US, tempoQ16_);
+  }
+
+  // Snapshot of the running effect as of the last tick
+  EffectState state() const {
+    return {effect_, brightness_, tempoQ16_, hue_.phase(), breathPos_, lastTickUs_};
+  }
+
+  // Adopt a state from another device on the same clock. Parameters are
+  // taken as-is; the phase only when it differs from ours by a whole step or
+  // more, so devices already in step do not twitch. The next tick advances
+  // the adopted phase from s.atUs. Returns true if effect, brightness or
+  // tempo changed.
+  bool syncState(const EffectState& s) {
+    const bool changed = s.effect != effect_ || s.brightness != brightness_ || s.tempoQ16 != tempoQ16_;
+    if (s.effect != effect_) setEffect((BackgroundEffect)s.effect);
+    if (s.brightness != brightness_) setBrightness(s.brightness);
+    if (s.tempoQ16 != tempoQ16_) setTempoQ16(s.tempoQ16);
+    // Our phase extrapolated to s.atUs (either side of the last tick)
+    const int32_t dt = (int32_t)(s.atUs - lastTickUs_);
+    const uint32_t span = dt >= 0 ? (uint32_t)dt : (uint32_t)-dt;
+    const uint32_t inc = (uint32_t)(hue_.phaseAt(span));
+    const uint32_t ours = dt >= 0 ? hue_.phase() + inc : hue_.phase() - inc;
+    const int32_t err = (int32_t)(s.phaseQ16 - ours);
+    if (restart_ || err >= (int32_t)Q16_ONE || err <= -(int32_t)Q16_ONE) {
+      hue_.reset(s.phaseQ16);
+      breathPos_ = s.breathPosQ16;
+      lastTickUs_ = s.atUs;
+      restart_ = false;
+      repaint_ = true;
+    }
+    return changed;
+  }
+
+  // Re-derive the running effect's phase from the clock on the next tick.
+  // Call after the clock passed to tick() jumped (ClockSync re-anchor).
+  void realign() { restart_ = true; }
+
+  // Green pixel-0 acknowledgement on every strand for PACKET_FLASH_US
+  void flashPacket(uint32_t nowUs) {
+    flashActive_ = true;
+    flashPainted_ = false;
+    flashUntilUs_ = nowUs + PACKET_FLASH_US;
+  }
+
+  // Advance the running effect to nowUs (micros() or a shared clock). Elapsed
+  // time, not the number of calls, drives the animation, so skipped or late
+  // frames just land further along. Returns true when the strand buffers changed.
+  bool tick(uint32_t nowUs) {
+    const int32_t elapsed = (int32_t)(nowUs - lastTickUs_);
+    uint32_t dtUs = 0;
+    if (elapsed > (int32_t)MAX_TICK_GAP_US || elapsed < -(int32_t)MAX_TICK_GAP_US) {
+      restart_ = true;
+    } else if (elapsed > 0) {
+      dtUs = (uint32_t)elapsed;
+    }
+    // A small backwards step (clock correction, adopted state from the
+    // future) holds the animation until the clock catches up
+    if (elapsed > 0 || restart_) lastTickUs_ = nowUs;
+    bool frame = restart_ || repaint_;
+    repaint_ = false;
+    if (restart_) {
+      // Freshly selected or realigned: phase as a function of the clock
+      const uint64_t phase = hue_.phaseAt(nowUs);
+      hue_.reset((uint32_t)phase);
+      const uint32_t span = (uint32_t)(brightness_ - brightness_ / 10);
+      breathPos_ = span ? (uint32_t)((phase * BREATH_STEP) % ((2u * span) << 16)) : 0;
+      dtUs = 0;
+      restart_ = false;
+    }
+
+    switch (effect_) {
+      case FX_RAINBOW: {
+        hue_.advance(dtUs);
+        const uint8_t hue = (uint8_t)hue_.steps();  // wraps at 256
+        if (hue != frameHue_) frame = true;
+        frameHue_ = hue;
+      } break;
+
+      case FX_BREATHING: {
+        const uint32_t inc = hue_.advance(dtUs);
+        const uint8_t hue = (uint8_t)hue_.steps();  // step hue slowly for variation
+
+        // Triangle wave between 10% and 100% of brightness, BREATH_STEP per step
+        const uint8_t maxBreath = brightness_;
+        const uint8_t minBreath = brightness_ / 10;
+        const uint32_t span = (uint32_t)(maxBreath - minBreath);
+        uint8_t value = maxBreath;
+        if (span > 0) {
+          const uint32_t periodQ16 = (2u * span) << 16;
+          breathPos_ = (breathPos_ + inc * BREATH_STEP) % periodQ16;
+          // Quantized to whole steps so breathing repaints at the step cadence
+          uint32_t pos = breathPos_ >> 16;
+          pos -= pos % BREATH_STEP;
+          value = (pos < span) ? (uint8_t)(minBreath + pos) : (uint8_t)(maxBreath - (pos - span));
+        }
+        if (hue != frameHue_ || value != breathBrightness_) frame = true;
+        frameHue_ = hue;
+        breathBrightness_ = value;
+      } break;
+
+      default:
+        break;
+    }
+
+    if (flashActive_ && (int32_t)(nowUs - flashUntilUs_) >= 0) {
+      // Flash over: repaint so pixel 0 returns to the background
+      flashActive_ = false;
+      frame = true;
+    }
+
+    // A stale buffer set cannot take a partial update (flash overlay alone,
+    // brightness-only change): repaint it first
+    if (stale_ && (dirty_ || (flashActive_ && !flashPainted_))) frame = true;
+
+    if (frame) render();
+    // Overlay only when the background was repainted or the flash just began
+    if (flashActive_ && (frame || !flashPainted_)) {
+      overlayFlash();
+      flashPainted_ = true;
+      frame = true;
+    }
+    return frame;
+  }
+
+  // Push the frame to the LEDs if any strand changed since the last show().
+  // All controllers go out together: the ESP32 RMT driver batches every
+  // registered controller into one transfer, so a partial show would stall.
+  bool show() {
+    if (!takeDirty()) return false;
+    FastLED.show();
+    return true;
+  }
+
+  // Returns and clears the dirty mask, for callers that do their own output
+  uint32_t takeDirty() {
+    const uint32_t d = dirty_;
+    dirty_ = 0;
+    return d;
+  }
+
+  void clear() {
+    for (uint8_t s = 0; s < kStrands; s++) {
+      if (!owns(s)) continue;
+      fill_solid(strands_[s], Layout::kLength[s], CRGB::Black);
+    }
+    dirty_ = kAllStrands;
+    stale_ = false;
+  }
+
+  // For code that writes the strand buffers directly (e.g. OTA visuals)
+  void markDirty(uint32_t mask = kAllStrands) { dirty_ |= mask & kAllStrands; }
+  uint32_t dirtyMask() const { return dirty_; }
+
+  // Strands whose pixels the caller supplies (e.g. a streamed frame, see
+  // PixelStream.h): render, clear and the flash overlay leave them alone. The
+  // caller writes them before each tick() and marks them dirty. Changing the
+  // mask repaints on the next tick, so released strands get the effect back.
+  void setExternal(uint32_t mask) {
+    mask &= kAllStrands;
+    if (mask == external_) return;
+    external_ = mask;
+    repaint_ = true;
+  }
+  uint32_t external() const { return external_; }
+
+  BackgroundEffect effect() const { return effect_; }
+  uint8_t brightness() const { return brightness_; }
+  uint32_t tempoQ16() const { return tempoQ16_; }
+  float tempo() const { return tempoQ16_ / (float)Q16_ONE; }  // for logging
+  CRGB* strand(uint8_t s) const { return strands_[s]; }
+#if FRAME_PROFILE
+  // The effect kernel alone, without the tick's clock and spell work ("prof")
+  TimingHistogram& kernelTimes() { return kernelTimes_; }
+#endif
+
+ private:
+  // Paint the current effect state. Hue ramps are scaled per strand length so
+  // every strand shows one full rainbow regardless of its pixel count.
+  void render() {
+    PROFILE_BEGIN(start);
+    switch (effect_) {
+      case FX_RAINBOW:
+        renderRamp(frameHue_, brightness_);
+        break;
+      case FX_BREATHING:
+        renderRamp(frameHue_, breathBrightness_);
+        break;
+      default:
+        clear();
+        break;
+    }
+    PROFILE_END(kernelTimes_, start);
+    stale_ = false;
+  }
+
+  // One wheel lookup per pixel; the wheel is only rebuilt when value changes
+  void renderRamp(uint8_t baseHue, uint8_t value) {
+    const CRGB* wheel = wheel_.at(value);
+    for (uint8_t s = 0; s < kStrands; s++) {
+      if (!owns(s)) continue;
+      const StrandMirror& m = Layout::kMirror[s];
+      CRGB* leds = strands_[s];
+      const uint16_t n = Layout::kLength[s];
+      if (m.source < 0) {
+        const uint8_t* offset = Layout::kHueOffset[s];
+        for (uint16_t i = 0; i < n; i++) {
+          leds[i] = wheel[(uint8_t)(baseHue + offset[i])];
+        }
+      } else {
+        // Transformed mirror: source ramp, rotated/reversed and hue-shifted
+        const uint8_t* offset = Layout::kHueOffset[m.source];
+        const uint8_t hue = baseHue + m.hueShift;
+        uint16_t k = m.offset % n;
+        for (uint16_t i = 0; i < n; i++) {
+          uint16_t src = m.reverse ? (uint16_t)(n - 1 - k) : k;
+          leds[i] = wheel[(uint8_t)(hue + offset[src])];
+          if (++k == n) k = 0;
+        }
+      }
+    }
+    dirty_ = kAllStrands;
+  }
+
+  void overlayFlash() {
+    for (uint8_t s = 0; s < kStrands; s++) {
+      if (!owns(s)) continue;
+      strands_[s][0] = CRGB::Green;
+      strands_[s][0].nscale8(brightness_);
+    }
+    dirty_ = kAllStrands;
+  }
+
+  // Aliased mirrors share their source buffer; external strands belong to the caller
+  bool owns(uint8_t s) const { return !Layout::kMirror[s].aliased() && !(external_ & (1u << s)); }
+
+  CRGB* strands_[kStrands];
+  ColorWheel wheel_;
+  uint32_t external_ = 0;
+#if FRAME_PROFILE
+  TimingHistogram kernelTimes_;
+#endif
+
+  BackgroundEffect effect_ = FX_OFF;
+  uint8_t brightness_ = 128;
+  uint32_t tempoQ16_ = Q16_ONE;  // 1.0 = normal speed
+
+  // Hue phase (whole steps = hue); drives rainbow and the breathing hue
+  PhaseAccumulator hue_;
+  uint32_t lastTickUs_ = 0;
+  bool restart_ = false;  // effect just selected: render it on the next tick
+  bool repaint_ = false;  // phase adopted by syncState(): render the next tick
+  uint8_t frameHue_ = 0;  // hue of the frame currently in the buffers
+
+  // Background breathing effect (effect 2): Q16.16 position on the triangle
+  uint32_t breathPos_ = 0;
+  uint8_t breathBrightness_ = 0;
+
+  bool flashActive_ = false;
+  bool flashPainted_ = false;
+  uint32_t flashUntilUs_ = 0;
+
+  uint32_t dirty_ = kAllStrands;  // strands changed since the last show()
+  bool stale_ = false;            // buffers were swapped since the last full paint
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+// Two-core render/output pipeline for an EffectEngine.
+//
+// A render task (APP core by default) ticks the engine into a back buffer set
+// while an AsyncShow output task (PRO core) clocks the previous frame out.
+// Once the previous transfer is done, render points the FastLED controllers at
+// the finished set, starts its transfer and takes the other set as its new back
+// buffer. The handoff is an atomic busy flag plus task notifications; neither
+// side ever takes a lock or copies pixels.
+//
+// Usage (per firmware):
+//   CRGB* const front[] = {ledsA, ledsB};   // the buffers given to addLeds()
+//   CRGB* const back[]  = {ledsA2, ledsB2}; // same sizes
+//   FramePipeline<Layout> pipeline(engine, front, back);
+//   pipeline.begin(handleDeferredWork, TARGET_FPS);  // hook runs on the render task
+//
+// Once running, the render task owns the engine: spells must be applied from
+// the hook, not from loop().
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "AsyncShow.h"
+#include "EffectEngine.h"
+#include "FrameProfile.h"
+#include "FrameScheduler.h"
+
+template <class Layout>
+class FramePipeline {
+ public:
+  static constexpr uint8_t kStrands = Layout::kStrands;
+  using Engine = EffectEngine<Layout>;
+  using Hook = void (*)();
+  using Clock = uint32_t (*)();  // animation time in microseconds
+
+  static constexpr uint32_t TASK_STACK = 4096;
+  static constexpr UBaseType_t RENDER_PRIORITY = 2;  // above loop() (1)
+
+  FramePipeline(Engine& engine, CRGB* const (&front)[kStrands], CRGB* const (&back)[kStrands])
+      : engine_(engine) {
+    for (uint8_t s = 0; s < kStrands; s++) {
+      // FastLED controllers of aliased mirrors read their source buffer
+      const StrandMirror& m = Layout::kMirror[s];
+      const uint8_t src = m.aliased() ? m.source : s;
+      sets_[0][s] = front[src];
+      sets_[1][s] = back[src];
+    }
+  }
+
+  // Start both tasks. The render task wakes once per frame at targetFps; hook
+  // (may be null) runs on it before every tick. Returns false if a task could
+  // not be created; the caller then keeps rendering on its own task.
+  bool begin(Hook hook, uint16_t targetFps, BaseType_t renderCore = 1, BaseType_t outputCore = 0) {
+    if (running_) return true;
+    hook_ = hook;
+    scheduler_.setTargetFps(targetFps);
+    back_ = 1;
+    engine_.attach(sets_[back_]);
+    if (!output_.begin(outputCore) ||
+        xTaskCreatePinnedToCore(renderTask, "fxRender", TASK_STACK, this, RENDER_PRIORITY,
+                                &renderHandle_, renderCore) != pdPASS) {
+      engine_.attach(sets_[0]);
+      return false;
+    }
+    running_ = true;
+    return true;
+  }
+
+  // Time source for engine ticks (default micros()), e.g. a ClockSync-backed
+  // shared clock. Set before begin().
+  void setClock(Clock clock) { clock_ = clock; }
+
+  bool running() const { return running_; }
+
+  // Stop rendering, e.g. while an OTA update draws its own progress. Returns
+  // once the render task is idle and the last frame is off the wire, with the
+  // FastLED controllers back on the front buffers, so the caller may draw
+  // into those and call FastLED.show() itself. Call from another task.
+  void pause() {
+    if (!running_ || paused_) return;
+    pauseRequested_ = true;
+    while (!paused_) vTaskDelay(1);
+    while (output_.busy()) vTaskDelay(1);
+    for (uint8_t s = 0; s < kStrands; s++) {
+      FastLED[s].setLeds(sets_[0][s], Layout::kLength[s]);
+    }
+    back_ = 1;
+    engine_.attach(sets_[back_]);
+  }
+
+  void resume() {
+    pauseRequested_ = false;
+    paused_ = false;
+  }
+  // Output metrics; blocked time is the render task waiting for the wire
+  AsyncShow& output() { return output_; }
+  // Frame pacing metrics (late frames) of the render task
+  FrameScheduler& scheduler() { return scheduler_; }
+
+#if FRAME_PROFILE
+  // Per frame on the render task: the hook (radio queues), engine tick, and
+  // the whole frame including any wait for the previous transfer
+  TimingHistogram& radioTimes() { return radioTimes_; }
+  TimingHistogram& renderTimes() { return renderTimes_; }
+  TimingHistogram& frameTimes() { return frameTimes_; }
+#endif
+
+ private:
+  static void renderTask(void* arg) { static_cast<FramePipeline*>(arg)->renderLoop(); }
+
+  void renderLoop() {
+    for (;;) {
+      scheduler_.wait();  // sleep until this frame's deadline
+      paused_ = pauseRequested_;
+      if (paused_) continue;
+      PROFILE_BEGIN(frameStart);
+      if (hook_) {
+        PROFILE_BEGIN(hookStart);
+        hook_();
+        PROFILE_END(radioTimes_, hookStart);
+      }
+      PROFILE_BEGIN(tickStart);
+      engine_.tick(clock_ ? clock_() : micros());
+      PROFILE_END(renderTimes_, tickStart);
+      if (engine_.takeDirty()) handOff();  // else nothing changed this frame
+      PROFILE_END(frameTimes_, frameStart);
+    }
+  }
+
+  // Wait until the frame on the wire is done, hand this one over and take
+  // the released set as the new back buffer
+  void handOff() {
+    output_.waitDone();
+    for (uint8_t s = 0; s < kStrands; s++) {
+      FastLED[s].setLeds(sets_[back_][s], Layout::kLength[s]);
+    }
+    output_.start();
+    back_ ^= 1;
+    engine_.attach(sets_[back_]);
+  }
+
+  Engine& engine_;
+  AsyncShow output_;
+  FrameScheduler scheduler_;
+  CRGB* sets_[2][kStrands];
+  uint8_t back_ = 1;  // set the render task is drawing into
+  Hook hook_ = nullptr;
+  Clock clock_ = nullptr;
+  TaskHandle_t renderHandle_ = nullptr;
+  volatile bool running_ = false;
+  volatile bool pauseRequested_ = false;
+  volatile bool paused_ = false;  // render task saw the request and is idle
+#if FRAME_PROFILE
+  TimingHistogram radioTimes_;
+  TimingHistogram renderTimes_;
+  TimingHistogram frameTimes_;
+#endif
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+// Per-phase timing histograms: render (and its effect kernel), show, radio
+// drain, OTA handling, loop.
+//
+// The averages in the 10 s "LED output:" report hide the frames that matter:
+// one slow show() in a hundred is a visible stutter. Each phase instead feeds
+// a TimingHistogram of fixed log-linear buckets (four per octave, exact below
+// 8 us, one catch-all above ~115 ms), from which p50/p99 can be read to within
+// a quarter octave, plus the exact maximum. Recording is two CCOUNT reads, a
+// count-leading-zeros and an increment, with no locks.
+//
+//   PROFILE_BEGIN(t0);
+//   engine.tick(now);
+//   PROFILE_END(renderTimes, t0);
+//
+// CCOUNT is per core, so only time code on a task pinned to one core (all of
+// ours are). Each histogram has a single writer. Readers (the NetSerial
+// "prof" command) may see a frame half-counted, which is fine for statistics.
+//
+// Build with -DFRAME_PROFILE=1 (the cape and staff envs do). Without it the
+// macros expand to nothing and no histogram exists.
+
+#ifndef FRAME_PROFILE
+#define FRAME_PROFILE 0
+#endif
+
+#if FRAME_PROFILE
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+class TimingHistogram {
+ public:
+  static constexpr uint8_t kBuckets = 64;
+
+  void add(uint32_t us) {
+    if (resetRequested_) {
+      memset((void*)counts_, 0, sizeof(counts_));
+      count_ = 0;
+      max_ = 0;
+      resetRequested_ = false;
+    }
+    counts_[bucketOf(us)]++;
+    count_++;
+    if (us > max_) max_ = us;
+  }
+
+  void addCycles(uint32_t cycles) { add(cycles / cyclesPerUs()); }
+
+  // Applied by the writer on its next add(), so it never races a write
+  void reset() { resetRequested_ = true; }
+
+  uint32_t count() const { return count_; }
+  uint32_t max() const { return max_; }
+
+  // Upper bound of the bucket holding the pct-th percentile (never above max)
+  uint32_t percentile(uint8_t pct) const {
+    const uint32_t n = count_;
+    if (!n) return 0;
+    const uint32_t rank = (uint32_t)(((uint64_t)n * pct + 99) / 100);
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b < kBuckets; b++) {
+      seen += counts_[b];
+      if (seen >= rank) {
+        const uint32_t upper = bucketUpper(b);
+        return upper < max_ ? upper : max_;
+      }
+    }
+    return max_;
+  }
+
+  // "render   3051   410   820  1034" (us); returns snprintf's result
+  int format(char* buf, size_t size, const char* name) const {
+    return snprintf(buf, size, "  %-8s %8lu %7lu %7lu %7lu\n", name, (unsigned long)count(),
+                    (unsigned long)percentile(50), (unsigned long)percentile(99), (unsigned long)max());
+  }
+
+  static uint8_t bucketOf(uint32_t us) {
+    if (us < 8) return (uint8_t)us;
+    const uint8_t e = 31 - __builtin_clz(us);  // >= 3
+    const uint32_t b = 8 + (e - 3) * 4 + ((us >> (e - 2)) & 3);
+    return b < kBuckets ? (uint8_t)b : kBuckets - 1;
+  }
+
+  static uint32_t bucketUpper(uint8_t b) {
+    if (b < 8) return b;
+    if (b == kBuckets - 1) return UINT32_MAX;
+    const uint8_t e = 3 + (b - 8) / 4;
+    const uint32_t lower = (4u + (b - 8) % 4) << (e - 2);
+    return lower + (1u << (e - 2)) - 1;
+  }
+
+ private:
+  static uint32_t cyclesPerUs() {
+    static const uint32_t mhz = getCpuFrequencyMhz();
+    return mhz;
+  }
+
+  volatile uint32_t counts_[kBuckets] = {};
+  volatile uint32_t count_ = 0;
+  volatile uint32_t max_ = 0;
+  volatile bool resetRequested_ = false;
+};
+
+// Column header for TimingHistogram::format()
+static constexpr const char* kProfileHeader = "  phase       count  p50 us  p99 us  max us\n";
+
+#define PROFILE_BEGIN(var) const uint32_t var = ESP.getCycleCount()
+#define PROFILE_END(hist, var) (hist).addCycles(ESP.getCycleCount() - (var))
+#else
+#define PROFILE_BEGIN(var)
+#define PROFILE_END(hist, var)
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+// Deadline-driven frame pacing.
+//
+// Frames start on a fixed grid of deadlines (1 / target FPS apart). wait()
+// sleeps the calling task until the next deadline, so the CPU is free for
+// WiFi and the idle task in between instead of busy-polling timers. A frame
+// that starts after its slot has already passed counts as late; the grid is
+// then re-anchored to now rather than bursting frames to catch up, since the
+// animation clock is time-based anyway.
+//
+// The sleep is vTaskDelayUntil() on a wake tick kept across frames. Render
+// time is therefore not added on top of the delay. The sub-tick part of each
+// period is carried to the next frame, so 60 fps at 1 kHz ticks alternates
+// 16 and 17 ticks instead of truncating every period to 16.
+//
+// wait() is the only writer of the stats. Other tasks may read stats() and
+// takeInterval(). The interval's worst overrun is cleared by the writer on
+// its next wait(), like TimingHistogram::reset().
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+class FrameScheduler {
+ public:
+  struct Stats {
+    uint32_t frames;       // frames started
+    uint32_t late;         // frames that started after their slot had passed
+    uint32_t worstLateUs;  // largest overrun past a deadline
+  };
+
+  explicit FrameScheduler(uint16_t targetFps = 60) { setTargetFps(targetFps); }
+
+  void setTargetFps(uint16_t fps) {
+    if (fps == 0) fps = 1;
+    periodUs_ = 1000000UL / fps;
+  }
+  uint16_t targetFps() const { return (uint16_t)(1000000UL / periodUs_); }
+  uint32_t periodUs() const { return periodUs_; }
+
+  // Sleep until the next frame deadline. Returns false if the previous frame
+  // overran it (the new frame starts immediately and is counted as late).
+  bool wait() {
+    if (resetWorst_) {
+      worstLateUs_ = 0;
+      resetWorst_ = false;
+    }
+    const uint32_t now = micros();
+    if (!started_) {
+      started_ = true;
+      anchor(now, now);
+    }
+    bool onTime = true;
+    const int32_t slack = (int32_t)(deadlineUs_ - now);
+    if (slack >= 0) {
+      // Wakes up to one tick early, which only shifts this frame, not the grid
+      if (stepTicks_ > 0) vTaskDelayUntil(&wakeTick_, stepTicks_);
+      advance();
+    } else {
+      const uint32_t overrun = (uint32_t)-slack;
+      if (overrun > worstLateUs_) worstLateUs_ = overrun;
+      late_++;
+      onTime = false;
+      anchor(now, now + periodUs_);  // re-anchor, no catch-up burst
+    }
+    frames_++;
+    return onTime;
+  }
+
+  Stats stats() const { return {frames_, late_, worstLateUs_}; }
+
+  // Stats accumulated since the previous call, for periodic reports
+  Stats takeInterval() {
+    const Stats now = stats();
+    const Stats d = {now.frames - last_.frames, now.late - last_.late, now.worstLateUs};
+    last_ = now;
+    resetWorst_ = true;
+    return d;
+  }
+
+ private:
+  static constexpr uint32_t kTickUs = 1000000UL / configTICK_RATE_HZ;
+
+  // Next deadline at deadlineUs; the wake tick restarts from the current tick
+  void anchor(uint32_t nowUs, uint32_t deadlineUs) {
+    deadlineUs_ = deadlineUs;
+    wakeTick_ = xTaskGetTickCount();
+    carryUs_ = deadlineUs - nowUs;
+    stepTicks_ = carryUs_ / kTickUs;
+    carryUs_ -= stepTicks_ * kTickUs;
+  }
+
+  // Step the deadline, and the tick it maps to, by one period
+  void advance() {
+    deadlineUs_ += periodUs_;
+    carryUs_ += periodUs_;
+    stepTicks_ = carryUs_ / kTickUs;
+    carryUs_ -= stepTicks_ * kTickUs;
+  }
+
+  uint32_t periodUs_ = 16666;
+  uint32_t deadlineUs_ = 0;
+  TickType_t wakeTick_ = 0;   // tick the previous sleep ended on
+  TickType_t stepTicks_ = 0;  // ticks from wakeTick_ to deadlineUs_
+  uint32_t carryUs_ = 0;      // part of a tick not yet slept
+  bool started_ = false;
+  // Written by wait() only
+  volatile uint32_t frames_ = 0;
+  volatile uint32_t late_ = 0;
+  volatile uint32_t worstLateUs_ = 0;
+  volatile bool resetWorst_ = false;
+  Stats last_ = {0, 0, 0};  // reader's snapshot for takeInterval()
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+// Per-peer ESP-NOW link counters, for diagnosing lost spells.
+//
+// The receive callback reports every frame, and whether any decoder accepted
+// it, with onFrame(). Per sender MAC that counts:
+//
+//   received    frames of any kind, valid or not
+//   malformed   frames every decoder rejected (bad length, magic, CRC)
+//   duplicates  v2 sequence numbers seen before (retransmissions)
+//   missing     v2 sequence numbers skipped and not received since
+//   restarts    sequence jumped far away: the sender rebooted
+//
+// Sequence accounting covers spells, sync beacons and state frames, which
+// share the staff's counter. ACKs echo the spell's seq and pixel fragments
+// have their own counter (PixelStream.h reports those), so they are only
+// counted as received.
+//
+// Build with LINK_RSSI=1 (off by default) for per-peer RSSI. enableRssi()
+// then puts the radio in promiscuous mode for management frames, where
+// ESP-NOW travels as vendor action frames, and records the RSSI of the last
+// frame from each known peer. The receive callback of this core version has
+// no RSSI. The filter passes every beacon in range to the callback as well,
+// which rejects them on the first byte but still costs WiFi task time, so it
+// is meant for link debugging sessions, not for shows.
+//
+// The staff registers onSent() as the ESP-NOW send callback. For broadcasts,
+// "delivered" only means the frame went out on the air.
+//
+// All writers run on the WiFi task. Readers (the NetSerial console, periodic
+// reports) may see a frame half-counted, which is fine for statistics.
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "SpellPacket.h"
+
+#ifndef LINK_PEERS
+#define LINK_PEERS 4  // senders tracked; frames from others only count in others()
+#endif
+#ifndef LINK_RSSI
+#define LINK_RSSI 0  // promiscuous RX for per-peer RSSI
+#endif
+
+struct LinkPeer {
+  uint8_t mac[6];
+  uint32_t received;
+  uint32_t malformed;
+  uint32_t duplicates;
+  uint32_t missing;
+  uint32_t restarts;
+  int8_t rssi;      // dBm of the last frame, 0 until one is seen
+  uint32_t lastMs;  // millis() of the last frame
+  // Sequence window: highest seq and a bitmap of the 32 below it
+  bool seqValid;
+  uint32_t topSeq;
+  uint32_t seqMask;
+};
+
+class LinkHealth {
+ public:
+  static constexpr uint8_t kPeers = LINK_PEERS;
+  static constexpr uint32_t kRestartGap = 1000;  // seq jumps further than this start afresh
+
+  // Receive callback: one frame from mac; valid if some decoder accepted it
+  __attribute__((always_inline)) inline void onFrame(const uint8_t* mac, const uint8_t* data, int len, bool valid,
+                                                     uint32_t nowMs) {
+    LinkPeer* p = find(mac, true);
+    if (!p) {
+      others_++;
+      return;
+    }
+    p->received++;
+    p->lastMs = nowMs;
+    if (!valid) {
+      p->malformed++;
+      return;
+    }
+    if (len < (int)sizeof(SpellHeader)) return;  // v1: no sequence number
+    const SpellHeader* h = reinterpret_cast<const SpellHeader*>(data);
+    if (h->type == SPELL_MSG_SPELL || h->type == SPELL_MSG_SYNC || h->type == SPELL_MSG_STATE) trackSeq(*p, h->seq);
+  }
+
+  // Send callback (staff)
+  void onSent(bool ok) {
+    if (ok) sent_++;
+    else sendFailed_++;
+  }
+
+  // Promiscuous mode for RSSI; call after esp_now_init(). Only one
+  // LinkHealth can own the callback. False with LINK_RSSI=0 or if the driver
+  // refused.
+  bool enableRssi() {
+#if LINK_RSSI
+    instance_ = this;
+    const wifi_promiscuous_filter_t filter = {WIFI_PROMIS_FILTER_MASK_MGMT};
+    return esp_wifi_set_promiscuous_filter(&filter) == ESP_OK &&
+           esp_wifi_set_promiscuous_rx_cb(onPromiscuous) == ESP_OK && esp_wifi_set_promiscuous(true) == ESP_OK;
+#else
+    return false;
+#endif
+  }
+
+  uint8_t peers() const { return peers_; }
+  const LinkPeer& peer(uint8_t i) const { return peer_[i]; }
+  uint32_t others() const { return others_; }  // frames from senders beyond kPeers
+  uint32_t sent() const { return sent_; }
+  uint32_t sendFailed() const { return sendFailed_; }
+
+  // "24:6f:28:aa:bb:cc rx 1520 bad 0 dup 3 miss 2 restarts 0 rssi -61 dBm, 40 ms ago"
+  // (no rssi field without LINK_RSSI)
+  int format(char* buf, size_t size, uint8_t i, uint32_t nowMs) const {
+    const LinkPeer& p = peer_[i];
+#if LINK_RSSI
+    char rssi[16];
+    snprintf(rssi, sizeof(rssi), " rssi %d dBm,", p.rssi);
+#else
+    const char* rssi = ",";
+#endif
+    return snprintf(buf, size,
+                    "%02x:%02x:%02x:%02x:%02x:%02x rx %lu bad %lu dup %lu miss %lu restarts %lu%s %lu ms ago\n",
+                    p.mac[0], p.mac[1], p.mac[2], p.mac[3], p.mac[4], p.mac[5], (unsigned long)p.received,
+                    (unsigned long)p.malformed, (unsigned long)p.duplicates, (unsigned long)p.missing,
+                    (unsigned long)p.restarts, rssi, (unsigned long)(nowMs - p.lastMs));
+  }
+
+ private:
+  __attribute__((always_inline)) inline LinkPeer* find(const uint8_t* mac, bool add) {
+    for (uint8_t i = 0; i < peers_; i++) {
+      if (memcmp(peer_[i].mac, mac, sizeof(peer_[i].mac)) == 0) return &peer_[i];
+    }
+    if (!add || peers_ >= kPeers) return nullptr;
+    LinkPeer* p = &peer_[peers_];
+    memcpy(p->mac, mac, sizeof(p->mac));
+    peers_++;  // after the MAC, so readers never see a half-written entry
+    return p;
+  }
+
+  // Like SeqWindow (ReliableLink.h), plus gap accounting: a late arrival
+  // inside the window fills the gap it left
+  __attribute__((always_inline)) inline static void trackSeq(LinkPeer& p, uint32_t seq) {
+    if (!p.seqValid) {
+      restartSeq(p, seq);
+      return;
+    }
+    const int32_t ahead = (int32_t)(seq - p.topSeq);
+    if (ahead > (int32_t)kRestartGap) {
+      p.restarts++;
+      restartSeq(p, seq);
+      return;
+    }
+    if (ahead > 0) {
+      p.missing += (uint32_t)(ahead - 1);
+      p.seqMask = (ahead >= 32) ? 1u : ((p.seqMask << ahead) | 1u);
+      p.topSeq = seq;
+      return;
+    }
+    const uint32_t back = (uint32_t)-ahead;
+    if (back >= 32) {
+      p.restarts++;
+      restartSeq(p, seq);
+      return;
+    }
+    if (p.seqMask & (1u << back)) {
+      p.duplicates++;
+      return;
+    }
+    p.seqMask |= 1u << back;
+    if (p.missing) p.missing--;
+  }
+
+  __attribute__((always_inline)) inline static void restartSeq(LinkPeer& p, uint32_t seq) {
+    p.seqValid = true;
+    p.topSeq = seq;
+    p.seqMask = 1;
+  }
+
+#if LINK_RSSI
+  // 802.11 action frame (subtype 13), category 127 (vendor), Espressif OUI:
+  // what ESP-NOW sends. The transmitter address (addr2) is at offset 10.
+  static void IRAM_ATTR onPromiscuous(void* buf, wifi_promiscuous_pkt_type_t type) {
+    if (type != WIFI_PKT_MGMT) return;
+    const wifi_promiscuous_pkt_t* pkt = static_cast<const wifi_promiscuous_pkt_t*>(buf);
+    const uint8_t* f = pkt->payload;
+    if (f[0] != 0xD0 || pkt->rx_ctrl.sig_len < 28) return;
+    if (f[24] != 0x7F || f[25] != 0x18 || f[26] != 0xFE || f[27] != 0x34) return;
+    if (LinkPeer* p = instance_->find(f + 10, false)) p->rssi = (int8_t)pkt->rx_ctrl.rssi;
+  }
+
+  static inline LinkHealth* instance_ = nullptr;
+#endif
+
+  LinkPeer peer_[kPeers] = {};
+  volatile uint8_t peers_ = 0;
+  volatile uint32_t others_ = 0;
+  volatile uint32_t sent_ = 0;
+  volatile uint32_t sendFailed_ = 0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+// Bounded lock-free multi-producer/single-consumer ring.
+//
+// SpscRing (SpellQueue.h) relies on there being exactly one producer. Logs
+// and trace events come from loop(), the render task, the OTA task and the
+// DMX task at once, so each slot here carries a sequence number instead
+// (D. Vyukov's bounded queue). A producer claims a slot with one
+// compare-and-swap on the enqueue position, fills it in place and publishes
+// it by bumping the slot's sequence. The consumer takes slots in order and
+// hands each one back by advancing its sequence a lap. Nobody ever waits: a
+// producer that finds the ring full counts a drop and gives up.
+
+#include <Arduino.h>
+
+#include <atomic>
+
+// Capacity must be a power of two
+template <typename T, uint32_t Capacity>
+class MpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+ public:
+  struct Slot {
+    std::atomic<uint32_t> seq;
+    T item;
+  };
+
+  MpscRing() {
+    for (uint32_t i = 0; i < Capacity; i++) slots_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // Producer side, any task: claim the next free slot, or null (and a counted
+  // drop) if the consumer is a full ring behind. Fill slot->item, then publish().
+  Slot* reserve() {
+    uint32_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& s = slots_[pos & kMask];
+      const int32_t dif = (int32_t)(s.seq.load(std::memory_order_acquire) - pos);
+      if (dif == 0) {
+        if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return &s;
+      } else if (dif < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      } else {
+        pos = enqueuePos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  static void publish(Slot* s) { s->seq.store(s->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer side: the oldest published slot, or null. Slots published out of
+  // order wait until the ones claimed before them are published too.
+  Slot* front() {
+    Slot& s = slots_[dequeuePos_ & kMask];
+    return s.seq.load(std::memory_order_acquire) == dequeuePos_ + 1 ? &s : nullptr;
+  }
+
+  void release(Slot* s) {
+    s->seq.store(dequeuePos_ + Capacity, std::memory_order_release);
+    dequeuePos_++;
+  }
+
+  // Items lost because the ring was full
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr uint32_t kMask = Capacity - 1;
+
+  Slot slots_[Capacity];
+  std::atomic<uint32_t> enqueuePos_{0};
+  uint32_t dequeuePos_ = 0;  // consumer only
+  std::atomic<uint32_t> dropped_{0};
+};
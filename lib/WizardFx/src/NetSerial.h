@@ -0,0 +1,223 @@
+#pragma once
+
+// Buffered NetSerial logging: Serial plus one TCP client on port 23.
+//
+// The old helpers printed straight to Serial and to the socket from whatever
+// task was logging. At 115200 baud a 60-character line holds the caller for
+// about 5 ms once the UART FIFO is full, and a slow telnet client could stall
+// it for much longer, in the middle of a frame. Now a log call only formats
+// its line into a slot of a lock-free ring and returns. A low-priority task
+// drains the ring to Serial and the client, and it also accepts connections.
+// If the ring is full the line is dropped and counted, so the caller never
+// waits. The drain task reports the count as "NetSerial: N lines dropped".
+// Lines the client types are handed to an onLine() handler on the same task.
+//
+// The ring is an MpscRing: loop(), the render task, the OTA task and the DMX
+// task may all log at once. Lines longer than NET_SERIAL_LINE bytes are
+// truncated.
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdarg.h>
+
+#include "MpscRing.h"
+
+#ifndef NET_SERIAL_SLOTS
+#define NET_SERIAL_SLOTS 32  // queued lines; power of two
+#endif
+#ifndef NET_SERIAL_LINE
+#define NET_SERIAL_LINE 160  // bytes per line, including the terminator
+#endif
+
+class NetSerial {
+ public:
+  static constexpr uint16_t PORT = 23;
+  static constexpr uint32_t TASK_STACK = 4096;
+  static constexpr UBaseType_t PRIORITY = 1;  // below rendering, output and radio work
+  static constexpr uint32_t POLL_MS = 5;      // drain latency when idle
+
+  static constexpr size_t INPUT_LINE = 64;     // longest command accepted
+
+  // Where a line goes
+  enum Sink : uint8_t { TO_SERIAL = 1, TO_CLIENT = 2, TO_BOTH = 3 };
+
+  // Receives each line the client sends, without the line ending and telnet
+  // negotiation. Runs on the drain task; it may log.
+  using LineHandler = void (*)(const char* line);
+
+  NetSerial() : server_(PORT) {}
+
+  // Start the drain task. Call early in setup(); lines logged before this
+  // wait in the ring. Returns false if the task could not be created.
+  bool begin(BaseType_t core = 0) {
+    if (task_) return true;
+    return xTaskCreatePinnedToCore(drainTask, "netlog", TASK_STACK, this, PRIORITY, &task_, core) == pdPASS;
+  }
+
+  // Open the TCP port once WiFi is up. The drain task owns the server and
+  // the client, so this only raises a flag.
+  void listen() { listenRequested_ = true; }
+
+  // Set before listen()
+  void onLine(LineHandler handler) { lineHandler_ = handler; }
+
+  bool running() const { return task_ != nullptr; }
+  bool listening() const { return listening_; }
+  // A telnet client is attached (as of the drain task's last look)
+  bool clientConnected() const { return clientConnected_; }
+  // Lines lost because the ring was full
+  uint32_t dropped() const { return ring_.dropped(); }
+
+  // Producer side: any task, never blocks
+  void vprintf(Sink sink, const char* fmt, va_list ap) {
+    Ring::Slot* s = ring_.reserve();
+    if (!s) return;
+    Line& l = s->item;
+    const int n = vsnprintf(l.text, sizeof(l.text), fmt, ap);
+    if (n >= (int)sizeof(l.text)) {
+      l.len = sizeof(l.text) - 1;
+      l.text[l.len - 1] = '\n';  // keep the next line on its own line
+    } else {
+      l.len = (uint16_t)(n < 0 ? 0 : n);
+    }
+    l.sink = sink;
+    ring_.publish(s);
+  }
+
+  __attribute__((format(printf, 3, 4))) void printf(Sink sink, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(sink, fmt, ap);
+    va_end(ap);
+  }
+
+  void print(Sink sink, const char* str, const char* suffix = "") {
+    Ring::Slot* s = ring_.reserve();
+    if (!s) return;
+    Line& l = s->item;
+    const size_t cap = sizeof(l.text) - 1;
+    size_t n = strlen(str);
+    if (n > cap) n = cap;
+    memcpy(l.text, str, n);
+    size_t m = strlen(suffix);
+    if (m > cap - n) m = cap - n;
+    memcpy(l.text + n, suffix, m);
+    l.text[n + m] = '\0';
+    l.len = (uint16_t)(n + m);
+    l.sink = sink;
+    ring_.publish(s);
+  }
+
+  // Raw bytes (e.g. binary trace records), at most maxWrite() per call
+  bool write(Sink sink, const uint8_t* data, size_t len) {
+    if (len > maxWrite()) return false;
+    Ring::Slot* s = ring_.reserve();
+    if (!s) return false;
+    memcpy(s->item.text, data, len);
+    s->item.len = (uint16_t)len;
+    s->item.sink = sink;
+    ring_.publish(s);
+    return true;
+  }
+
+  static constexpr size_t maxWrite() { return NET_SERIAL_LINE; }
+
+ private:
+  struct Line {
+    uint16_t len;
+    uint8_t sink;
+    char text[NET_SERIAL_LINE];
+  };
+  using Ring = MpscRing<Line, NET_SERIAL_SLOTS>;
+
+  void output(uint8_t sink, const char* text, size_t len) {
+    if (sink & TO_SERIAL) Serial.write((const uint8_t*)text, len);
+    if ((sink & TO_CLIENT) && clientConnected_) client_.write((const uint8_t*)text, len);
+  }
+
+  void acceptClient() {
+    if (client_ && client_.connected()) return;
+    WiFiClient n = server_.available();
+    if (n) {
+      if (client_) client_.stop();
+      client_ = n;
+      client_.setNoDelay(true);
+      inputLen_ = 0;
+      telnet_ = 0;
+      Serial.println("NetSerial: client connected");
+    }
+  }
+
+  void readClient() {
+    while (client_.available() > 0) {
+      const int c = client_.read();
+      if (c < 0) break;
+      // Telnet clients open with option negotiation: IAC cmd [option], or a
+      // subnegotiation IAC SB ... IAC SE. None of it is input.
+      if (telnet_) {
+        if (telnet_ == 1) telnet_ = (c >= 251 && c <= 254) ? 2 : (c == 250 ? 3 : 0);
+        else if (telnet_ == 2) telnet_ = 0;
+        else if (telnet_ == 3) telnet_ = c == 255 ? 4 : 3;
+        else telnet_ = c == 240 ? 0 : 3;
+        continue;
+      }
+      if (c == 255) {
+        telnet_ = 1;
+      } else if (c == '\n') {
+        input_[inputLen_] = '\0';
+        if (inputLen_ && lineHandler_) lineHandler_(input_);
+        inputLen_ = 0;
+      } else if ((c == '\b' || c == 127) && inputLen_) {
+        inputLen_--;
+      } else if (c >= 32 && c < 127 && inputLen_ < INPUT_LINE - 1) {
+        input_[inputLen_++] = (char)c;
+      }
+    }
+  }
+
+  static void drainTask(void* arg) {
+    NetSerial* self = static_cast<NetSerial*>(arg);
+    for (;;) {
+      if (self->listenRequested_ && !self->listening_) {
+        self->server_.begin();
+        self->server_.setNoDelay(true);
+        self->listening_ = true;
+      }
+      if (self->listening_) self->acceptClient();
+      self->clientConnected_ = self->client_ && self->client_.connected();
+      if (self->clientConnected_) self->readClient();
+
+      // Writes may block on the UART or a slow socket; only this task waits
+      while (Ring::Slot* s = self->ring_.front()) {
+        self->output(s->item.sink, s->item.text, s->item.len);
+        self->ring_.release(s);
+      }
+
+      const uint32_t dropped = self->dropped();
+      if (dropped != self->reportedDrops_) {
+        char buf[48];
+        const int n = snprintf(buf, sizeof(buf), "NetSerial: %lu lines dropped\r\n",
+                               (unsigned long)(dropped - self->reportedDrops_));
+        self->reportedDrops_ = dropped;
+        self->output(TO_BOTH, buf, (size_t)n);
+      }
+      vTaskDelay(pdMS_TO_TICKS(POLL_MS));
+    }
+  }
+
+  Ring ring_;
+  uint32_t reportedDrops_ = 0;
+
+  TaskHandle_t task_ = nullptr;
+  WiFiServer server_;
+  WiFiClient client_;  // drain task only
+  LineHandler lineHandler_ = nullptr;
+  char input_[INPUT_LINE];
+  uint8_t inputLen_ = 0;
+  uint8_t telnet_ = 0;  // negotiation parser state
+  volatile bool listenRequested_ = false;
+  volatile bool listening_ = false;
+  volatile bool clientConnected_ = false;
+};
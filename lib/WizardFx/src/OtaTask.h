@@ -0,0 +1,87 @@
+#pragma once
+
+// ArduinoOTA serviced on its own low-priority task for the whole uptime.
+//
+// Polling ArduinoOTA.handle() is cheap (one UDP check), but an accepted
+// upload runs to completion inside that call, and the OTA callbacks draw
+// progress straight to FastLED. So the firmware keeps rendering and taking
+// spells until a transfer actually starts, and then hands the LEDs over:
+//
+//   OTA task, ArduinoOTA.onStart:  otaTask.beginUpdate();  // waits for park()
+//   loop() / renderer, per frame:  if (otaTask.updating()) { otaTask.park(); return; }
+//   ArduinoOTA.onError:            otaTask.endUpdate();    // rendering resumes
+//
+// park() means "I am not touching the LED buffers or FastLED any more", so a
+// renderer with an asynchronous output calls it only once its last frame is
+// off the wire.
+
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "FrameProfile.h"
+
+class OtaTask {
+ public:
+  static constexpr uint32_t TASK_STACK = 8192;  // Update + TCP client, like loopTask
+  static constexpr UBaseType_t PRIORITY = 1;    // below rendering, output and radio work
+  static constexpr uint32_t POLL_MS = 50;       // upload invitations are answered within this
+
+  // Start polling. ArduinoOTA.begin() must have been called. Returns false if
+  // the task could not be created.
+  bool begin(BaseType_t core = 0) {
+    if (task_) return true;
+    return xTaskCreatePinnedToCore(pollTask, "ota", TASK_STACK, this, PRIORITY, &task_, core) == pdPASS;
+  }
+
+  bool running() const { return task_ != nullptr; }
+  // A transfer is in progress; whoever renders must stand aside
+  bool updating() const { return updating_; }
+
+  // Renderer side: acknowledge updating() once the LEDs are free
+  void park() { parked_ = true; }
+
+  // OTA side (onStart): flag the transfer and wait until the renderer parked.
+  // Returns false if it did not within timeoutMs; the update goes ahead anyway.
+  bool beginUpdate(uint32_t timeoutMs = 250) {
+    parked_ = false;
+    updating_ = true;
+    const uint32_t start = millis();
+    while (!parked_) {
+      if ((uint32_t)(millis() - start) >= timeoutMs) return false;
+      vTaskDelay(1);
+    }
+    return true;
+  }
+
+  // OTA side (onError): give the LEDs back to the renderer
+  void endUpdate() {
+    updating_ = false;
+    parked_ = false;
+  }
+
+#if FRAME_PROFILE
+  // ArduinoOTA.handle() per poll; an accepted upload lands in the last bucket
+  TimingHistogram& handleTimes() { return handleTimes_; }
+#endif
+
+ private:
+  static void pollTask(void* arg) {
+    OtaTask* self = static_cast<OtaTask*>(arg);
+    (void)self;
+    for (;;) {
+      PROFILE_BEGIN(handleStart);
+      ArduinoOTA.handle();
+      PROFILE_END(self->handleTimes_, handleStart);
+      vTaskDelay(pdMS_TO_TICKS(POLL_MS));
+    }
+  }
+
+  TaskHandle_t task_ = nullptr;
+  volatile bool updating_ = false;
+  volatile bool parked_ = false;
+#if FRAME_PROFILE
+  TimingHistogram handleTimes_;
+#endif
+};
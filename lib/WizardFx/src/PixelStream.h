@@ -0,0 +1,351 @@
+#pragma once
+
+// Pixel-frame streaming over ESP-NOW.
+//
+// One device renders and broadcasts whole frames; receivers show them instead
+// of their built-in effects. A frame is split into fragments of at most
+// ESP_NOW_MAX_DATA_LEN bytes. Each fragment covers a pixel range and is
+// encoded on its own, so it decodes without its neighbours:
+//   STREAM_RAW      3 bytes per pixel
+//   STREAM_RLE      runs of equal pixels: [count 1-255][r][g][b]
+//   STREAM_XOR_RLE  RLE of the XOR against the previous frame (baseId)
+// The sender picks whichever encoding covers the most pixels per fragment, and
+// sends a keyframe (no XOR) every STREAM_KEYFRAME_EVERY frames so a receiver
+// that lost a frame recovers. A frame is shown only once every fragment
+// arrived (duplicates count once); until then, or if its delta base is
+// missing, the previous frame stays up.
+//
+// Fragment layout: StreamFragmentHeader, payload, uint16 CRC over both.
+
+#include <Arduino.h>
+#include <FastLED.h>
+#include <string.h>
+
+#include "SpellPacket.h"
+#include "SpellQueue.h"
+
+static constexpr int STREAM_MAX_FRAGMENT = 250;  // ESP_NOW_MAX_DATA_LEN
+static constexpr uint16_t STREAM_KEYFRAME_EVERY = 15;
+
+enum StreamEncoding : uint8_t {
+  STREAM_RAW = 0,
+  STREAM_RLE = 1,
+  STREAM_XOR_RLE = 2,
+};
+
+struct __attribute__((packed)) StreamFragmentHeader {
+  SpellHeader hdr;
+  uint16_t frameId;
+  uint16_t baseId;       // frame the XOR delta is against (STREAM_XOR_RLE only)
+  uint16_t totalPixels;  // pixels in the whole frame
+  uint16_t start;        // first pixel in this fragment
+  uint16_t count;        // pixels in this fragment
+  uint8_t encoding;      // StreamEncoding
+  uint8_t fragment;      // index within the frame, for diagnostics
+};
+
+static_assert(sizeof(StreamFragmentHeader) == 28, "StreamFragmentHeader must stay 28 bytes on the wire");
+static constexpr int STREAM_MAX_PAYLOAD = STREAM_MAX_FRAGMENT - (int)sizeof(StreamFragmentHeader) - 2;
+
+// Raw copy of one received fragment, queued by the receive callback
+struct StreamPacket {
+  uint8_t len;
+  uint8_t data[STREAM_MAX_FRAGMENT];
+};
+
+// Cheap header check for the receive callback (CRC is checked when decoding)
+__attribute__((always_inline)) inline bool isStreamFragment(const uint8_t* data, int len) {
+  if (len < (int)sizeof(StreamFragmentHeader) + 2 || len > STREAM_MAX_FRAGMENT) return false;
+  const SpellHeader* h = reinterpret_cast<const SpellHeader*>(data);
+  return h->magic == SPELL_MAGIC && h->version == SPELL_VERSION && h->type == SPELL_MSG_PIXELS;
+}
+
+// 4 KB: a 750-pixel raw frame is 11 fragments
+using StreamQueue = SpscRing<StreamPacket, 16>;
+
+// Receive callback side: queue a copy of a fragment. Returns false if the
+// payload is not a fragment at all, so the caller can try other types.
+__attribute__((always_inline)) inline bool queueStreamFragment(StreamQueue& q, const uint8_t* data, int len) {
+  if (!isStreamFragment(data, len)) return false;
+  StreamPacket p;
+  p.len = (uint8_t)len;
+  memcpy(p.data, data, len);
+  q.push(p);
+  return true;
+}
+
+namespace pixelstream {
+
+inline CRGB xorPixel(const CRGB& a, const CRGB& b) { return CRGB(a.r ^ b.r, a.g ^ b.g, a.b ^ b.b); }
+
+// Encode pixels [start, n) as runs until cap bytes are used; base (may be
+// null) is XORed in first. Returns pixels covered, bytes in *used.
+inline uint16_t encodeRle(const CRGB* px, const CRGB* base, uint16_t start, uint16_t n, uint8_t* out,
+                          int cap, int* used) {
+  uint16_t i = start;
+  int pos = 0;
+  while (i < n && pos + 4 <= cap) {
+    const CRGB v = base ? xorPixel(px[i], base[i]) : px[i];
+    uint16_t run = 1;
+    while (i + run < n && run < 255) {
+      const CRGB w = base ? xorPixel(px[i + run], base[i + run]) : px[i + run];
+      if (w != v) break;
+      run++;
+    }
+    out[pos++] = (uint8_t)run;
+    out[pos++] = v.r;
+    out[pos++] = v.g;
+    out[pos++] = v.b;
+    i += run;
+  }
+  *used = pos;
+  return i - start;
+}
+
+// Decode count pixels of runs into dst; base (may be null) is XORed back out.
+// Returns false if the payload does not describe exactly count pixels.
+inline bool decodeRle(const uint8_t* in, int len, CRGB* dst, const CRGB* base, uint16_t count) {
+  uint16_t i = 0;
+  for (int pos = 0; pos + 4 <= len; pos += 4) {
+    const uint8_t run = in[pos];
+    if (run == 0 || i + run > count) return false;
+    const CRGB v(in[pos + 1], in[pos + 2], in[pos + 3]);
+    for (uint8_t k = 0; k < run; k++, i++) dst[i] = base ? xorPixel(v, base[i]) : v;
+  }
+  return i == count;
+}
+
+}  // namespace pixelstream
+
+// Sender side: fragments and encodes frames of up to MaxPixels
+template <uint16_t MaxPixels>
+class PixelStreamSender {
+ public:
+  struct Stats {
+    uint32_t frames;
+    uint32_t fragments;
+    uint32_t bytes;     // on the wire, headers included
+    uint32_t rawBytes;  // what the same frames cost as raw RGB
+  };
+
+  // Encode one frame and hand each finished fragment to send(data, len).
+  // seq is the caller's stream sequence counter, bumped per fragment. Keep it
+  // apart from the spell counter: receivers dedupe spells by seq window.
+  template <class Send>
+  void sendFrame(const CRGB* px, uint16_t n, uint64_t senderUs, uint32_t& seq, Send send) {
+    if (n > MaxPixels) n = MaxPixels;
+    const bool delta = havePrev_ && prevCount_ == n && (frameId_ % STREAM_KEYFRAME_EVERY) != 0;
+    uint8_t buf[STREAM_MAX_FRAGMENT];
+    uint8_t alt[STREAM_MAX_PAYLOAD];
+    StreamFragmentHeader& h = *reinterpret_cast<StreamFragmentHeader*>(buf);
+    uint8_t* payload = buf + sizeof(StreamFragmentHeader);
+    uint16_t start = 0;
+    uint8_t fragment = 0;
+    while (start < n) {
+      // Raw is the baseline; RLE and XOR-RLE win when they cover more pixels
+      uint16_t count = (uint16_t)min<int>(n - start, STREAM_MAX_PAYLOAD / 3);
+      int used = count * 3;
+      uint8_t enc = STREAM_RAW;
+      memcpy(payload, &px[start], used);
+      int altUsed = 0;
+      uint16_t c = pixelstream::encodeRle(px, nullptr, start, n, alt, STREAM_MAX_PAYLOAD, &altUsed);
+      if (c > count || (c == count && altUsed < used)) {
+        count = c, used = altUsed, enc = STREAM_RLE;
+        memcpy(payload, alt, used);
+      }
+      if (delta) {
+        c = pixelstream::encodeRle(px, prev_, start, n, alt, STREAM_MAX_PAYLOAD, &altUsed);
+        if (c > count || (c == count && altUsed < used)) {
+          count = c, used = altUsed, enc = STREAM_XOR_RLE;
+          memcpy(payload, alt, used);
+        }
+      }
+      h.frameId = frameId_;
+      h.baseId = (uint16_t)(frameId_ - 1);
+      h.totalPixels = n;
+      h.start = start;
+      h.count = count;
+      h.encoding = enc;
+      h.fragment = fragment++;
+      h.hdr.magic = SPELL_MAGIC;
+      h.hdr.version = SPELL_VERSION;
+      h.hdr.type = SPELL_MSG_PIXELS;
+      h.hdr.seq = ++seq;
+      h.hdr.senderUs = senderUs;
+      const int len = (int)sizeof(StreamFragmentHeader) + used;
+      const uint16_t crc = spellCrc16(buf, len);
+      memcpy(buf + len, &crc, sizeof(crc));
+      send(buf, len + 2);
+      stats_.fragments++;
+      stats_.bytes += len + 2;
+      start += count;
+    }
+    memcpy(prev_, px, n * sizeof(CRGB));
+    prevCount_ = n;
+    havePrev_ = true;
+    frameId_++;
+    stats_.frames++;
+    stats_.rawBytes += n * 3;
+  }
+
+  Stats stats() const { return stats_; }
+
+  // Stats accumulated since the previous call, for periodic reports
+  Stats takeInterval() {
+    const Stats d = {stats_.frames - last_.frames, stats_.fragments - last_.fragments,
+                     stats_.bytes - last_.bytes, stats_.rawBytes - last_.rawBytes};
+    last_ = stats_;
+    return d;
+  }
+
+ private:
+  CRGB prev_[MaxPixels];  // last frame sent: the XOR base
+  uint16_t prevCount_ = 0;
+  bool havePrev_ = false;
+  uint16_t frameId_ = 0;
+  Stats stats_ = {0, 0, 0, 0};
+  Stats last_ = {0, 0, 0, 0};
+};
+
+// Receiver side: reassembles fragments into complete frames. Single-threaded:
+// feed it from the engine owner's task (the callback only queues copies).
+template <uint16_t MaxPixels>
+class PixelStreamReceiver {
+ public:
+  // The sender fills every fragment at least as far as raw RGB would
+  static constexpr uint16_t kMaxFragments = (MaxPixels + STREAM_MAX_PAYLOAD / 3 - 1) / (STREAM_MAX_PAYLOAD / 3);
+  static_assert(kMaxFragments <= 64, "fragment bitmask holds 64 fragments");
+
+  struct Stats {
+    uint32_t frames;        // complete frames
+    uint32_t dropped;       // frames abandoned: fragment lost or delta base missing
+    uint32_t badFragments;  // CRC or range errors
+  };
+
+  // Decode one fragment. Returns true when it completed a frame.
+  bool onFragment(const uint8_t* data, int len) {
+    if (len < (int)sizeof(StreamFragmentHeader) + 2) return bad();
+    uint16_t crc;
+    memcpy(&crc, data + len - 2, sizeof(crc));
+    if (spellCrc16(data, len - 2) != crc) return bad();
+    StreamFragmentHeader h;
+    memcpy(&h, data, sizeof(h));
+    if (h.totalPixels == 0 || h.totalPixels > MaxPixels || h.count == 0 ||
+        (uint32_t)h.start + h.count > h.totalPixels || h.fragment >= kMaxFragments) {
+      return bad();
+    }
+    if (haveFrame_ && h.frameId == frameId_) return false;  // already complete
+    if (!assembling_ || h.frameId != assemblingId_) {
+      // A straggler from a frame already given up on; far behind means the sender restarted
+      const int16_t behind = (int16_t)(assemblingId_ - h.frameId);
+      if (assembling_ && behind > 0 && behind < 64) return false;
+      if (assembling_ && !broken_) stats_.dropped++;  // previous frame never completed
+      assembling_ = true;
+      assemblingId_ = h.frameId;
+      total_ = h.totalPixels;
+      covered_ = 0;
+      received_ = 0;
+      lastFragment_ = -1;
+      broken_ = false;
+    }
+    if (broken_) return false;
+    const uint64_t bit = 1ull << h.fragment;
+    if (received_ & bit) return false;  // retransmitted or duplicated on the air
+    const uint8_t* payload = data + sizeof(StreamFragmentHeader);
+    const int payloadLen = len - 2 - (int)sizeof(StreamFragmentHeader);
+    CRGB* dst = &assembly_[h.start];
+    bool ok = false;
+    switch (h.encoding) {
+      case STREAM_RAW:
+        ok = payloadLen == h.count * 3;
+        if (ok) memcpy(dst, payload, payloadLen);
+        break;
+      case STREAM_RLE:
+        ok = pixelstream::decodeRle(payload, payloadLen, dst, nullptr, h.count);
+        break;
+      case STREAM_XOR_RLE:
+        // Only against the frame the sender diffed with
+        if (!haveFrame_ || frameId_ != h.baseId || count_ != h.totalPixels) {
+          broken_ = true;
+          stats_.dropped++;
+          return false;
+        }
+        ok = pixelstream::decodeRle(payload, payloadLen, dst, &frame_[h.start], h.count);
+        break;
+      default:
+        break;
+    }
+    if (!ok) {
+      broken_ = true;
+      stats_.dropped++;
+      return bad();
+    }
+    received_ |= bit;
+    covered_ += h.count;
+    if ((uint32_t)h.start + h.count == total_) lastFragment_ = h.fragment;
+    // Complete once fragments 0..last all arrived
+    if (lastFragment_ < 0) return false;
+    const uint64_t all = (lastFragment_ == 63) ? ~0ull : (1ull << (lastFragment_ + 1)) - 1;
+    if ((received_ & all) != all) return false;
+    if (covered_ != total_) {  // ranges overlap or leave a gap
+      broken_ = true;
+      stats_.dropped++;
+      return bad();
+    }
+    memcpy(frame_, assembly_, total_ * sizeof(CRGB));
+    count_ = total_;
+    frameId_ = assemblingId_;
+    haveFrame_ = true;
+    assembling_ = false;
+    fresh_ = true;
+    lastFrameMs_ = millis();
+    stats_.frames++;
+    return true;
+  }
+
+  // True while frames keep arriving
+  bool active(uint32_t timeoutMs) const { return haveFrame_ && (millis() - lastFrameMs_) < timeoutMs; }
+
+  // True once per newly completed frame
+  bool takeFresh() {
+    const bool f = fresh_;
+    fresh_ = false;
+    return f;
+  }
+
+  // Copy the latest complete frame onto a strand of len pixels, scaled by
+  // nearest neighbour when the lengths differ
+  void blit(CRGB* dst, uint16_t len) const {
+    if (!haveFrame_ || len == 0) return;
+    if (len == count_) {
+      memcpy(dst, frame_, len * sizeof(CRGB));
+      return;
+    }
+    for (uint16_t i = 0; i < len; i++) dst[i] = frame_[(uint32_t)i * count_ / len];
+  }
+
+  Stats stats() const { return stats_; }
+
+ private:
+  bool bad() {
+    stats_.badFragments++;
+    return false;
+  }
+
+  CRGB assembly_[MaxPixels];  // frame being reassembled
+  CRGB frame_[MaxPixels];     // latest complete frame (shown, and the XOR base)
+  uint16_t count_ = 0;
+  uint16_t frameId_ = 0;
+  bool haveFrame_ = false;
+  bool fresh_ = false;
+  uint32_t lastFrameMs_ = 0;
+
+  bool assembling_ = false;
+  bool broken_ = false;
+  uint16_t assemblingId_ = 0;
+  uint16_t total_ = 0;
+  uint16_t covered_ = 0;      // pixels in the fragments received
+  uint64_t received_ = 0;     // bit per fragment index received
+  int8_t lastFragment_ = -1;  // index of the fragment ending the frame, once seen
+  Stats stats_ = {0, 0, 0};
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+// Optional reliable spell delivery over ESP-NOW broadcast.
+//
+// The staff sets SPELL_ACK_REQUESTED on a spell and keeps it in a small
+// pending table. Every receiver answers with a SpellAck unicast to the sender
+// (sendSpellAck). The staff retransmits the identical frame (same seq and
+// CRC) with exponential backoff until every known peer has acknowledged it or
+// MAX_RETRIES is used up. Peers are learned from their ACKs and forgotten
+// after PEER_MISS_LIMIT spells they failed to acknowledge, so a hat that was
+// switched off stops costing retries. Spells still pending stop waiting for a
+// forgotten peer, and its slot starts clean for the next one.
+//
+// Receivers see retransmissions as duplicates: they ACK them again (the first
+// ACK may have been the frame that got lost) but run them through a SeqWindow
+// so a relative spell like "brightness up" is applied once.
+//
+// Receivers ACK when they drain their spell queue, once per rendered frame, so
+// an ACK can take a whole frame period. The first retry waits for the slowest
+// receiver's frame (RELIABLE_ACK_FRAME_MS) plus a margin. With no peer known
+// yet there is nobody to wait for: a spell that gets no ACK is not resent.
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <string.h>
+
+#include "SpellPacket.h"
+#include "SpellQueue.h"
+
+#ifndef RELIABLE_ACK_FRAME_MS
+#define RELIABLE_ACK_FRAME_MS 40  // slowest receiver frame period (cape and receiver at 25 fps)
+#endif
+
+// Receiver side: answer one spell. Runs on the engine owner's task, not in the
+// receive callback, since it may have to register the sender as a peer.
+inline esp_err_t sendSpellAck(const uint8_t* mac, uint32_t seq, uint64_t senderUs) {
+  if (!esp_now_is_peer_exist(mac)) {
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+    peer.channel = 0;  // follow the current radio channel
+    peer.encrypt = false;
+    const esp_err_t err = esp_now_add_peer(&peer);
+    if (err != ESP_OK) return err;
+  }
+  SpellAck ack = {};
+  sealFrame(ack, SPELL_MSG_ACK, seq, senderUs);
+  return esp_now_send(mac, reinterpret_cast<const uint8_t*>(&ack), sizeof(ack));
+}
+
+// Receiver side: drops sequence numbers already seen. Remembers the highest
+// seq and a 32-frame bitmap below it, so late retransmissions are caught too.
+// A seq far below the window means the sender restarted; it starts afresh.
+class SeqWindow {
+ public:
+  // True if seq is new (and records it), false for a duplicate
+  bool accept(uint32_t seq) {
+    if (!valid_) {
+      reset(seq);
+      return true;
+    }
+    const int32_t ahead = (int32_t)(seq - top_);
+    if (ahead > 0) {
+      mask_ = (ahead >= 32) ? 1u : ((mask_ << ahead) | 1u);
+      top_ = seq;
+      return true;
+    }
+    const uint32_t back = (uint32_t)-ahead;
+    if (back >= 32) {
+      reset(seq);
+      return true;
+    }
+    if (mask_ & (1u << back)) {
+      duplicates_++;
+      return false;
+    }
+    mask_ |= 1u << back;
+    return true;
+  }
+
+  uint32_t duplicates() const { return duplicates_; }
+
+ private:
+  void reset(uint32_t seq) {
+    valid_ = true;
+    top_ = seq;
+    mask_ = 1;
+  }
+
+  bool valid_ = false;
+  uint32_t top_ = 0;   // highest seq accepted
+  uint32_t mask_ = 0;  // bit n: top_ - n was seen
+  uint32_t duplicates_ = 0;
+};
+
+// Staff side: one received ACK, queued by the receive callback
+struct AckEvent {
+  uint8_t mac[ESP_NOW_ETH_ALEN];
+  uint32_t seq;
+  uint64_t senderUs;  // echoed send time of the acknowledged spell
+  uint32_t rxUs;      // micros() when the ACK arrived
+};
+
+__attribute__((always_inline)) inline bool decodeAck(const uint8_t* mac, const uint8_t* data, int len,
+                                                     uint32_t rxUs, AckEvent& ev) {
+  const SpellAck* a = nullptr;
+  if (parseFrame(data, len, SPELL_MSG_ACK, &a) != SPELL_OK_V2) return false;
+  memcpy(ev.mac, mac, ESP_NOW_ETH_ALEN);
+  ev.seq = a->hdr.seq;
+  ev.senderUs = a->hdr.senderUs;
+  ev.rxUs = rxUs;
+  return true;
+}
+
+using AckQueue = SpscRing<AckEvent, 16>;
+
+// Staff side: pending spells, retransmission schedule and delivery stats.
+// Single-threaded: call from loop() only.
+template <uint8_t MaxPeers = 4, uint8_t MaxPending = 8>
+class ReliableSender {
+  static_assert(MaxPeers <= 32, "ack mask holds at most 32 peers");
+
+ public:
+  static constexpr uint32_t ACK_MARGIN_US = 20000;  // airtime, WiFi task latency, a late frame
+  static constexpr uint32_t FIRST_RETRY_US = RELIABLE_ACK_FRAME_MS * 1000u + ACK_MARGIN_US;  // doubles per retry
+  static constexpr uint8_t MAX_RETRIES = 5;
+  static constexpr uint8_t PEER_MISS_LIMIT = 3;  // unacked spells before a peer is forgotten
+
+  struct Stats {
+    uint32_t sent;          // spells tracked
+    uint32_t delivered;     // acknowledged by every known peer
+    uint32_t failed;        // gave up after MAX_RETRIES
+    uint32_t retries;       // retransmissions
+    uint32_t latencySumUs;  // first send to last needed ACK, delivered spells only
+    uint32_t latencyMaxUs;
+  };
+
+  // Start tracking a sealed spell that was just sent
+  void track(const SpellPacketV2& pkt, uint32_t nowUs) {
+    Pending* slot = nullptr;
+    for (Pending& p : pending_) {
+      if (!p.active) {
+        slot = &p;
+        break;
+      }
+      if (!slot || (int32_t)(p.firstUs - slot->firstUs) < 0) slot = &p;  // oldest
+    }
+    if (slot->active) fail(*slot);  // table full: give up on the oldest
+    slot->pkt = pkt;
+    slot->firstUs = nowUs;
+    slot->backoffUs = FIRST_RETRY_US;
+    slot->nextUs = nowUs + FIRST_RETRY_US;
+    slot->retries = 0;
+    slot->acked = 0;
+    slot->needed = knownMask();
+    slot->active = true;
+    stats_.sent++;
+  }
+
+  // Record one ACK. Unknown senders become known peers.
+  void onAck(const AckEvent& ack) {
+    const int8_t peer = findOrAddPeer(ack.mac);
+    for (Pending& p : pending_) {
+      if (!p.active || p.pkt.hdr.seq != ack.seq) continue;
+      if (peer >= 0) p.acked |= 1u << peer;
+      // Nobody was known at send time: the first ACK is the best we can do
+      if (p.needed == 0 || (p.acked & p.needed) == p.needed) complete(p, ack.rxUs);
+      return;
+    }
+  }
+
+  // Next spell due for retransmission, or nullptr. The caller sends it again
+  // as-is; call until it returns nullptr.
+  const SpellPacketV2* due(uint32_t nowUs) {
+    for (Pending& p : pending_) {
+      if (!p.active || (int32_t)(nowUs - p.nextUs) < 0) continue;
+      // A forgotten peer no longer counts: whoever is left may have confirmed it
+      if (p.acked != 0 && (p.acked & p.needed) == p.needed) {
+        complete(p, nowUs);
+        continue;
+      }
+      if (p.retries >= MAX_RETRIES || (p.needed == 0 && knownMask() == 0)) {
+        fail(p);
+        continue;
+      }
+      p.retries++;
+      stats_.retries++;
+      p.backoffUs *= 2;
+      p.nextUs = nowUs + p.backoffUs;
+      return &p.pkt;
+    }
+    return nullptr;
+  }
+
+  uint8_t peers() const {
+    uint8_t n = 0;
+    for (const Peer& p : peers_) n += p.used ? 1 : 0;
+    return n;
+  }
+
+  Stats stats() const { return stats_; }
+
+  // Stats accumulated since the previous call, for periodic reports
+  Stats takeInterval() {
+    const Stats d = {stats_.sent - last_.sent, stats_.delivered - last_.delivered, stats_.failed - last_.failed,
+                     stats_.retries - last_.retries, stats_.latencySumUs - last_.latencySumUs,
+                     stats_.latencyMaxUs};
+    last_ = stats_;
+    stats_.latencyMaxUs = 0;
+    return d;
+  }
+
+ private:
+  struct Pending {
+    SpellPacketV2 pkt;
+    uint32_t firstUs;
+    uint32_t nextUs;
+    uint32_t backoffUs;
+    uint32_t acked;   // peer bits that confirmed
+    uint32_t needed;  // peers known when it was sent
+    uint8_t retries;
+    bool active;
+  };
+
+  struct Peer {
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    uint8_t misses;
+    bool used;
+  };
+
+  uint32_t knownMask() const {
+    uint32_t m = 0;
+    for (uint8_t i = 0; i < MaxPeers; i++) {
+      if (peers_[i].used) m |= 1u << i;
+    }
+    return m;
+  }
+
+  int8_t findOrAddPeer(const uint8_t* mac) {
+    int8_t freeSlot = -1;
+    for (uint8_t i = 0; i < MaxPeers; i++) {
+      if (!peers_[i].used) {
+        if (freeSlot < 0) freeSlot = (int8_t)i;
+        continue;
+      }
+      if (memcmp(peers_[i].mac, mac, ESP_NOW_ETH_ALEN) == 0) {
+        peers_[i].misses = 0;
+        return (int8_t)i;
+      }
+    }
+    if (freeSlot >= 0) {
+      clearPeer((uint8_t)freeSlot);
+      memcpy(peers_[freeSlot].mac, mac, ESP_NOW_ETH_ALEN);
+      peers_[freeSlot].misses = 0;
+      peers_[freeSlot].used = true;
+    }
+    return freeSlot;  // -1: table full, the ACK still counts for unknown-peer spells
+  }
+
+  void complete(Pending& p, uint32_t nowUs) {
+    const uint32_t latency = nowUs - p.firstUs;
+    stats_.delivered++;
+    stats_.latencySumUs += latency;
+    if (latency > stats_.latencyMaxUs) stats_.latencyMaxUs = latency;
+    p.active = false;
+  }
+
+  void fail(Pending& p) {
+    stats_.failed++;
+    const uint32_t missing = p.needed & ~p.acked;
+    for (uint8_t i = 0; i < MaxPeers; i++) {
+      if (!(missing & (1u << i)) || !peers_[i].used) continue;
+      if (++peers_[i].misses >= PEER_MISS_LIMIT) {
+        peers_[i].used = false;
+        clearPeer(i);
+      }
+    }
+    p.active = false;
+  }
+
+  // A slot's bit must not outlive its peer: a new MAC in the same slot would
+  // otherwise confirm spells the old one never acknowledged
+  void clearPeer(uint8_t i) {
+    const uint32_t bit = 1u << i;
+    for (Pending& p : pending_) {
+      p.needed &= ~bit;
+      p.acked &= ~bit;
+    }
+  }
+
+  Pending pending_[MaxPending] = {};
+  Peer peers_[MaxPeers] = {};
+  Stats stats_ = {0, 0, 0, 0, 0, 0};
+  Stats last_ = {0, 0, 0, 0, 0, 0};
+};
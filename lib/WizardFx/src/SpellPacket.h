@@ -0,0 +1,166 @@
+#pragma once
+
+// ESP-NOW spell wire format.
+//
+// v1 (legacy, sender.cpp and older staff builds): a bare 4-byte int effect_id.
+// v2: a packed little-endian frame with magic, version, sequence number,
+// sender timestamp, effect parameters and a CRC-16. Receivers accept both;
+// a v1 frame is recognised by its exact 4-byte length.
+//
+// An old v1-only receiver reads the first four bytes of a v2 frame as the
+// int 0x01025A57. That is not a known spell, so it only flashes; it never
+// switches effects by accident.
+//
+// Parsing is zero-copy: parseSpell() validates the frame in place and returns
+// a pointer into the receive buffer, so the ESP-NOW callback can reject
+// malformed frames before anything is queued.
+
+#include <Arduino.h>
+
+static constexpr uint16_t SPELL_MAGIC = 0x5A57;  // "WZ" on the wire
+static constexpr uint8_t SPELL_VERSION = 2;
+
+// Message types sharing the v2 header
+enum SpellMsgType : uint8_t {
+  SPELL_MSG_SPELL = 1,
+  SPELL_MSG_SYNC = 2,  // clock beacon from the staff (SyncBeacon)
+  SPELL_MSG_ACK = 3,   // receiver -> staff acknowledgement (SpellAck)
+  SPELL_MSG_STATE = 4, // periodic absolute effect state from the staff (StateSync)
+  SPELL_MSG_PIXELS = 5,  // streamed frame fragment, variable length (PixelStream.h)
+};
+
+// SpellPacketV2::flags: which optional parameters are set
+enum SpellParamFlags : uint8_t {
+  SPELL_HAS_BRIGHTNESS = 1 << 0,
+  SPELL_HAS_TEMPO = 1 << 1,
+  SPELL_HAS_PALETTE = 1 << 2,
+  SPELL_HAS_SEED = 1 << 3,
+  SPELL_HAS_EXEC_AT = 1 << 4,  // apply at hdr.senderUs + leadMs on the shared clock
+  SPELL_ACK_REQUESTED = 1 << 7,  // reliable mode: receivers answer with a SpellAck
+};
+
+struct __attribute__((packed)) SpellHeader {
+  uint16_t magic;     // SPELL_MAGIC
+  uint8_t version;    // SPELL_VERSION
+  uint8_t type;       // SpellMsgType
+  uint32_t seq;       // per-sender, +1 per frame
+  uint64_t senderUs;  // sender esp_timer_get_time() when sent
+};
+
+struct __attribute__((packed)) SpellPacketV2 {
+  SpellHeader hdr;
+  int16_t spell;       // same ids as v1
+  uint8_t flags;       // SpellParamFlags
+  uint8_t brightness;  // 1-255, if SPELL_HAS_BRIGHTNESS
+  uint8_t palette;     // if SPELL_HAS_PALETTE (reserved for palette effects)
+  uint8_t leadMs;      // if SPELL_HAS_EXEC_AT: execution delay after senderUs, ms
+  uint32_t tempoQ16;   // Q16.16 tempo multiplier, if SPELL_HAS_TEMPO
+  uint32_t seed;       // if SPELL_HAS_SEED (reserved for randomized effects)
+  uint16_t crc;        // CRC-16/CCITT-FALSE over every preceding byte
+};
+
+// Clock beacon: hdr.senderUs is the staff's clock, stamped just before sending
+struct __attribute__((packed)) SyncBeacon {
+  SpellHeader hdr;
+  uint16_t crc;
+};
+
+// Acknowledgement, unicast back to the sender of a spell. hdr.seq and
+// hdr.senderUs echo the acknowledged spell, so the staff needs no lookup to
+// match it or to measure the round trip.
+struct __attribute__((packed)) SpellAck {
+  SpellHeader hdr;
+  uint16_t crc;
+};
+
+// Absolute effect state, broadcast periodically so a device that missed
+// spells (or just booted) converges without replaying them. Phases are as of
+// atUs, the low 32 bits of the staff's clock.
+struct __attribute__((packed)) StateSync {
+  SpellHeader hdr;
+  uint8_t effect;         // BackgroundEffect
+  uint8_t brightness;
+  uint8_t palette;        // reserved for palette effects
+  uint8_t reserved;
+  uint32_t tempoQ16;
+  uint32_t phaseQ16;      // hue phase
+  uint32_t breathPosQ16;  // breathing triangle position
+  uint32_t atUs;
+  uint16_t crc;
+};
+
+static_assert(sizeof(SpellHeader) == 16, "SpellHeader must stay 16 bytes on the wire");
+static_assert(sizeof(SpellPacketV2) == 32, "SpellPacketV2 must stay 32 bytes on the wire");
+static_assert(sizeof(SyncBeacon) == 18, "SyncBeacon must stay 18 bytes on the wire");
+static_assert(sizeof(SpellAck) == 18, "SpellAck must stay 18 bytes on the wire");
+static_assert(sizeof(StateSync) == 38, "StateSync must stay 38 bytes on the wire");
+
+static constexpr int SPELL_V1_LEN = 4;
+
+enum SpellParseResult : uint8_t {
+  SPELL_OK_V1,
+  SPELL_OK_V2,
+  SPELL_BAD_LENGTH,
+  SPELL_BAD_MAGIC,
+  SPELL_BAD_VERSION,
+  SPELL_BAD_CRC,
+  SPELL_OTHER_TYPE,  // valid v2 header, different message type
+};
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), bitwise: 30 bytes per frame
+// does not justify a 512-byte table. Force-inlined so an IRAM_ATTR callback
+// does not call out to flash.
+__attribute__((always_inline)) inline uint16_t spellCrc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Validate a v2 frame of message type `type` in place (header, length, CRC).
+// T is the packed frame struct; its last member must be `uint16_t crc`.
+template <class T>
+__attribute__((always_inline)) inline SpellParseResult parseFrame(const uint8_t* data, int len, uint8_t type,
+                                                                  const T** out) {
+  if (len < (int)sizeof(SpellHeader)) return SPELL_BAD_LENGTH;
+  const SpellHeader* h = reinterpret_cast<const SpellHeader*>(data);
+  if (h->magic != SPELL_MAGIC) return SPELL_BAD_MAGIC;
+  if (h->version != SPELL_VERSION) return SPELL_BAD_VERSION;
+  if (h->type != type) return SPELL_OTHER_TYPE;
+  if (len < (int)sizeof(T)) return SPELL_BAD_LENGTH;
+  const T* p = reinterpret_cast<const T*>(data);
+  if (spellCrc16(data, offsetof(T, crc)) != p->crc) return SPELL_BAD_CRC;
+  *out = p;
+  return SPELL_OK_V2;
+}
+
+// Validate one received spell payload in place. On SPELL_OK_V2, *v2 points
+// into data; on SPELL_OK_V1, *v1Spell holds the legacy effect id.
+__attribute__((always_inline)) inline SpellParseResult parseSpell(const uint8_t* data, int len,
+                                                                  const SpellPacketV2** v2,
+                                                                  int32_t* v1Spell) {
+  if (len == SPELL_V1_LEN) {
+    memcpy(v1Spell, data, sizeof(*v1Spell));
+    return SPELL_OK_V1;
+  }
+  return parseFrame<SpellPacketV2>(data, len, SPELL_MSG_SPELL, v2);
+}
+
+// Fill the header and CRC of an outgoing frame (body fields set by the caller)
+template <class T>
+inline void sealFrame(T& p, uint8_t type, uint32_t seq, uint64_t senderUs) {
+  p.hdr.magic = SPELL_MAGIC;
+  p.hdr.version = SPELL_VERSION;
+  p.hdr.type = type;
+  p.hdr.seq = seq;
+  p.hdr.senderUs = senderUs;
+  p.crc = spellCrc16(reinterpret_cast<const uint8_t*>(&p), offsetof(T, crc));
+}
+
+inline void sealSpellPacket(SpellPacketV2& p, uint32_t seq, uint64_t senderUs) {
+  sealFrame(p, SPELL_MSG_SPELL, seq, senderUs);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+// Lock-free single-producer/single-consumer ring for received spells.
+//
+// The ESP-NOW receive callback runs on the WiFi task and is the only producer;
+// whichever task owns the effect engine is the only consumer and drains the
+// ring once per frame. Each side writes only its own index, so push() and pop()
+// are a copy plus one atomic store: no locks, no critical sections, nothing
+// that can stall the radio. Unlike the old per-spell volatile flags, repeated
+// spells are queued individually (three brightness-ups are three steps).
+
+#include <Arduino.h>
+
+#include <atomic>
+
+#include "SpellPacket.h"
+
+struct SpellEvent {
+  int32_t spell;        // effect id
+  uint32_t rxUs;        // micros() when the callback received it
+  uint32_t seq;         // sender sequence number (v2 only)
+  uint64_t senderUs;    // sender timestamp (v2 only)
+  uint32_t tempoQ16;    // valid if flags & SPELL_HAS_TEMPO
+  uint32_t seed;        // valid if flags & SPELL_HAS_SEED
+  uint8_t version;      // wire version: 1 or 2
+  uint8_t flags;        // SpellParamFlags (0 for v1)
+  uint8_t brightness;   // valid if flags & SPELL_HAS_BRIGHTNESS
+  uint8_t palette;      // valid if flags & SPELL_HAS_PALETTE
+  uint8_t leadMs;       // valid if flags & SPELL_HAS_EXEC_AT
+  uint8_t mac[6];       // sender, for ACKs (filled by the receive callback)
+};
+
+// Validate one ESP-NOW payload and fill ev from it (only on success). Meant
+// for the receive callback, so it is inlined and copies only what it needs.
+__attribute__((always_inline)) inline bool decodeSpell(const uint8_t* data, int len, uint32_t rxUs,
+                                                       SpellEvent& ev, SpellParseResult* result = nullptr) {
+  const SpellPacketV2* p = nullptr;
+  int32_t v1 = 0;
+  const SpellParseResult r = parseSpell(data, len, &p, &v1);
+  if (result) *result = r;
+  if (r != SPELL_OK_V1 && r != SPELL_OK_V2) return false;
+  ev = SpellEvent{};  // named fields below; anything added later starts at zero
+  ev.rxUs = rxUs;
+  if (r == SPELL_OK_V1) {
+    ev.spell = v1;
+    ev.version = 1;
+    return true;
+  }
+  ev.spell = p->spell;
+  ev.seq = p->hdr.seq;
+  ev.senderUs = p->hdr.senderUs;
+  ev.tempoQ16 = p->tempoQ16;
+  ev.seed = p->seed;
+  ev.version = p->hdr.version;
+  ev.flags = p->flags;
+  ev.brightness = p->brightness;
+  ev.palette = p->palette;
+  ev.leadMs = p->leadMs;
+  return true;
+}
+
+// Capacity must be a power of two; one slot is kept free to tell full from empty
+template <typename T, uint16_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+ public:
+  // Producer side. Inlined so an IRAM_ATTR callback keeps it in IRAM.
+  // Returns false (and counts a drop) if the consumer has fallen a full ring behind.
+  __attribute__((always_inline)) inline bool push(const T& item) {
+    const uint16_t head = head_.load(std::memory_order_relaxed);
+    const uint16_t next = (head + 1) & kMask;
+    if (next == tail_.load(std::memory_order_acquire)) {
+      dropped_++;
+      return false;
+    }
+    slots_[head] = item;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& item) {
+    const uint16_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    item = slots_[tail];
+    tail_.store((tail + 1) & kMask, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+  }
+  // Events rejected because the ring was full (written by the producer only)
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  static constexpr uint16_t kMask = Capacity - 1;
+  T slots_[Capacity];
+  std::atomic<uint16_t> head_{0};  // next slot to write (producer)
+  std::atomic<uint16_t> tail_{0};  // next slot to read (consumer)
+  volatile uint32_t dropped_ = 0;
+};
+
+// Sized for bursts far beyond what the staff can send between two frames
+using SpellQueue = SpscRing<SpellEvent, 32>;
@@ -0,0 +1,292 @@
+#pragma once
+
+// The ESP-NOW receive path shared by the hat, cape and receiver firmwares.
+//
+// onRecv() runs on the WiFi task. It validates each frame and queues it:
+// spells, clock beacons, state frames and pixel fragments. Nothing heavier
+// happens there. The task that owns the engine calls drain() once per frame.
+// drain() does the rest, in order:
+//
+//   1. adopts clock beacons
+//   2. ACKs and dedupes spells, and holds scheduled ones for their slot on
+//      the shared clock
+//   3. applies the other spells
+//   4. adopts state frames
+//   5. reports queue and CRC counters as they change
+//
+// updateStream() copies streamed frames into the strands right before tick().
+// The stream needs STREAM_FRAMES=1 on both ends. It costs ~4 KB of fragment
+// queue plus two frames of StreamPixels. Without it, fragments are counted as
+// valid traffic and dropped.
+//
+// The firmware keeps the engine, the trace log and its own logging. It hands
+// them in, plus a plain onRecv() wrapper (IRAM_ATTR) to register with ESP-NOW:
+//
+//   SpellReceiver<HatLayout, NUM_LEDS_STOLE> rx(engine, traceLog, serialLogF);
+//   void IRAM_ATTR onRecv(const uint8_t* mac, const uint8_t* data, int len) { rx.onRecv(mac, data, len); }
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "ClockSync.h"
+#include "EffectEngine.h"
+#include "LinkHealth.h"
+#include "PixelStream.h"
+#include "ReliableLink.h"
+#include "SpellQueue.h"
+#include "SpellSchedule.h"
+#include "StateSync.h"
+#include "Trace.h"
+
+#ifndef CLOCK_SYNC_LOG_EVERY
+#define CLOCK_SYNC_LOG_EVERY 10  // beacons between offset/drift log lines
+#endif
+#ifndef STREAM_FRAMES
+#define STREAM_FRAMES 0  // show pixel frames streamed by the staff
+#endif
+#ifndef STREAM_TIMEOUT_MS
+#define STREAM_TIMEOUT_MS 500  // no complete frame for this long: back to effects
+#endif
+#ifndef LINK_STATS_INTERVAL_MS
+#define LINK_STATS_INTERVAL_MS 30000  // reportLink() period
+#endif
+
+// printf to Serial, for firmwares without NetSerial
+inline void serialLogF(const char* fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  Serial.print(buf);
+}
+
+template <class Layout, uint16_t StreamPixels>
+class SpellReceiver {
+ public:
+  using Engine = EffectEngine<Layout>;
+  using Log = void (*)(const char* fmt, ...);
+  using FirstSpellHook = void (*)(const SpellEvent& ev);
+
+  struct Stats {
+    uint32_t queueDrops;  // spells lost to a full queue
+    uint32_t duplicates;  // v2 retransmissions dropped
+    uint32_t rejected;    // frames no decoder accepted
+    uint32_t late;        // scheduled spells applied after their slot
+  };
+
+  SpellReceiver(Engine& engine, TraceLog& trace, Log log) : engine_(engine), trace_(trace), log_(log) {}
+
+  // Called once with the first spell after boot (fast-reconnect timing)
+  void onFirstSpell(FirstSpellHook hook) { firstSpell_ = hook; }
+
+  // WiFi task: validate (v1 or v2) and queue. Inlined into the firmware's
+  // IRAM_ATTR wrapper.
+  __attribute__((always_inline)) inline void onRecv(const uint8_t* mac, const uint8_t* data, int len) {
+    const uint64_t rxUs = esp_timer_get_time();
+    SpellEvent ev;
+    ClockSample cs;
+    EffectState st;
+    bool valid = true;
+#if STREAM_FRAMES
+    const bool fragment = queueStreamFragment(streamQueue_, data, len);  // decoded by updateStream()
+#else
+    const bool fragment = isStreamFragment(data, len);  // stream not built in: dropped
+#endif
+    if (fragment) {
+      // nothing more to do
+    } else if (decodeSpell(data, len, (uint32_t)rxUs, ev)) {
+      memcpy(ev.mac, mac, sizeof(ev.mac));
+      spellQueue_.push(ev);
+    } else if (decodeSync(data, len, rxUs, cs)) {
+      syncQueue_.push(cs);
+    } else if (decodeState(data, len, st)) {
+      stateQueue_.push(st);
+    } else {
+      rejected_++;
+      valid = false;
+    }
+    link_.onFrame(mac, data, len, valid, (uint32_t)(rxUs / 1000));
+  }
+
+  // Engine owner, once per frame
+  void drain() {
+    drainClockSync();
+    SpellEvent ev;
+    while (spellQueue_.pop(ev)) {
+      // ACK every copy (the lost frame may have been our ACK), apply only the first
+      if (ev.flags & SPELL_ACK_REQUESTED) sendSpellAck(ev.mac, ev.seq, ev.senderUs);
+      if (ev.version >= 2 && !seqs_.accept(ev.seq)) continue;
+      if (!seenSpell_) {
+        seenSpell_ = true;
+        if (firstSpell_) firstSpell_(ev);
+      }
+      // Scheduled spells wait for their slot on the shared clock; without a
+      // lock on the staff's clock there is no slot to wait for
+      if ((ev.flags & SPELL_HAS_EXEC_AT) && clock_.synced() &&
+          schedule_.add(ev, SpellSchedule<>::executeAt(ev), sharedNowUs())) {
+        continue;
+      }
+      apply(ev, sharedNowUs() - ((uint32_t)micros() - ev.rxUs));  // flash from rxUs on the shared clock
+    }
+    while (schedule_.popDue(sharedNowUs(), ev)) apply(ev, sharedNowUs());
+    drainStateSync();
+    reportCounters();
+  }
+
+  // Apply one spell to the engine; flashUs is when the pixel-0 flash starts
+  void apply(const SpellEvent& ev, uint32_t flashUs) {
+    lastSpellUs_ = sharedNow64();
+    haveSpell_ = true;
+    trace_.record(TRACE_SPELL_RECEIVED, ev.spell, ev.version, ev.seq);
+    engine_.applySpell(ev.spell);  // 0-8; anything else only flashes
+    // Absolute parameters carried by v2 frames override the relative steps
+    if (ev.flags & SPELL_HAS_BRIGHTNESS) engine_.setBrightness(ev.brightness);
+    if (ev.flags & SPELL_HAS_TEMPO) engine_.setTempoQ16(ev.tempoQ16);
+    switch (ev.spell) {
+      case 5: log_("Tempo decreased. tempoFactor=%.2f\n", engine_.tempo()); break;
+      case 6: log_("Tempo increased. tempoFactor=%.2f\n", engine_.tempo()); break;
+      case 7: log_("Brightness decreased to %u/255\n", engine_.brightness()); break;
+      case 8: log_("Brightness increased to %u/255\n", engine_.brightness()); break;
+      default: break;
+    }
+    engine_.flashPacket(flashUs);
+  }
+
+  // Reassemble streamed fragments and, while frames keep coming, copy the
+  // latest one into the strands in mask (aliased mirrors show their source).
+  // everyFrame: copy even without a new frame, for double-buffered engines
+  // whose back buffers may be a swap behind. Returns whether the stream is
+  // active; the caller hands those strands over with engine.setExternal().
+  bool updateStream(uint32_t mask, bool everyFrame) {
+#if STREAM_FRAMES
+    StreamPacket pkt;
+    while (streamQueue_.pop(pkt)) stream_.onFragment(pkt.data, pkt.len);
+    const bool active = stream_.active(STREAM_TIMEOUT_MS);
+    if (active != streamActive_) {
+      streamActive_ = active;
+      const typename PixelStreamReceiver<StreamPixels>::Stats ps = stream_.stats();
+      log_("Pixel stream: %s (%lu frames, %lu dropped, %lu bad fragments, %lu queue drops so far)\n",
+           active ? "showing streamed frames" : "timed out, back to effects", (unsigned long)ps.frames,
+           (unsigned long)ps.dropped, (unsigned long)ps.badFragments, (unsigned long)streamQueue_.dropped());
+    }
+    if (!active) return false;
+    const bool fresh = stream_.takeFresh();
+    if (fresh || everyFrame) {
+      for (uint8_t s = 0; s < Layout::kStrands; s++) {
+        if (!(mask & (1u << s)) || Layout::kMirror[s].aliased()) continue;
+        stream_.blit(engine_.strand(s), Layout::kLength[s]);
+      }
+    }
+    if (fresh) engine_.markDirty(mask);
+    return true;
+#else
+    (void)mask;
+    (void)everyFrame;
+    return false;
+#endif
+  }
+
+  // One line per sender every LINK_STATS_INTERVAL_MS (LinkHealth.h)
+  void reportLink() {
+    const uint32_t now = millis();
+    if ((int32_t)(now - nextLinkMs_) < 0) return;
+    nextLinkMs_ = now + LINK_STATS_INTERVAL_MS;
+    char line[128];
+    for (uint8_t i = 0; i < link_.peers(); i++) {
+      if (link_.format(line, sizeof(line), i, now) > 0) log_("Link: %s", line);
+    }
+    if (link_.others()) log_("Link: %lu frames from untracked senders\n", (unsigned long)link_.others());
+  }
+
+  uint64_t sharedNow64() const { return clock_.toShared(esp_timer_get_time()); }
+  uint32_t sharedNowUs() const { return (uint32_t)sharedNow64(); }
+
+  const ClockSync& clock() const { return clock_; }
+  LinkHealth& link() { return link_; }
+  Stats stats() const { return {spellQueue_.dropped(), seqs_.duplicates(), rejected_, schedule_.stats().late}; }
+
+ private:
+  // Clock beacons from the staff
+  void drainClockSync() {
+    ClockSample cs;
+    while (syncQueue_.pop(cs)) {
+      if (clock_.addSample(cs)) {
+        engine_.realign();   // shared clock jumped: re-derive effect phase
+        haveSpell_ = false;  // lastSpellUs_ is on the old timeline
+        log_("Clock sync: %s (offset %lld us)\n", clock_.steps() ? "re-anchored" : "locked to staff",
+             (long long)clock_.offsetUs(cs.localUs));
+      } else if (clock_.beacons() % CLOCK_SYNC_LOG_EVERY == 0) {
+        log_("Clock sync: offset %lld us, drift %ld ppb, last error %ld us\n", (long long)clock_.offsetUs(cs.localUs),
+             (long)clock_.driftPpb(), (long)clock_.lastErrorUs());
+      }
+    }
+  }
+
+  // Periodic absolute state from the staff
+  void drainStateSync() {
+    EffectState st;
+    while (stateQueue_.pop(st)) {
+      // Phases are on the staff's clock; a state sampled before our latest
+      // spell would undo it
+      if (!clock_.synced()) continue;
+      if (haveSpell_ && stateTimeUs(st.atUs, sharedNow64()) < lastSpellUs_) continue;
+      if (engine_.syncState(st)) {
+        log_("State sync: effect %u, brightness %u, tempo %.2fx\n", (unsigned)st.effect, engine_.brightness(),
+             engine_.tempo());
+      }
+    }
+  }
+
+  // Counters that only grow, logged when they change
+  void reportCounters() {
+    const Stats now = stats();
+    if (now.queueDrops != reported_.queueDrops) {
+      log_("Spell queue full: %lu spells dropped so far\n", (unsigned long)now.queueDrops);
+    }
+    if (now.duplicates != reported_.duplicates) {
+      log_("Duplicate spells dropped so far: %lu\n", (unsigned long)now.duplicates);
+    }
+    if (now.late != reported_.late) {
+      log_("Scheduled spells applied late so far: %lu (worst %lu us)\n", (unsigned long)now.late,
+           (unsigned long)schedule_.stats().worstLateUs);
+    }
+    if (now.rejected != reported_.rejected) {
+      log_("Malformed spell frames rejected so far: %lu\n", (unsigned long)now.rejected);
+    }
+    reported_ = now;
+  }
+
+  Engine& engine_;
+  TraceLog& trace_;
+  Log log_;
+  FirstSpellHook firstSpell_ = nullptr;
+
+  // Filled by onRecv() on the WiFi task, drained by the engine owner
+  SpellQueue spellQueue_;
+  SyncQueue syncQueue_;
+  StateQueue stateQueue_;
+#if STREAM_FRAMES
+  StreamQueue streamQueue_;
+#endif
+  volatile uint32_t rejected_ = 0;
+  LinkHealth link_;
+
+  // Engine owner only
+  ClockSync clock_;
+  SeqWindow seqs_;            // v2 retransmissions already applied
+  SpellSchedule<> schedule_;  // spells waiting for their shared-clock slot
+#if STREAM_FRAMES
+  PixelStreamReceiver<StreamPixels> stream_;
+#endif
+  uint64_t lastSpellUs_ = 0;  // shared time the latest spell was applied
+  bool haveSpell_ = false;    // lastSpellUs_ is set
+  bool seenSpell_ = false;
+#if STREAM_FRAMES
+  bool streamActive_ = false;
+#endif
+  Stats reported_ = {0, 0, 0, 0};
+  uint32_t nextLinkMs_ = LINK_STATS_INTERVAL_MS;
+};
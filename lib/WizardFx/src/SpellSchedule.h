@@ -0,0 +1,83 @@
+#pragma once
+
+// Spells held back until a shared-clock instant.
+//
+// A scheduled spell (SPELL_HAS_EXEC_AT) names the moment it should take
+// effect: hdr.senderUs + leadMs on the staff's clock, which every synced
+// device shares (ClockSync.h). With a lead longer than radio latency plus one
+// frame, the staff, hat and cape all switch on the same frame instead of
+// whenever each of them happened to drain its queue.
+//
+// Single-threaded, like the engine it feeds: add() and popDue() both run on
+// the engine owner's task, once per frame.
+
+#include <Arduino.h>
+
+#include "SpellQueue.h"
+
+template <uint8_t Capacity = 8>
+class SpellSchedule {
+ public:
+  // Leads beyond this mean the clock is not trustworthy: apply immediately
+  static constexpr uint32_t MAX_LEAD_US = 1000000;
+
+  struct Stats {
+    uint32_t scheduled;    // queued ahead of their slot
+    uint32_t late;         // arrived after their slot, applied immediately
+    uint32_t worstLateUs;  // largest lateness seen
+    uint32_t overflow;     // schedule full, applied immediately
+  };
+
+  // Execution instant of a scheduled spell on the shared clock
+  static uint32_t executeAt(const SpellEvent& ev) {
+    return (uint32_t)(ev.senderUs + (uint64_t)ev.leadMs * 1000u);
+  }
+
+  // Queue ev for atUs (shared clock). Returns false if it should be applied
+  // right away instead: already due, implausibly far ahead, or no room.
+  bool add(const SpellEvent& ev, uint32_t atUs, uint32_t nowUs) {
+    const int32_t lead = (int32_t)(atUs - nowUs);
+    if (lead <= 0) {
+      stats_.late++;
+      if ((uint32_t)-lead > stats_.worstLateUs) stats_.worstLateUs = (uint32_t)-lead;
+      return false;
+    }
+    if ((uint32_t)lead > MAX_LEAD_US) return false;
+    if (count_ == Capacity) {
+      stats_.overflow++;
+      return false;
+    }
+    // Keep slots sorted by time; equal times stay in arrival order
+    uint8_t i = count_;
+    while (i > 0 && (int32_t)(slots_[i - 1].atUs - atUs) > 0) {
+      slots_[i] = slots_[i - 1];
+      i--;
+    }
+    slots_[i] = {ev, atUs};
+    count_++;
+    stats_.scheduled++;
+    return true;
+  }
+
+  // Earliest spell whose time has come, if any; call until it returns false
+  bool popDue(uint32_t nowUs, SpellEvent& ev) {
+    if (count_ == 0 || (int32_t)(nowUs - slots_[0].atUs) < 0) return false;
+    ev = slots_[0].ev;
+    for (uint8_t i = 1; i < count_; i++) slots_[i - 1] = slots_[i];
+    count_--;
+    return true;
+  }
+
+  uint8_t pending() const { return count_; }
+  Stats stats() const { return stats_; }
+
+ private:
+  struct Slot {
+    SpellEvent ev;
+    uint32_t atUs;
+  };
+
+  Slot slots_[Capacity];
+  uint8_t count_ = 0;
+  Stats stats_ = {0, 0, 0, 0};
+};
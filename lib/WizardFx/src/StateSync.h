@@ -0,0 +1,44 @@
+#pragma once
+
+// Periodic absolute state sync between the staff and receivers.
+//
+// Spells are edges: a receiver that was off, out of range or rebooting when
+// one was cast stays wrong until the next spell. Every STATE_SYNC_INTERVAL_MS
+// the staff also broadcasts its EffectEngine::state() as a StateSync frame,
+// and receivers adopt it with EffectEngine::syncState(), so a late joiner
+// converges within one interval. Phases are on the shared clock
+// (ClockSync.h); receivers only adopt them once locked to it.
+
+#include <Arduino.h>
+#include <string.h>
+
+#include "EffectEngine.h"
+#include "SpellPacket.h"
+#include "SpellQueue.h"
+
+inline void fillStateSync(StateSync& f, const EffectState& s) {
+  f.effect = s.effect;
+  f.brightness = s.brightness;
+  f.palette = 0;
+  f.reserved = 0;
+  f.tempoQ16 = s.tempoQ16;
+  f.phaseQ16 = s.phaseQ16;
+  f.breathPosQ16 = s.breathPosQ16;
+  f.atUs = s.atUs;
+}
+
+// Validate one ESP-NOW payload as a StateSync and fill s from it (only on
+// success). Inlined for the receive callback, like decodeSpell().
+__attribute__((always_inline)) inline bool decodeState(const uint8_t* data, int len, EffectState& s) {
+  const StateSync* f = nullptr;
+  if (parseFrame(data, len, SPELL_MSG_STATE, &f) != SPELL_OK_V2) return false;
+  s = {f->effect, f->brightness, f->tempoQ16, f->phaseQ16, f->breathPosQ16, f->atUs};
+  return true;
+}
+
+// Widen a state's atUs (low 32 bits of the shared clock) to the full shared
+// clock, taking the value nearest nowUs: states are seconds old at most
+inline uint64_t stateTimeUs(uint32_t atUs, uint64_t nowUs) { return nowUs + (int32_t)(atUs - (uint32_t)nowUs); }
+
+// Only the newest state matters; a few slots cover a stalled consumer
+using StateQueue = SpscRing<EffectState, 4>;
@@ -0,0 +1,198 @@
+#pragma once
+
+// Compact event tracing for the hot paths.
+//
+// Pad presses, received spells and the touch diagnostics used to be printf
+// lines: a vsnprintf per event and 30-90 bytes of UART or TCP each. A trace
+// event is just an id from TraceEvents.def, a micros() timestamp and up to
+// four integers:
+//
+//   traceLog.record(TRACE_PAD_PRESS, 0, now);
+//
+// With TRACE_LOG=1 that is one MpscRing slot claimed and filled (no
+// formatting). A low-priority task packs the records into a binary stream and
+// hands it to the firmware's writer: NetSerial on the cape and staff, Serial
+// on the hat and receiver. tools/trace_decode turns the stream back into log
+// lines and timelines using the format strings from TraceEvents.def, which
+// are not compiled into the firmware. Plain text in the stream (the other
+// logs) passes through the decoder unchanged.
+//
+// With TRACE_LOG=0 (the default) record() formats the same line on the spot
+// and writes it as text, so a serial monitor needs no decoder.
+//
+// Wire format, little-endian, 7 + 4 * nargs bytes per record:
+//
+//   0xA5 | event | nargs | tUs (u32) | args (i32 x nargs)
+//
+// 0xA5 never appears in the ASCII logs, which is how the decoder finds
+// records. Records lost to a full ring are reported as a TRACE_DROPPED record.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef TRACE_LOG
+#define TRACE_LOG 0  // 1: binary records for tools/trace_decode
+#endif
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 128  // queued records; power of two
+#endif
+
+enum TraceEvent : uint8_t {
+#define TRACE_EVENT(name, fmt) TRACE_##name,
+#include "TraceEvents.def"
+#undef TRACE_EVENT
+  TRACE_EVENT_COUNT
+};
+
+static constexpr uint8_t TRACE_SYNC = 0xA5;
+static constexpr uint8_t TRACE_MAX_ARGS = 4;
+static constexpr size_t TRACE_HEADER_BYTES = 7;
+static constexpr size_t TRACE_MAX_BYTES = TRACE_HEADER_BYTES + 4 * TRACE_MAX_ARGS;
+
+struct TraceRecord {
+  uint32_t tUs;
+  uint8_t event;  // TraceEvent
+  uint8_t nargs;
+  int32_t args[TRACE_MAX_ARGS];
+};
+
+// Format strings by event id. Only referenced with TRACE_LOG=0 and by the
+// decoder, so a binary-trace build leaves them out.
+static constexpr const char* kTraceFormats[] = {
+#define TRACE_EVENT(name, fmt) fmt,
+#include "TraceEvents.def"
+#undef TRACE_EVENT
+};
+
+// Serialize one record into out (TRACE_MAX_BYTES); returns the length
+inline size_t encodeTrace(const TraceRecord& r, uint8_t* out) {
+  out[0] = TRACE_SYNC;
+  out[1] = r.event;
+  out[2] = r.nargs;
+  for (int i = 0; i < 4; i++) out[3 + i] = (uint8_t)(r.tUs >> (8 * i));
+  uint8_t* p = out + TRACE_HEADER_BYTES;
+  for (uint8_t a = 0; a < r.nargs; a++) {
+    for (int i = 0; i < 4; i++) *p++ = (uint8_t)((uint32_t)r.args[a] >> (8 * i));
+  }
+  return (size_t)(p - out);
+}
+
+// Parse a record at data[0] (which must be TRACE_SYNC). Returns the bytes
+// used, 0 if more data is needed, or -1 if this is not a valid record.
+inline int decodeTrace(const uint8_t* data, size_t len, TraceRecord& r) {
+  if (len < TRACE_HEADER_BYTES) return 0;
+  if (data[0] != TRACE_SYNC || data[1] >= TRACE_EVENT_COUNT || data[2] > TRACE_MAX_ARGS) return -1;
+  const size_t size = TRACE_HEADER_BYTES + 4 * (size_t)data[2];
+  if (len < size) return 0;
+  r.event = data[1];
+  r.nargs = data[2];
+  r.tUs = 0;
+  for (int i = 0; i < 4; i++) r.tUs |= (uint32_t)data[3 + i] << (8 * i);
+  const uint8_t* p = data + TRACE_HEADER_BYTES;
+  for (uint8_t a = 0; a < r.nargs; a++, p += 4) {
+    r.args[a] = (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+  }
+  return (int)size;
+}
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+
+#include "MpscRing.h"
+
+class TraceLog {
+ public:
+  // Receives binary records (TRACE_LOG=1) or finished text lines
+  using Writer = void (*)(const uint8_t* data, size_t len);
+
+  static constexpr uint32_t TASK_STACK = 2048;
+  static constexpr UBaseType_t PRIORITY = 1;  // below rendering, output and radio work
+  static constexpr uint32_t POLL_MS = 10;
+  static constexpr size_t BATCH_BYTES = 128;  // per writer call; fits a NetSerial line
+  static constexpr size_t TEXT_LINE = 96;     // TRACE_LOG=0 line buffer
+
+  // TRACE_LOG=1 also starts the packing task. Returns false if it could not
+  // be created.
+  bool begin(Writer out, BaseType_t core = 0) {
+    out_ = out;
+#if TRACE_LOG
+    if (task_) return true;
+    return xTaskCreatePinnedToCore(drainTask, "trace", TASK_STACK, this, PRIORITY, &task_, core) == pdPASS;
+#else
+    return true;
+#endif
+  }
+
+  // Any task, never blocks. Arguments are stored as int32_t.
+  template <typename... A>
+  void record(TraceEvent ev, A... args) {
+    static_assert(sizeof...(A) <= TRACE_MAX_ARGS, "at most four trace arguments");
+#if TRACE_LOG
+    Ring::Slot* s = ring_.reserve();
+    if (!s) return;
+    TraceRecord& r = s->item;
+    r.tUs = micros();
+    r.event = ev;
+    r.nargs = sizeof...(A);
+    const int32_t values[] = {(int32_t)args..., 0};
+    memcpy(r.args, values, sizeof(int32_t) * sizeof...(A));
+    ring_.publish(s);
+#else
+    if (!out_) return;
+    char line[TEXT_LINE];
+    int n = snprintf(line, sizeof(line) - 1, kTraceFormats[ev], (long)args..., 0L);
+    if (n < 0) return;
+    if (n > (int)sizeof(line) - 2) n = sizeof(line) - 2;
+    line[n++] = '\n';
+    out_((const uint8_t*)line, (size_t)n);
+#endif
+  }
+
+  // Records lost because the ring was full
+  uint32_t dropped() const {
+#if TRACE_LOG
+    return ring_.dropped();
+#else
+    return 0;
+#endif
+  }
+
+ private:
+#if TRACE_LOG
+  using Ring = MpscRing<TraceRecord, TRACE_RECORDS>;
+
+  static void drainTask(void* arg) {
+    TraceLog* self = static_cast<TraceLog*>(arg);
+    uint8_t batch[BATCH_BYTES];
+    for (;;) {
+      size_t used = 0;
+      const uint32_t dropped = self->ring_.dropped();
+      if (dropped != self->reportedDrops_) {
+        const TraceRecord r = {(uint32_t)micros(), TRACE_DROPPED, 1, {(int32_t)(dropped - self->reportedDrops_)}};
+        self->reportedDrops_ = dropped;
+        used += encodeTrace(r, batch);
+      }
+      while (Ring::Slot* s = self->ring_.front()) {
+        if (used + TRACE_MAX_BYTES > sizeof(batch)) {
+          self->out_(batch, used);
+          used = 0;
+        }
+        used += encodeTrace(s->item, batch + used);
+        self->ring_.release(s);
+      }
+      if (used) self->out_(batch, used);
+      vTaskDelay(pdMS_TO_TICKS(POLL_MS));
+    }
+  }
+
+  Ring ring_;
+  uint32_t reportedDrops_ = 0;
+  TaskHandle_t task_ = nullptr;
+#endif
+  Writer out_ = nullptr;
+};
+#endif
@@ -0,0 +1,323 @@
+#pragma once
+
+// Non-blocking WiFi station bring-up.
+//
+// setup() used to spin in a delay(500) loop for up to ten seconds waiting
+// for the access point, with the LEDs dark and ESP-NOW not yet listening.
+// Instead, begin() starts the association and returns at once; poll() is
+// called once per frame from loop() and reports, exactly once, whether the
+// attempt connected or timed out. The caller reacts to that event (OTA
+// setup, or the ESP-NOW-only fallback) while effects and spells keep running.
+//
+// Fast reconnect: after a successful connection the caller saves the BSSID,
+// channel and ESP-NOW channel (save()). The copy lives in RTC slow memory,
+// which survives deep sleep, and in NVS, which survives power loss. The next
+// begin() then associates with that BSSID on that channel, which skips the
+// all-channel scan. The address always comes from DHCP, so the lease is
+// renewed on every boot rather than reused after the router gave it away. If
+// the cached access point does not answer within WIFI_FAST_CONNECT_TIMEOUT_MS,
+// it falls back to a normal scan. The cached ESP-NOW channel lets
+// the firmware listen on the right channel before WiFi is up at all.
+//
+// Losing the access point later: the driver's own reconnect scans every
+// channel, and ESP-NOW stops hearing the staff while the radio hops. After
+// holdChannel() the driver no longer reconnects by itself. A disconnect pins
+// the radio back on the ESP-NOW channel, and poll() looks for the access
+// point on that channel only (every WIFI_RETRY_INTERVAL_MS) and rejoins when
+// it is back. An access point that returns on another channel is not
+// followed; the show keeps running on ESP-NOW alone.
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <esp_system.h>
+#include <esp_wifi.h>
+
+#ifndef WIFI_CONNECT_TIMEOUT_MS
+#define WIFI_CONNECT_TIMEOUT_MS 10000  // same budget as the old 20 x 500 ms wait
+#endif
+#ifndef WIFI_FAST_CONNECT_TIMEOUT_MS
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 2000  // cached BSSID silent this long: scan instead
+#endif
+#ifndef WIFI_RETRY_INTERVAL_MS
+#define WIFI_RETRY_INTERVAL_MS 5000  // access point lost: look for it on our channel this often
+#endif
+
+enum WifiBringupEvent : uint8_t {
+  WIFI_BRINGUP_NONE,       // still connecting, or already resolved
+  WIFI_BRINGUP_CONNECTED,  // associated and has an IP
+  WIFI_BRINGUP_FAILED,     // gave up after the timeout
+  WIFI_BRINGUP_LOST,       // after holdChannel(): link dropped, radio kept on the channel
+  WIFI_BRINGUP_RESTORED,   // rejoined the access point after WIFI_BRINGUP_LOST
+};
+
+// Last good association
+struct WifiCache {
+  uint32_t magic;
+  uint32_t ssidHash;  // a different SSID invalidates the entry
+  uint8_t bssid[6];
+  uint8_t channel;        // access point channel
+  uint8_t espnowChannel;  // channel ESP-NOW ran on with this access point
+};
+
+// How this boot started, for reset-to-first-spell measurements
+inline const char* resetKind() {
+  switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:
+      return "cold boot";
+    case ESP_RST_DEEPSLEEP:
+      return "deep-sleep wake";
+    case ESP_RST_BROWNOUT:
+      return "brownout";
+    default:
+      return "reset";
+  }
+}
+
+class WifiBringup {
+ public:
+  static constexpr uint32_t CACHE_MAGIC = 0x57464332;  // "WFC2": no IP lease since v2
+
+  void begin(const char* ssid, const char* password, uint32_t timeoutMs = WIFI_CONNECT_TIMEOUT_MS) {
+    ssid_ = ssid;
+    password_ = password;
+    timeoutMs_ = timeoutMs;
+    startMs_ = millis();
+    const WifiCache* c = cache(ssid);
+    if (c) {
+      // Straight to the known BSSID and channel; DHCP as usual
+      WiFi.begin(ssid, password, c->channel, c->bssid);
+      state_ = FAST;
+    } else {
+      WiFi.begin(ssid, password);
+      state_ = SCANNING;
+    }
+  }
+
+  // Cheap enough for every frame: WiFi.status() reads cached driver state
+  WifiBringupEvent poll() {
+    switch (state_) {
+      case FAST:
+      case SCANNING:
+        return pollConnect();
+      case CONNECTED:
+      case LOST:
+      case REJOINING:
+        return pollLink();
+      default:
+        return WIFI_BRINGUP_NONE;
+    }
+  }
+
+  // After WIFI_BRINGUP_CONNECTED, once ESP-NOW runs on channel: never let the
+  // station leave it again (see the top of this file)
+  void holdChannel(uint8_t channel) {
+    channel_ = channel;
+    WiFi.setAutoReconnect(false);
+    if (handlerAdded_) return;
+    handlerAdded_ = true;
+    WiFi.onEvent([this](arduino_event_id_t, arduino_event_info_t) { onDisconnected(); },
+                 ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  }
+
+  // After WIFI_BRINGUP_CONNECTED, once the firmware has settled on its
+  // ESP-NOW channel: remember this association for the next boot. NVS is
+  // only written when something changed, to spare the flash.
+  void save(uint8_t espnowChannel) {
+    WifiCache c = {};
+    c.magic = CACHE_MAGIC;
+    c.ssidHash = hashSsid(ssid_);
+    memcpy(c.bssid, WiFi.BSSID(), sizeof(c.bssid));
+    c.channel = (uint8_t)WiFi.channel();
+    c.espnowChannel = espnowChannel;
+    rtcCache() = c;
+    if (loadNvs() && memcmp(&nvs_, &c, sizeof(c)) == 0) return;
+    Preferences prefs;
+    if (prefs.begin(NVS_NAMESPACE, false)) {
+      prefs.putBytes(NVS_KEY, &c, sizeof(c));
+      prefs.end();
+    }
+    nvs_ = c;
+    nvsLoaded_ = true;
+  }
+
+  // The valid cached association for this SSID, or null. RTC memory first
+  // (deep-sleep wake), then NVS. Usable before begin() given the SSID.
+  const WifiCache* cache(const char* ssid = nullptr) {
+    if (!cacheChecked_) {
+      cacheChecked_ = true;
+      const uint32_t hash = hashSsid(ssid ? ssid : ssid_);
+      const WifiCache& rtc = rtcCache();
+      if (valid(rtc, hash)) {
+        cached_ = rtc;
+        source_ = "RTC";
+      } else if (loadNvs() && valid(nvs_, hash)) {
+        cached_ = nvs_;
+        source_ = "NVS";
+      } else {
+        source_ = nullptr;
+      }
+    }
+    return source_ ? &cached_ : nullptr;
+  }
+
+  // ESP-NOW channel of the cached association, 0 if there is none
+  uint8_t cachedEspNowChannel(const char* ssid = nullptr) {
+    const WifiCache* c = cache(ssid);
+    return c ? c->espnowChannel : 0;
+  }
+
+  bool pending() const { return state_ == FAST || state_ == SCANNING; }
+  bool connected() const { return state_ == CONNECTED; }
+  // Times the access point was lost after holdChannel()
+  uint32_t losses() const { return losses_; }
+  // Connected straight to the cached BSSID, without a scan
+  bool fast() const { return fast_; }
+  // Time from begin() to the connect/fail event
+  uint32_t elapsedMs() const { return elapsedMs_; }
+  // Cached attempts that had to fall back to a scan
+  uint32_t fallbacks() const { return fallbacks_; }
+
+  // For logs: "fast reconnect (RTC)", "full scan", "connecting", ...
+  const char* describe() const {
+    switch (state_) {
+      case IDLE:
+        return "off";
+      case FAST:
+      case SCANNING:
+        return "connecting";
+      case CONNECTED:
+        if (!fast_) return "full scan";
+        return strcmp(source_, "RTC") == 0 ? "fast reconnect (RTC)" : "fast reconnect (NVS)";
+      case LOST:
+      case REJOINING:
+        return "access point lost";
+      default:
+        return "failed";
+    }
+  }
+
+ private:
+  enum State : uint8_t { IDLE, FAST, SCANNING, CONNECTED, FAILED, LOST, REJOINING };
+  static constexpr const char* NVS_NAMESPACE = "wifi";
+  static constexpr const char* NVS_KEY = "cache";
+
+  WifiBringupEvent pollConnect() {
+    const uint32_t elapsed = millis() - startMs_;
+    const wl_status_t status = WiFi.status();
+    if (status == WL_CONNECTED) {
+      fast_ = state_ == FAST;
+      state_ = CONNECTED;
+      elapsedMs_ = elapsed;
+      return WIFI_BRINGUP_CONNECTED;
+    }
+    if (elapsed >= timeoutMs_) {
+      state_ = FAILED;
+      elapsedMs_ = elapsed;
+      return WIFI_BRINGUP_FAILED;
+    }
+    if (state_ == FAST &&
+        (elapsed >= WIFI_FAST_CONNECT_TIMEOUT_MS || status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED)) {
+      // Moved access point or new channel: forget it and scan
+      fallbacks_++;
+      WiFi.disconnect();
+      WiFi.begin(ssid_, password_);
+      state_ = SCANNING;
+    }
+    return WIFI_BRINGUP_NONE;
+  }
+
+  // Connected, or lost after holdChannel(): rejoin on channel_ only
+  WifiBringupEvent pollLink() {
+    const uint32_t now = millis();
+    if (linkDown_) {
+      linkDown_ = false;
+      const bool wasUp = state_ == CONNECTED;
+      state_ = LOST;
+      retryAtMs_ = now + WIFI_RETRY_INTERVAL_MS;
+      if (!wasUp) return WIFI_BRINGUP_NONE;  // a rejoin attempt failed
+      losses_++;
+      return WIFI_BRINGUP_LOST;
+    }
+    if (state_ == REJOINING) {
+      if (WiFi.status() == WL_CONNECTED) {
+        state_ = CONNECTED;
+        return WIFI_BRINGUP_RESTORED;
+      }
+      if (now - startMs_ >= WIFI_FAST_CONNECT_TIMEOUT_MS) {
+        WiFi.disconnect();
+        state_ = LOST;
+        retryAtMs_ = now + WIFI_RETRY_INTERVAL_MS;
+      }
+      return WIFI_BRINGUP_NONE;
+    }
+    if (state_ != LOST) return WIFI_BRINGUP_NONE;
+    const int16_t found = WiFi.scanComplete();
+    if (found > 0) {
+      // Back on our channel: associate there directly, no scan of the others
+      WiFi.begin(ssid_, password_, channel_, WiFi.BSSID(0));
+      state_ = REJOINING;
+      startMs_ = now;
+    }
+    if (found >= 0) {
+      WiFi.scanDelete();
+    } else if (found != WIFI_SCAN_RUNNING && (int32_t)(now - retryAtMs_) >= 0) {
+      retryAtMs_ = now + WIFI_RETRY_INTERVAL_MS;
+      WiFi.scanNetworks(true /* async */, false, false, 300, channel_, ssid_);
+    }
+    return WIFI_BRINGUP_NONE;
+  }
+
+  // WiFi event task. Only the flag is shared with poll().
+  void onDisconnected() {
+    if (!channel_) return;
+    esp_wifi_set_channel(channel_, WIFI_SECOND_CHAN_NONE);
+    linkDown_ = true;
+  }
+
+  // Zero-initialised on a cold boot, kept across deep sleep
+  static WifiCache& rtcCache() {
+    static RTC_DATA_ATTR WifiCache cache;
+    return cache;
+  }
+
+  // FNV-1a
+  static uint32_t hashSsid(const char* ssid) {
+    uint32_t h = 2166136261u;
+    for (const char* p = ssid ? ssid : ""; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+    return h;
+  }
+
+  static bool valid(const WifiCache& c, uint32_t ssidHash) {
+    return c.magic == CACHE_MAGIC && c.ssidHash == ssidHash && c.channel >= 1 && c.channel <= 14;
+  }
+
+  bool loadNvs() {
+    if (nvsLoaded_) return true;
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, true)) return false;
+    nvsLoaded_ = prefs.getBytesLength(NVS_KEY) == sizeof(nvs_) &&
+                 prefs.getBytes(NVS_KEY, &nvs_, sizeof(nvs_)) == sizeof(nvs_);
+    prefs.end();
+    return nvsLoaded_;
+  }
+
+  State state_ = IDLE;
+  const char* ssid_ = nullptr;
+  const char* password_ = nullptr;
+  uint32_t startMs_ = 0;
+  uint32_t timeoutMs_ = WIFI_CONNECT_TIMEOUT_MS;
+  uint32_t elapsedMs_ = 0;
+  uint32_t fallbacks_ = 0;
+  uint8_t channel_ = 0;  // held by holdChannel(); 0 = not yet
+  bool handlerAdded_ = false;
+  volatile bool linkDown_ = false;  // set by the disconnect event
+  uint32_t retryAtMs_ = 0;
+  uint32_t losses_ = 0;
+  bool fast_ = false;
+  bool cacheChecked_ = false;
+  const char* source_ = nullptr;  // where cached_ came from, null if invalid
+  WifiCache cached_ = {};
+  bool nvsLoaded_ = false;
+  WifiCache nvs_ = {};  // what NVS holds, to skip redundant writes
+};
@@ -1,11 +1,32 @@
 #include <Arduino.h>
+
+// LED output backend. 0: RMT (FastLED default), one strand after another.
+// 1: I2S peripheral in parallel mode, all five strands clocked out together
+//    from one DMA buffer, so show() costs about one 250-LED strand.
+#ifndef CAPE_I2S_OUTPUT
+#define CAPE_I2S_OUTPUT 0
+#endif
+#if CAPE_I2S_OUTPUT
+#define FASTLED_ESP32_I2S true  // must be defined before FastLED.h
+#endif
+
 #include <esp_now.h>
 #include <WiFi.h>
 #include <FastLED.h>
 #include <ESPmDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
+#include <WifiBringup.h>
+#include <OtaTask.h>
 #include <esp_wifi.h>
+#include <esp_timer.h>
+#include <EffectEngine.h>
+#include <SpellReceiver.h>
+#include <DmxInput.h>
+#include <FramePipeline.h>
+#include <NetSerial.h>
+#include <Trace.h>
+#include <Console.h>
 #include <stdarg.h>
 
 #ifndef DEBUG_NET_SERIAL
@@ -13,50 +34,40 @@
 #endif
 
 #if DEBUG_NET_SERIAL
-WiFiServer debugServer(23);
-WiFiClient debugClient;
+// Log calls only queue the line; a background task writes it to Serial and
+// the telnet client (see NetSerial.h)
+NetSerial netSerial;
 unsigned long nextTouchLogMs = 0;
 
-static void debugBegin() {
-  debugServer.begin();
-  debugServer.setNoDelay(true);
-}
-
-static void debugAcceptClient() {
-  if (!debugClient || !debugClient.connected()) {
-    WiFiClient n = debugServer.available();
-    if (n) {
-      if (debugClient) debugClient.stop();
-      debugClient = n;
-      debugClient.setNoDelay(true);
-      Serial.println("NetSerial: client connected");
-    }
-  }
-}
+static void debugBegin() { netSerial.listen(); }
 
 static void debugPrint(const char* s) {
-  if (debugClient && debugClient.connected()) debugClient.print(s);
+  if (netSerial.clientConnected()) netSerial.print(NetSerial::TO_CLIENT, s);
 }
 
 static void debugPrintln(const char* s) {
-  if (debugClient && debugClient.connected()) {
-    debugClient.print(s);
-    debugClient.print("\r\n");
-  }
+  if (netSerial.clientConnected()) netSerial.print(NetSerial::TO_CLIENT, s, "\r\n");
 }
 
 static void debugPrintf(const char* fmt, ...) {
-  if (!(debugClient && debugClient.connected())) return;
-  char buf[256];
+  if (!netSerial.clientConnected()) return;
   va_list ap;
   va_start(ap, fmt);
-  vsnprintf(buf, sizeof(buf), fmt, ap);
+  netSerial.vprintf(NetSerial::TO_CLIENT, fmt, ap);
   va_end(ap);
-  debugClient.print(buf);
 }
 
-static void logBoth(const char* s) { Serial.print(s); debugPrint(s); }
-static void logBothLn(const char* s) { Serial.println(s); debugPrintln(s); }
+static void logBoth(const char* s) { netSerial.print(NetSerial::TO_BOTH, s); }
+static void logBothLn(const char* s) { netSerial.print(NetSerial::TO_BOTH, s, "\r\n"); }
+static void logBothF(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  netSerial.vprintf(NetSerial::TO_BOTH, fmt, ap);
+  va_end(ap);
+}
+#else
+static void logBoth(const char* s) { Serial.print(s); }
+static void logBothLn(const char* s) { Serial.println(s); }
 static void logBothF(const char* fmt, ...) {
   char buf[256];
   va_list ap;
@@ -64,7 +75,6 @@ static void logBothF(const char* fmt, ...) {
   vsnprintf(buf, sizeof(buf), fmt, ap);
   va_end(ap);
   Serial.print(buf);
-  if (debugClient && debugClient.connected()) debugClient.print(buf);
 }
 #endif
 
@@ -72,6 +82,16 @@ static void logBothF(const char* fmt, ...) {
 bool debugActive = false;
 #endif
 
+// Hot-path events (Trace.h): text lines, or binary records with TRACE_LOG=1
+TraceLog traceLog;
+static void traceOut(const uint8_t* data, size_t len) {
+#if DEBUG_NET_SERIAL
+  netSerial.write(NetSerial::TO_BOTH, data, len);
+#else
+  Serial.write(data, len);
+#endif
+}
+
 // OTA Configuration
 // Set your WiFi credentials for OTA updates
 // When OTA is enabled, the device will connect to WiFi for updates
@@ -137,49 +157,107 @@ Electrical guidance:
 // Dynamic ESP-NOW channel (defaults to 1, updated to AP channel if connected during OTA)
 int espnowChannel = 1;
 
-// Global brightness control (0-255)
-// Adjust this value to change maximum brightness for all effects
-uint8_t globalBrightness = 128;  // Full brightness (adjust as needed)
-const uint8_t BRIGHTNESS_STEP = 16; // Step used by spells 7/8
-
 CRGB leds1[NUM_LEDS];
 CRGB leds2[NUM_LEDS];
 CRGB leds3[NUM_LEDS];
 CRGB leds4[NUM_LEDS];
 CRGB ledsStole[NUM_LEDS_STOLE];
 
-typedef struct {
-  int effect_id;
-} SpellPacket;
-
-SpellPacket incoming;
-volatile int currentEffect = 0;  // updated in ISR/callback
-
-// Deferred-work flags/state to keep onRecv minimal and non-blocking
-volatile bool effectUpdated = false;   // for deferred Serial logging
-volatile bool packetFlash = false;        // transient visual pulse on any received packet
-unsigned long packetFlashUntil = 0;
-// Control request flags (set in onRecv, handled in loop)
-volatile bool tempoDownRequested = false;
-volatile bool tempoUpRequested = false;
-volatile bool brightnessDownRequested = false;
-volatile bool brightnessUpRequested = false;
-
-// Effect state
-int lastEffect = -1;
-int backgroundEffect = 0;  // Current background effect (0=off, 1=rainbow, 2=breathing)
-volatile bool otaInProgress = false;  // Flag to stop effects during OTA
+// Render on one core while the other clocks out the previous frame
+#ifndef FRAME_PIPELINE
+#define FRAME_PIPELINE 1
+#endif
+#if FRAME_PIPELINE
+// Back buffers for the render task
+CRGB backStrips[NUM_STRIPS][NUM_LEDS];
+CRGB backStole[NUM_LEDS_STOLE];
+#endif
+
+// Background effects, tempo and brightness (0-255) live in the shared engine.
+// Strand order must match the FastLED.addLeds() order in setup().
+using CapeLayout = StrandLayout<NUM_LEDS, NUM_LEDS, NUM_LEDS, NUM_LEDS, NUM_LEDS_STOLE>;
+EffectEngine<CapeLayout> engine({leds1, leds2, leds3, leds4, ledsStole});
+#if FRAME_PIPELINE
+FramePipeline<CapeLayout> pipeline(engine, {leds1, leds2, leds3, leds4, ledsStole},
+                                   {backStrips[0], backStrips[1], backStrips[2], backStrips[3], backStole});
+bool pipelineStarted = false;
+
+// Frame rate target; parallel I2S output takes ~7.5 ms per frame, RMT ~5x that
+#ifndef TARGET_FPS
+#if CAPE_I2S_OUTPUT
+#define TARGET_FPS 60
+#else
+#define TARGET_FPS 25
+#endif
+#endif
+
+// Periodic LED output report: frames, time on the wire, time the renderer
+// spent blocked waiting for it, and frames that missed their deadline
+#ifndef OUTPUT_STATS_INTERVAL_MS
+#define OUTPUT_STATS_INTERVAL_MS 10000
+#endif
+unsigned long nextOutputStatsMs = 0;
+
+static void reportOutputStats(AsyncShow& out, FrameScheduler& sched) {
+  unsigned long now = millis();
+  if ((long)(now - nextOutputStatsMs) < 0) return;
+  nextOutputStatsMs = now + OUTPUT_STATS_INTERVAL_MS;
+  AsyncShow::Stats st = out.takeInterval();
+  FrameScheduler::Stats fs = sched.takeInterval();
+  logBothF("LED output: %lu frames in %lu ms, show avg %lu us, blocked %lu us, late %lu/%lu (worst %lu us)\n",
+           (unsigned long)st.shows, (unsigned long)OUTPUT_STATS_INTERVAL_MS,
+           (unsigned long)(st.shows ? st.showUs / st.shows : 0), (unsigned long)st.blockedUs,
+           (unsigned long)fs.late, (unsigned long)fs.frames, (unsigned long)fs.worstLateUs);
+}
+#endif
+
+// ESP-NOW receive path (SpellReceiver.h): spells, clock beacons, state
+// frames and, with STREAM_FRAMES=1, pixel frames streamed by the staff, which
+// replace the effect on STREAM_STRAND_MASK while they keep arriving (stretched
+// to each strand).
+// onRecv only queues; handleDeferredWork drains on the engine owner's task.
+SpellReceiver<CapeLayout, NUM_LEDS_STOLE> spellRx(engine, traceLog, logBothF);
+#ifndef STREAM_STRAND_MASK
+#define STREAM_STRAND_MASK (1u << 4)  // ledsStole
+#endif
+bool streamActive = false;
+
+static uint32_t sharedNowUs() { return spellRx.sharedNowUs(); }
+
+// Settings from the NetSerial console, applied by the engine owner
+enum ConsoleOpCode : uint8_t { CONSOLE_BRIGHTNESS, CONSOLE_TEMPO, CONSOLE_FPS, CONSOLE_SPELL };
+ConsoleQueue consoleOps;
+
+// Pixel input from a lighting desk or PC (DmxInput.h): sACN or Art-Net
+// universes mapped onto all five strands in addLeds() order, each strand
+// starting on a fresh universe (1-2 leds1 ... 9-10 ledsStole by default).
+// Listens over the WiFi connection (OTA_ENABLED builds); while data
+// arrives it overrides effects and streamed frames.
+#ifndef DMX_INPUT
+#define DMX_INPUT 0
+#endif
+#ifndef DMX_FIRST_UNIVERSE
+#define DMX_FIRST_UNIVERSE 1
+#endif
+#ifndef DMX_TIMEOUT_MS
+#define DMX_TIMEOUT_MS 2500  // E1.31 network data loss timeout
+#endif
+#ifndef DMX_STATS_INTERVAL_MS
+#define DMX_STATS_INTERVAL_MS 10000
+#endif
+#if DMX_INPUT
+DmxInput<CapeLayout::kTotalPixels> dmxInput;
+DmxSocket dmxSocket;
+bool dmxActive = false;
+unsigned long nextDmxStatsMs = 0;
+#endif
+
+// Idle ("off") unless OTA_ENABLED
+WifiBringup wifiBringup;  // polled from loop() until it connects or times out
 #if OTA_ENABLED
-const unsigned long OTA_WINDOW_MS = 25000;  // OTA upload window after boot (25s)
-bool otaWindowActive = false;
-unsigned long otaWindowEndMs = 0;
-// Visual indicator state during OTA window
-unsigned long otaVisualNextMs = 0;
-const unsigned long OTA_VISUAL_INTERVAL_MS = 30;
-uint8_t otaVisualHue = 160; // blue-ish indicator
-uint8_t otaVisualPos = 0;
-
-// Built-in LED dim blink during OTA window
+OtaTask otaTask;          // ArduinoOTA for the whole uptime once WiFi is up
+
+// Built-in LED glows dimly while an update is written
 #ifndef BUILTIN_LED_PIN
 #define BUILTIN_LED_PIN 4
 #endif
@@ -193,33 +271,7 @@ uint8_t otaVisualPos = 0;
 #define LEDC_FREQ_HZ 5000
 #endif
 bool builtinLedReady = false;
-uint8_t builtinLedDuty = 0;
-unsigned long builtinLedNextToggleMs = 0;
-const unsigned long BUILTIN_LED_TOGGLE_MS = 300;
-#endif
-
- // Tempo control (applies to all background effects)
-float tempoFactor = 1.0f;        // 1.0 = normal speed
-const float TEMPO_MIN = 0.25f;   // 0.25x (very slow)
-const float TEMPO_MAX = 4.0f;    // 4x (very fast)
-inline unsigned long tempoMs(unsigned long baseMs) {
-  float scaled = baseMs / tempoFactor;
-  if (scaled < 1.0f) scaled = 1.0f;
-  return (unsigned long)scaled;
-}
-
-// Background rainbow effect (effect 1)
-uint8_t rainbowHue = 0;
-unsigned long nextRainbowMs = 0;
-const unsigned long RAINBOW_INTERVAL_MS = 20;  // update rate for smooth animation
-
-// Background breathing effect (effect 2)
-uint8_t breathBrightness = 0;
-int8_t breathStep = 4;                     // brightness step per tick
-unsigned long nextBreathMs = 0;
-const unsigned long BREATH_INTERVAL_MS = 15;  // update rate
-
-
+#endif
 
 #if DEBUG_MODE
 // Debug mode variables for automatic effect cycling
@@ -230,32 +282,16 @@ const int DEBUG_EFFECTS[] = {1, 2, 3, 0};  // Effects to cycle through
 const int DEBUG_EFFECTS_COUNT = sizeof(DEBUG_EFFECTS) / sizeof(DEBUG_EFFECTS[0]);
 #endif
 
-void onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
-  // Keep callback minimal: parse/copy and set flags only
-  if (len >= (int)sizeof(SpellPacket)) {
-    memcpy((void*)&incoming, incomingData, sizeof(incoming));
-    int spell = incoming.effect_id;
-    currentEffect = spell; // keep for logging
-
-    // Map spells:
-    // 1-4: set base background effect (4=Off)
-    // 5: tempo down, 6: tempo up, 7: brightness down, 8: brightness up
-    if (spell == 5) {
-      tempoDownRequested = true;
-    } else if (spell == 6) {
-      tempoUpRequested = true;
-    } else if (spell == 7) {
-      brightnessDownRequested = true;
-    } else if (spell == 8) {
-      brightnessUpRequested = true;
-    }
+void IRAM_ATTR onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  spellRx.onRecv(mac, incomingData, len);
+}
 
-    // Signal loop() to do any heavier work
-    effectUpdated = true;   // deferred Serial logging
-    // Visual pulse to confirm radio reception regardless of effect mapping
-    packetFlash = true;
-    packetFlashUntil = millis() + 120; // ~120ms green blip
-  }
+// Reset-to-first-spell time for fast-reconnect measurements, logged once by
+// the receiver's first-spell hook. rxUs is esp_timer time, which starts at
+// boot (also after deep sleep).
+static void noteFirstSpell(const SpellEvent& ev) {
+  logBothF("Boot: first spell %lu ms after %s (WiFi: %s, ESP-NOW channel %d)\n",
+           (unsigned long)(ev.rxUs / 1000), resetKind(), wifiBringup.describe(), espnowChannel);
 }
 
 static void reinitEspNow() {
@@ -272,13 +308,378 @@ static void reinitEspNow() {
   Serial.printf("ESP-NOW reinitialized on channel %d\n", WiFi.channel());
 }
 
+#if DMX_INPUT
+// Network task: sACN/Art-Net datagrams straight into DmxInput's back frame
+static void dmxTask(void*) {
+  static uint8_t packet[DMX_MAX_PACKET];
+  for (;;) {
+    const int len = dmxSocket.receive(packet, sizeof(packet), 100);
+    if (len > 0) dmxInput.onPacket(packet, (size_t)len, millis());
+  }
+}
+
+static void startDmxInput() {
+  if (WiFi.status() != WL_CONNECTED) {
+    logBothLn("DMX input: no WiFi connection; disabled");
+    return;
+  }
+  if (!dmxInput.begin(CapeLayout::kLength, CapeLayout::kStrands, DMX_FIRST_UNIVERSE) || !dmxSocket.begin()) {
+    logBothLn("DMX input: setup failed; disabled");
+    return;
+  }
+  for (uint8_t i = 0; i < dmxInput.universes(); i++) dmxSocket.joinUniverse(dmxInput.universeStats(i).universe);
+  // Low priority on the WiFi core: a burst of universes never delays rendering
+  if (xTaskCreatePinnedToCore(dmxTask, "dmxIn", 4096, nullptr, 2, nullptr, 0) != pdPASS) {
+    logBothLn("DMX input: task start failed; disabled");
+    return;
+  }
+  logBothF("DMX input: sACN port %u / Art-Net port %u, universes %u-%u\n", SACN_PORT, ARTNET_PORT,
+           (unsigned)DMX_FIRST_UNIVERSE, (unsigned)(DMX_FIRST_UNIVERSE + dmxInput.universes() - 1));
+}
+#endif
+
+#if OTA_ENABLED
+// WiFi associated (polled from loop): stay connected and serve OTA,
+// NetSerial and DMX input from here on
+static void startOta() {
+  Serial.printf("WiFi connected after %lu ms (%s)\n", (unsigned long)wifiBringup.elapsedMs(),
+                wifiBringup.describe());
+  Serial.print("IP address: ");
+  Serial.println(WiFi.localIP());
+  Serial.printf("WiFi channel: %d\n", WiFi.channel());
+  // The radio follows the access point: move the hidden SoftAP and ESP-NOW with it
+  uint8_t chNow = (uint8_t)WiFi.channel();
+  WiFi.softAP("cape-sync", "", chNow, 1 /* hidden */);
+  delay(100);
+  espnowChannel = chNow;
+  reinitEspNow();
+  wifiBringup.save(espnowChannel);  // next boot: no scan
+  wifiBringup.holdChannel((uint8_t)espnowChannel);  // a lost access point must not move ESP-NOW
+  logBothF("ESP-NOW receiver mode on channel %d\n", espnowChannel);
+  
+  // Configure OTA
+  ArduinoOTA.setHostname(OTA_HOSTNAME);
+  ArduinoOTA.setPassword(OTA_PASSWORD);
+  
+  ArduinoOTA.onStart([]() {
+    String type;
+    if (ArduinoOTA.getCommand() == U_FLASH) {
+      type = "sketch";
+    } else {  // U_SPIFFS
+      type = "filesystem";
+    }
+    Serial.println("Start updating " + type);
+    // Effects ran until now; take the LEDs over for the progress bar
+    if (!otaTask.beginUpdate()) Serial.println("OTA: renderer did not park in time");
+#if FRAME_PIPELINE
+    pipeline.pause();
+#endif
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 24);
+  });
+  
+  ArduinoOTA.onEnd([]() {
+    Serial.println("\nEnd");
+    // Brief green success flash
+    fill_solid(leds1, NUM_LEDS, CRGB::Green);
+    fill_solid(leds2, NUM_LEDS, CRGB::Green);
+    fill_solid(leds3, NUM_LEDS, CRGB::Green);
+    fill_solid(leds4, NUM_LEDS, CRGB::Green);
+    fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Green);
+    FastLED.show();
+    delay(200);
+    FastLED.clear();
+    FastLED.show();
+  });
+  
+  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+    if (total == 0) {
+      Serial.printf("Progress: %u/%u\r", progress, total);
+      return;
+    }
+    uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
+    static uint32_t lastPct = 101U;
+    if (pct != lastPct) {
+      lastPct = pct;
+      Serial.printf("Progress: %u%%\r", pct);
+    }
+
+    // Visual OTA progress across all strips (blue bar fill)
+    // Map progress 0..total to 0..(NUM_LEDS * NUM_STRIPS)
+    const uint32_t totalLeds = (uint32_t)NUM_LEDS * (uint32_t)NUM_STRIPS;
+    uint32_t lit = (total > 0) ? ((uint64_t)progress * totalLeds) / total : 0;
+
+    // Clear all LEDs, then fill lit portion in order: strip1 -> strip4
+    FastLED.clear();
+
+    uint8_t hue = 160; // blue-ish
+    CRGB onColor = CHSV(hue, 255, engine.brightness());
+
+    uint32_t remaining = lit;
+
+    // Strip 1
+    uint32_t c1 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c1 > 0) fill_solid(leds1, (int)c1, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
+
+    // Strip 2
+    uint32_t c2 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c2 > 0) fill_solid(leds2, (int)c2, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
+
+    // Strip 3
+    uint32_t c3 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c3 > 0) fill_solid(leds3, (int)c3, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
+
+    // Strip 4
+    uint32_t c4 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c4 > 0) fill_solid(leds4, (int)c4, onColor);
+
+    FastLED.show();
+  });
+  
+  ArduinoOTA.onError([](ota_error_t error) {
+    Serial.printf("Error[%u]: ", error);
+    if (error == OTA_AUTH_ERROR) {
+      Serial.println("Auth Failed");
+    } else if (error == OTA_BEGIN_ERROR) {
+      Serial.println("Begin Failed");
+    } else if (error == OTA_CONNECT_ERROR) {
+      Serial.println("Connect Failed");
+    } else if (error == OTA_RECEIVE_ERROR) {
+      Serial.println("Receive Failed");
+    } else if (error == OTA_END_ERROR) {
+      Serial.println("End Failed");
+    }
+    // Flash red on error
+    fill_solid(leds1, NUM_LEDS, CRGB::Red);
+    fill_solid(leds2, NUM_LEDS, CRGB::Red);
+    fill_solid(leds3, NUM_LEDS, CRGB::Red);
+    fill_solid(leds4, NUM_LEDS, CRGB::Red);
+    fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Red);
+    FastLED.show();
+    delay(1000);
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
+    engine.realign();  // full repaint over the progress bar
+    otaTask.endUpdate();
+#if FRAME_PIPELINE
+    pipeline.resume();
+#endif
+  });
+  
+  ArduinoOTA.begin();
+  Serial.println("OTA Ready");
+  Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
+  if (!otaTask.begin()) Serial.println("OTA task failed to start; OTA disabled");
+#if DEBUG_NET_SERIAL
+  if (!debugActive) {
+    debugBegin();
+    debugActive = true;
+    Serial.println("NetSerial: started on TCP port 23");
+  }
+#endif
+#if DMX_INPUT
+  startDmxInput();
+#endif
+}
+
+// No access point within WIFI_CONNECT_TIMEOUT_MS
+static void onWifiFailed() {
+  Serial.printf("WiFi connection failed after %lu ms. OTA disabled.\n", (unsigned long)wifiBringup.elapsedMs());
+  Serial.println("Continuing with ESP-NOW only (already initialized)...");
+  if (espnowChannel != 1) {
+    // Booted on the cached access point's channel; a staff without WiFi pins channel 1
+    WiFi.disconnect();
+    espnowChannel = 1;
+    WiFi.softAP("cape-sync", "", espnowChannel, 1 /* hidden */);
+    delay(100);
+    reinitEspNow();
+  }
+}
+
+static void pollWifiBringup() {
+  switch (wifiBringup.poll()) {
+    case WIFI_BRINGUP_CONNECTED:
+      startOta();
+      break;
+    case WIFI_BRINGUP_FAILED:
+      onWifiFailed();
+      break;
+    case WIFI_BRINGUP_LOST:
+      logBothF("WiFi: access point lost; ESP-NOW stays on channel %d\n", espnowChannel);
+      break;
+    case WIFI_BRINGUP_RESTORED:
+      logBothF("WiFi: rejoined the access point on channel %d\n", espnowChannel);
+      break;
+    default:
+      break;
+  }
+}
+#endif
+
+#if DEBUG_NET_SERIAL
+// ===================== NetSerial console =====================
+// Console.h: reads answer right away, changes go through consoleOps
+static void consoleReply(const char* s) { debugPrint(s); }
+
+static void postConsoleOp(uint8_t code, int32_t value) {
+  if (!consoleOps.push({code, value})) consoleReply("Busy, try again\r\n");
+}
+
+static void cmdStats(const ConsoleArgs&) {
+  debugPrintf("Uptime %lu s, free heap %lu B\r\n", (unsigned long)(millis() / 1000), (unsigned long)ESP.getFreeHeap());
+  debugPrintf("Effect %d, brightness %u/255, tempo %.2fx\r\n", (int)engine.effect(), engine.brightness(), engine.tempo());
+#if FRAME_PIPELINE
+  const FrameScheduler::Stats fs = pipeline.scheduler().stats();
+  const AsyncShow::Stats st = pipeline.output().stats();
+  debugPrintf("Frames %lu at %u fps target (%lu late), shows %lu (avg %lu us), blocked %lu ms\r\n",
+              (unsigned long)fs.frames, pipeline.scheduler().targetFps(), (unsigned long)fs.late,
+              (unsigned long)st.shows, (unsigned long)(st.shows ? st.showUs / st.shows : 0),
+              (unsigned long)(st.blockedUs / 1000));
+#endif
+  const auto rs = spellRx.stats();
+  debugPrintf("Spells: %lu queue drops, %lu duplicates, %lu rejected, %lu late\r\n", (unsigned long)rs.queueDrops,
+              (unsigned long)rs.duplicates, (unsigned long)rs.rejected, (unsigned long)rs.late);
+  const ClockSync& clock = spellRx.clock();
+  if (clock.synced()) {
+    debugPrintf("Clock sync: locked, offset %lld us, drift %ld ppb\r\n", (long long)clock.offsetUs(esp_timer_get_time()),
+                (long)clock.driftPpb());
+  } else {
+    consoleReply("Clock sync: not locked\r\n");
+  }
+  debugPrintf("WiFi: %s, ESP-NOW channel %d, RSSI %d dBm\r\n", wifiBringup.describe(), espnowChannel,
+              WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0);
+  debugPrintf("Dropped log lines %lu, trace records %lu\r\n", (unsigned long)netSerial.dropped(),
+              (unsigned long)traceLog.dropped());
+}
+
+static void cmdLink(const ConsoleArgs&) {
+  char line[128];
+  const uint32_t now = millis();
+  const LinkHealth& linkHealth = spellRx.link();
+  if (!linkHealth.peers()) consoleReply("No ESP-NOW senders heard yet\r\n");
+  for (uint8_t i = 0; i < linkHealth.peers(); i++) {
+    if (linkHealth.format(line, sizeof(line), i, now) > 0) consoleReply(line);
+  }
+  if (linkHealth.others()) debugPrintf("%lu frames from untracked senders\r\n", (unsigned long)linkHealth.others());
+}
+
+#if FRAME_PROFILE
+static void replyHistogram(const TimingHistogram& h, const char* name) {
+  char line[64];
+  if (h.format(line, sizeof(line), name) > 0) consoleReply(line);
+}
+
+// Timing histograms since boot or the last "prof reset" (FrameProfile.h)
+static void cmdProf(const ConsoleArgs& args) {
+  if (args.argc > 1 && strcmp(args.argv[1], "reset") == 0) {
+#if FRAME_PIPELINE
+    pipeline.frameTimes().reset();
+    pipeline.radioTimes().reset();
+    pipeline.renderTimes().reset();
+    pipeline.output().showTimes().reset();
+#endif
+    engine.kernelTimes().reset();
+#if OTA_ENABLED
+    otaTask.handleTimes().reset();
+#endif
+    consoleReply("Profile: cleared\r\n");
+    return;
+  }
+  consoleReply(kProfileHeader);
+#if FRAME_PIPELINE
+  replyHistogram(pipeline.frameTimes(), "frame");
+  replyHistogram(pipeline.radioTimes(), "radio");
+  replyHistogram(pipeline.renderTimes(), "render");
+  replyHistogram(pipeline.output().showTimes(), "show");
+#endif
+  replyHistogram(engine.kernelTimes(), "kernel");
+#if OTA_ENABLED
+  replyHistogram(otaTask.handleTimes(), "ota");
+#endif
+}
+#endif
+
+static void cmdBrightness(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 0, 255, v)) return consoleReply("Usage: brightness <0-255>\r\n");
+  postConsoleOp(CONSOLE_BRIGHTNESS, v);
+}
+
+static void cmdTempo(const ConsoleArgs& args) {
+  float v;
+  if (!args.toFloat(1, 0.25f, 4.0f, v)) return consoleReply("Usage: tempo <0.25-4.0>\r\n");
+  postConsoleOp(CONSOLE_TEMPO, (int32_t)(v * Q16_ONE));
+}
+
+#if FRAME_PIPELINE
+static void cmdFps(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 1, 120, v)) return consoleReply("Usage: fps <1-120>\r\n");
+  postConsoleOp(CONSOLE_FPS, v);
+}
+#endif
+
+static void cmdSpell(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 0, 255, v)) return consoleReply("Usage: spell <id>\r\n");
+  postConsoleOp(CONSOLE_SPELL, v);
+}
+
+// Pixels as last handed to the output (the front buffer); a frame that
+// lands mid-dump may mix two frames
+static void cmdDump(const ConsoleArgs& args) {
+  long strand, first = 0, count = 16;
+  if (!args.toInt(1, 0, FastLED.count() - 1, strand) || (args.argc > 2 && !args.toInt(2, 0, 65535, first)) ||
+      (args.argc > 3 && !args.toInt(3, 1, 256, count))) {
+    return consoleReply("Usage: dump <strand 0-4> [first] [count <= 256]\r\n");
+  }
+  CLEDController& c = FastLED[strand];
+  const CRGB* px = c.leds();
+  const long end = min((long)c.size(), first + count);
+  char line[NET_SERIAL_LINE];
+  for (long i = first; i < end; i += 16) {
+    int n = snprintf(line, sizeof(line), "%ld/%3ld:", strand, i);
+    for (long j = i; j < end && j < i + 16; j++) {
+      n += snprintf(line + n, sizeof(line) - n, " %02x%02x%02x", px[j].r, px[j].g, px[j].b);
+    }
+    snprintf(line + n, sizeof(line) - n, "\r\n");
+    consoleReply(line);
+  }
+}
+
+static const ConsoleCommand consoleCommands[] = {
+    {"stats", "stats: frames, spells, clock sync, WiFi", cmdStats},
+    {"link", "link: ESP-NOW counters and RSSI per sender", cmdLink},
+#if FRAME_PROFILE
+    {"prof", "prof [reset]: timing histograms", cmdProf},
+#endif
+    {"brightness", "brightness <0-255>", cmdBrightness},
+    {"tempo", "tempo <0.25-4.0>", cmdTempo},
+#if FRAME_PIPELINE  // without it loop() renders unpaced: no target to change
+    {"fps", "fps <1-120>: render task frame rate", cmdFps},
+#endif
+    {"spell", "spell <id>: apply locally, as if received", cmdSpell},
+    {"dump", "dump <strand 0-4> [first] [count]: pixels as RRGGBB", cmdDump},
+};
+
+static void onNetSerialLine(const char* line) { runConsoleLine(consoleCommands, line, consoleReply); }
+#endif
+
 void setup() {
   Serial.begin(115200);
   delay(50);
   Serial.println("WS2812B LED Strip Cape (with NetSerial)");
 #if DEBUG_NET_SERIAL
-  Serial.println("NetSerial: will start after OTA window (post-OTA).");
+  if (!netSerial.begin()) Serial.println("NetSerial: log task failed to start");
+  netSerial.onLine(onNetSerialLine);
+  Serial.println("NetSerial: telnet port opens once WiFi connects.");
 #endif
+  if (!traceLog.begin(traceOut)) Serial.println("Trace: task failed to start");
   // Built-in LED (GPIO4) not used - hat LEDs on GPIO12 instead
   builtinLedReady = false;
 
@@ -290,16 +691,24 @@ void setup() {
   FastLED.addLeds<LED_TYPE, LED_PIN_3, COLOR_ORDER>(leds3, NUM_LEDS);
   FastLED.addLeds<LED_TYPE, LED_PIN_4, COLOR_ORDER>(leds4, NUM_LEDS);
   FastLED.addLeds<LED_TYPE, LED_PIN_STOLE, COLOR_ORDER>(ledsStole, NUM_LEDS_STOLE);
-  FastLED.setBrightness(globalBrightness);  // Use global brightness setting
+  FastLED.setBrightness(engine.brightness());
   FastLED.clear();
+  unsigned long showStartUs = micros();
   FastLED.show();
+  unsigned long showUs = micros() - showStartUs;
   logBothLn("WS2812B LED Strip Cape initialized");
+  logBothF("LED output: %s, full frame show() took %lu us\n",
+           CAPE_I2S_OUTPUT ? "I2S parallel" : "RMT", showUs);
   logBothF("Controlling %d LEDs per strip across %d strips on pins: %d,%d,%d,%d\n", NUM_LEDS, NUM_STRIPS, LED_PIN_1, LED_PIN_2, LED_PIN_3, LED_PIN_4);
   logBothF("Stole strand: %d LEDs on pin %d\n", NUM_LEDS_STOLE, LED_PIN_STOLE);
-  logBothF("Global brightness set to: %d/255\n", globalBrightness);
+  logBothF("Global brightness set to: %d/255\n", engine.brightness());
   // Default to a visible background effect so LEDs show after boot
-  currentEffect = 1;
+  engine.applySpell(1);
 
+#if OTA_ENABLED
+  // Listen where the staff was last time: the cached access point's channel
+  if (uint8_t ch = wifiBringup.cachedEspNowChannel(WIFI_SSID)) espnowChannel = ch;
+#endif
   // WiFi/ESP-NOW: Start with SoftAP FIRST to pin channel (CRITICAL - must be before esp_now_init)
   WiFi.mode(WIFI_AP_STA);
   WiFi.setSleep(false);
@@ -312,152 +721,17 @@ void setup() {
     return;
   }
   esp_now_register_recv_cb(onRecv);
+  spellRx.onFirstSpell(noteFirstSpell);
+#if LINK_RSSI
+  if (!spellRx.link().enableRssi()) Serial.println("Link health: no RSSI (promiscuous RX off)");
+#endif
   Serial.printf("ESP-NOW initialized on channel %d\n", espnowChannel);
 
 #if OTA_ENABLED
-  // Connect to WiFi for OTA updates
-  Serial.println("Connecting to WiFi for OTA...");
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  
-  // Wait for connection with timeout
-  int wifi_retry = 0;
-  while (WiFi.status() != WL_CONNECTED && wifi_retry < 20) {
-    delay(500);
-    Serial.print(".");
-    wifi_retry++;
-  }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected!");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-    Serial.printf("WiFi channel: %d\n", WiFi.channel());
-    
-    // Configure OTA
-    ArduinoOTA.setHostname(OTA_HOSTNAME);
-    ArduinoOTA.setPassword(OTA_PASSWORD);
-    
-    ArduinoOTA.onStart([]() {
-      String type;
-      if (ArduinoOTA.getCommand() == U_FLASH) {
-        type = "sketch";
-      } else {  // U_SPIFFS
-        type = "filesystem";
-      }
-      Serial.println("Start updating " + type);
-      // Stop all effects and turn off LEDs during update
-      otaInProgress = true;
-      backgroundEffect = 0;
-      FastLED.clear();
-      FastLED.show();
-    });
-    
-    ArduinoOTA.onEnd([]() {
-      Serial.println("\nEnd");
-      // Brief green success flash
-      fill_solid(leds1, NUM_LEDS, CRGB::Green);
-      fill_solid(leds2, NUM_LEDS, CRGB::Green);
-      fill_solid(leds3, NUM_LEDS, CRGB::Green);
-      fill_solid(leds4, NUM_LEDS, CRGB::Green);
-      fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Green);
-      FastLED.show();
-      delay(200);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-#if DEBUG_NET_SERIAL
-      if (!debugActive) {
-        debugBegin();
-        debugActive = true;
-        Serial.println("NetSerial: started on TCP port 23 (post-OTA end)");
-      }
-#endif
-    });
-    
-    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-      if (total == 0) {
-        Serial.printf("Progress: %u/%u\r", progress, total);
-        return;
-      }
-      uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
-      static uint32_t lastPct = 101U;
-      if (pct != lastPct) {
-        lastPct = pct;
-        Serial.printf("Progress: %u%%\r", pct);
-      }
-
-      // Visual OTA progress across all strips (blue bar fill)
-      // Map progress 0..total to 0..(NUM_LEDS * NUM_STRIPS)
-      const uint32_t totalLeds = (uint32_t)NUM_LEDS * (uint32_t)NUM_STRIPS;
-      uint32_t lit = (total > 0) ? ((uint64_t)progress * totalLeds) / total : 0;
-
-      // Clear all LEDs, then fill lit portion in order: strip1 -> strip4
-      FastLED.clear();
-
-      uint8_t hue = 160; // blue-ish
-      CRGB onColor = CHSV(hue, 255, globalBrightness);
-
-      uint32_t remaining = lit;
-
-      // Strip 1
-      uint32_t c1 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c1 > 0) fill_solid(leds1, (int)c1, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
-
-      // Strip 2
-      uint32_t c2 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c2 > 0) fill_solid(leds2, (int)c2, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
-
-      // Strip 3
-      uint32_t c3 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c3 > 0) fill_solid(leds3, (int)c3, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
-
-      // Strip 4
-      uint32_t c4 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c4 > 0) fill_solid(leds4, (int)c4, onColor);
-
-      FastLED.show();
-    });
-    
-    ArduinoOTA.onError([](ota_error_t error) {
-      Serial.printf("Error[%u]: ", error);
-      if (error == OTA_AUTH_ERROR) {
-        Serial.println("Auth Failed");
-      } else if (error == OTA_BEGIN_ERROR) {
-        Serial.println("Begin Failed");
-      } else if (error == OTA_CONNECT_ERROR) {
-        Serial.println("Connect Failed");
-      } else if (error == OTA_RECEIVE_ERROR) {
-        Serial.println("Receive Failed");
-      } else if (error == OTA_END_ERROR) {
-        Serial.println("End Failed");
-      }
-      // Flash red on error
-      fill_solid(leds1, NUM_LEDS, CRGB::Red);
-      fill_solid(leds2, NUM_LEDS, CRGB::Red);
-      fill_solid(leds3, NUM_LEDS, CRGB::Red);
-      fill_solid(leds4, NUM_LEDS, CRGB::Red);
-      fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Red);
-      FastLED.show();
-      delay(1000);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-    });
-    
-    ArduinoOTA.begin();
-    Serial.println("OTA Ready");
-    Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
-    // Start limited OTA window
-    otaWindowActive = true;
-    otaWindowEndMs = millis() + OTA_WINDOW_MS;
-    Serial.printf("OTA upload window active for %lu ms\n", OTA_WINDOW_MS);
-  } else {
-    Serial.println("\nWiFi connection failed. OTA disabled.");
-    Serial.println("Continuing with ESP-NOW only (already initialized)...");
-  }
+  // Connect to WiFi for OTA updates without waiting: ESP-NOW is already up,
+  // and loop() picks up the result (pollWifiBringup)
+  Serial.println("Connecting to WiFi for OTA in the background...");
+  wifiBringup.begin(WIFI_SSID, WIFI_PASSWORD);
 #else
   Serial.println("OTA disabled in build config");
 #endif
@@ -466,307 +740,152 @@ void setup() {
   Serial.println("DEBUG MODE: Automatic effect cycling enabled");
   Serial.println("Effects will cycle every 1 second: Rainbow -> Breathing -> Off");
   nextDebugEffectMs = millis() + DEBUG_EFFECT_DURATION_MS;
-  currentEffect = DEBUG_EFFECTS[0];  // Start with first effect
-  backgroundEffect = currentEffect;  // Set initial background effect
+  engine.applySpell(DEBUG_EFFECTS[0]);  // Set initial background effect
 #endif
 }
 
-void loop() {
-#if DEBUG_NET_SERIAL
-  if (debugActive) debugAcceptClient();
-#endif
-#if OTA_ENABLED
-  // During the initial OTA window, handle OTA and show a special LED indicator.
-  if (otaWindowActive) {
-    ArduinoOTA.handle();
-
-    if (!otaInProgress) {
-      unsigned long now = millis();
-      if ((long)(now - otaVisualNextMs) >= 0) {
-        otaVisualNextMs = now + OTA_VISUAL_INTERVAL_MS;
-        // Render a colorful comet animation across all strips to indicate "upload mode"
-        FastLED.clear();
-
-        uint8_t hue0 = otaVisualHue;
-        uint8_t hue1 = otaVisualHue + 42;
-        uint8_t hue2 = otaVisualHue + 84;
-        uint8_t hue3 = otaVisualHue + 126;
-
-        int head = otaVisualPos % NUM_LEDS;
-
-        // Strip 1
-        leds1[head] = CHSV(hue0, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t1 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds1[t1] = CHSV(hue0, 220, globalBrightness / 4);
-        }
-
-        // Strip 2
-        leds2[head] = CHSV(hue1, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t2 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds2[t2] = CHSV(hue1, 220, globalBrightness / 4);
-        }
-
-        // Strip 3
-        leds3[head] = CHSV(hue2, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t3 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds3[t3] = CHSV(hue2, 220, globalBrightness / 4);
-        }
-
-        // Strip 4
-        leds4[head] = CHSV(hue3, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t4 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds4[t4] = CHSV(hue3, 220, globalBrightness / 4);
-        }
-
-        otaVisualPos = (otaVisualPos + 1) % NUM_LEDS;
-        otaVisualHue++; // slowly cycle hues for a prettier effect
-        FastLED.show();
-
-        // Dim pulsing built-in LED during OTA window (very low peak)
-        if (builtinLedReady) {
-          static uint8_t phase = 0; // 0..255
-          phase += 4; // pulse speed
-          uint8_t tri = (phase < 128) ? phase : (255 - phase); // 0..127 triangle wave
-          const uint8_t MAX_DUTY = 8; // very dim peak
-          uint8_t duty = (uint16_t)tri * MAX_DUTY / 127;
-          ledcWrite(LEDC_CHANNEL_BUILTIN, duty);
-        }
-      }
-    }
-
-    // Close OTA window after timeout (unless an OTA is currently active)
-    if ((long)(millis() - otaWindowEndMs) >= 0 && !otaInProgress) {
-      otaWindowActive = false;
-      // Prepare ESP-NOW mode. If STA is connected, keep it and adopt its channel.
-      if (WiFi.status() == WL_CONNECTED) {
-        WiFi.mode(WIFI_AP_STA);
-        uint8_t chNow = (uint8_t)WiFi.channel();
-        WiFi.softAP("cape-sync", "", chNow, 1 /* hidden */);
-        delay(100);
-        espnowChannel = chNow;
-      } else {
-        WiFi.disconnect(true, true);
-        WiFi.mode(WIFI_AP_STA);
-        WiFi.softAP("cape-sync", "", espnowChannel, 1 /* hidden */);
-        delay(100);
-      }
-      reinitEspNow();
-      FastLED.clear();
-      FastLED.show();
-      // Turn off built-in LED after OTA window closes
-      if (builtinLedReady) {
-        ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
-      }
-      logBothF("OTA window closed; switching to ESP-NOW receiver mode on channel %d\n", espnowChannel);
-      logBothF("Current channel after switch: %d\n", WiFi.channel());
-#if DEBUG_NET_SERIAL
-      if (!debugActive) {
-        debugBegin();
-        debugActive = true;
-        Serial.println("NetSerial: started on TCP port 23 (post-OTA)");
-      }
-#endif
-    }
-
-    // While in OTA window, skip normal effect rendering
-    if (otaWindowActive) {
-      return;
-    }
-  }
-#endif
-
-  // Deferred logging to avoid Serial in callback
-  if (effectUpdated) {
-    effectUpdated = false;
-    int effect = currentEffect; // read once
-    logBothF("Received effect %d\n", effect);
-  }
-
-  // Handle control requests from spells 5-8
-  if (tempoDownRequested) {
-    tempoDownRequested = false;
-    tempoFactor *= 0.85f; // slow down ~15%
-    if (tempoFactor < TEMPO_MIN) tempoFactor = TEMPO_MIN;
-    logBothF("Tempo decreased. tempoFactor=%.2f\n", tempoFactor);
-  }
-  if (tempoUpRequested) {
-    tempoUpRequested = false;
-    tempoFactor *= 1.15f; // speed up ~15%
-    if (tempoFactor > TEMPO_MAX) tempoFactor = TEMPO_MAX;
-    logBothF("Tempo increased. tempoFactor=%.2f\n", tempoFactor);
-  }
-  if (brightnessDownRequested) {
-    brightnessDownRequested = false;
-    uint16_t b = globalBrightness;
-    if (b > BRIGHTNESS_STEP) b -= BRIGHTNESS_STEP; else b = 1;
-    globalBrightness = (uint8_t)b;
-    FastLED.setBrightness(globalBrightness);
-    logBothF("Brightness decreased to %u/255\n", globalBrightness);
-  }
-  if (brightnessUpRequested) {
-    brightnessUpRequested = false;
-    uint16_t b = globalBrightness;
-    b = (b + BRIGHTNESS_STEP > 255) ? 255 : (b + BRIGHTNESS_STEP);
-    globalBrightness = (uint8_t)b;
-    FastLED.setBrightness(globalBrightness);
-    logBothF("Brightness increased to %u/255\n", globalBrightness);
-  }
-
-  // Detect effect change and reset state as needed
-  if (lastEffect != currentEffect) {
-    lastEffect = currentEffect;
-
-    // Reset per-effect state for background effects only
-    switch (currentEffect) {
-      case 0: // Off - clear background effect
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      case 1: // Background rainbow
-        backgroundEffect = 1;
-        rainbowHue = 0;
-        nextRainbowMs = millis();
+// Console changes, on the task that owns the engine, before the next tick
+static void applyConsoleOps() {
+  ConsoleOp op;
+  while (consoleOps.pop(op)) {
+    switch (op.code) {
+      case CONSOLE_BRIGHTNESS:
+        engine.setBrightness((uint8_t)op.value);
+        logBothF("Console: brightness %u/255\n", engine.brightness());
         break;
-      case 2: // Background breathing
-        backgroundEffect = 2;
-        breathBrightness = globalBrightness / 10;
-        breathStep = abs(breathStep);
-        nextBreathMs = millis();
+      case CONSOLE_TEMPO:
+        engine.setTempoQ16((uint32_t)op.value);
+        logBothF("Console: tempo %.2fx\n", engine.tempo());
         break;
-      case 3:
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
+#if FRAME_PIPELINE
+      case CONSOLE_FPS:
+        pipeline.scheduler().setTargetFps((uint16_t)op.value);
+        logBothF("Console: %u fps\n", pipeline.scheduler().targetFps());
         break;
-      case 4: // Off (spell 4)
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
+#endif
+      case CONSOLE_SPELL: {
+        SpellEvent ev = {};  // a bare v1 spell, no parameters
+        ev.spell = op.value;
+        ev.rxUs = micros();
+        ev.version = 1;
+        spellRx.apply(ev, sharedNowUs());
         break;
+      }
       default:
-        // Ignore non-background spells (5-8) here
         break;
     }
   }
+}
 
-  unsigned long now = millis();
+#if DMX_INPUT
+// Copy the latest complete DMX frame over every strand while data arrives.
+// Every frame, since the pipeline's back buffers may be a swap behind.
+static void updateDmxInput() {
+  const bool active = dmxInput.active(millis(), DMX_TIMEOUT_MS);
+  if (active != dmxActive) {
+    dmxActive = active;
+    logBothF("DMX input: %s\n", active ? "receiving, effects paused" : "timed out, back to effects");
+  }
+  if (!active) return;
+  bool fresh;
+  const uint8_t* frame = dmxInput.frame(&fresh);
+  for (uint8_t s = 0; s < CapeLayout::kStrands; s++) {
+    memcpy(engine.strand(s), frame, CapeLayout::kLength[s] * sizeof(CRGB));
+    frame += CapeLayout::kLength[s] * sizeof(CRGB);
+  }
+  if (fresh) engine.markDirty();
+}
 
-  // Skip all effects if OTA is in progress
-  if (otaInProgress) {
-    return;
+// Frame rate, sync state and per-universe sequence gaps
+static void reportDmxStats() {
+  unsigned long now = millis();
+  if ((long)(now - nextDmxStatsMs) < 0) return;
+  nextDmxStatsMs = now + DMX_STATS_INTERVAL_MS;
+  static uint32_t lastFrames = 0;
+  const auto st = dmxInput.stats();
+  if (st.frames == lastFrames) return;
+  logBothF("DMX input: %lu frames in %lu ms, %s, %lu unmapped, %lu ignored\n",
+           (unsigned long)(st.frames - lastFrames), (unsigned long)DMX_STATS_INTERVAL_MS,
+           dmxInput.synced() ? "synced" : "unsynced", (unsigned long)st.unmapped, (unsigned long)st.ignored);
+  lastFrames = st.frames;
+  for (uint8_t i = 0; i < dmxInput.universes(); i++) {
+    const auto u = dmxInput.universeStats(i);
+    if (u.gaps || u.outOfOrder) {
+      logBothF("  universe %u: %lu packets, %lu lost, %lu out of order so far\n", u.universe,
+               (unsigned long)u.packets, (unsigned long)u.gaps, (unsigned long)u.outOfOrder);
+    }
   }
+}
+#endif
+
+// Deferred spell handling (onRecv only queues spells). Runs on whichever task
+// owns the engine: loop() before the frame pipeline starts, the render task after.
+static void handleDeferredWork() {
+  applyConsoleOps();
+  spellRx.drain();
+  // In the pipeline the back buffers may be a swap behind: copy every frame
+  streamActive = spellRx.updateStream(STREAM_STRAND_MASK, true);
+#if DMX_INPUT
+  updateDmxInput();  // after the stream: DMX wins where both write
+  engine.setExternal((dmxActive ? engine.kAllStrands : 0) | (streamActive ? STREAM_STRAND_MASK : 0));
+#else
+  engine.setExternal(streamActive ? STREAM_STRAND_MASK : 0);
+#endif
 
 #if DEBUG_MODE
   // Debug mode: automatically cycle background effects
+  unsigned long now = millis();
   if ((long)(now - nextDebugEffectMs) >= 0) {
     debugEffectIndex = (debugEffectIndex + 1) % DEBUG_EFFECTS_COUNT;
-    currentEffect = DEBUG_EFFECTS[debugEffectIndex];
+    const int effect = DEBUG_EFFECTS[debugEffectIndex];
+    engine.applySpell(effect);
     nextDebugEffectMs = now + DEBUG_EFFECT_DURATION_MS;
     
     const char* effectNames[] = {"Off", "Rainbow", "Breathing"};
-    Serial.printf("DEBUG: Switching to background effect %d (%s)\n", currentEffect, 
-                  currentEffect < 3 ? effectNames[currentEffect] : "Unknown");
+    logBothF("DEBUG: Switching to background effect %d (%s)\n", effect, effect < 3 ? effectNames[effect] : "Unknown");
   }
 #endif
+}
 
-  // First, render background effect (if any)
-  switch (backgroundEffect) {
-    case 0: {
-      // Off - no background effect
-    } break;
-
-    case 1: {
-      // Background Rainbow: continuous rainbow cycling
-      if ((long)(now - nextRainbowMs) >= 0) {
-        nextRainbowMs = now + tempoMs(RAINBOW_INTERVAL_MS);
-
-        // Create rainbow effect across all LEDs
-        for (int i = 0; i < NUM_LEDS; i++) {
-          uint8_t ledHue = rainbowHue + (i * 256 / NUM_LEDS);
-          leds1[i] = CHSV(ledHue, 255, globalBrightness);
-          leds2[i] = CHSV(ledHue, 255, globalBrightness);
-          leds3[i] = CHSV(ledHue, 255, globalBrightness);
-          leds4[i] = CHSV(ledHue, 255, globalBrightness);
-        }
-        // Stole strand (scaled to its length)
-        for (int j = 0; j < NUM_LEDS_STOLE; j++) {
-          uint8_t ledHue2 = rainbowHue + (j * 256 / NUM_LEDS_STOLE);
-          ledsStole[j] = CHSV(ledHue2, 255, globalBrightness);
-        }
-
-        rainbowHue += 1;  // wraps at 256
-      }
-    } break;
-
-    case 2: {
-      // Background Breathing: continuous breathing effect
-      if ((long)(now - nextBreathMs) >= 0) {
-        nextBreathMs = now + tempoMs(BREATH_INTERVAL_MS);
-
-        uint8_t maxBreath = globalBrightness;
-        uint8_t minBreath = globalBrightness / 10;
-
-        // Update brightness with bounds
-        int16_t b = (int16_t)breathBrightness + breathStep;
-        if (b >= maxBreath) {
-          b = maxBreath;
-          breathStep = -breathStep; // start decreasing
-        } else if (b <= minBreath) {
-          b = minBreath;
-          breathStep = -breathStep; // start increasing
-        }
-        breathBrightness = (uint8_t)b;
-
-        // Apply rainbow with breathing brightness
-        for (int i = 0; i < NUM_LEDS; i++) {
-          uint8_t ledHue = rainbowHue + (i * 256 / NUM_LEDS);
-          leds1[i] = CHSV(ledHue, 255, breathBrightness);
-          leds2[i] = CHSV(ledHue, 255, breathBrightness);
-          leds3[i] = CHSV(ledHue, 255, breathBrightness);
-          leds4[i] = CHSV(ledHue, 255, breathBrightness);
-        }
-        // Stole strand (scaled to its length)
-        for (int j = 0; j < NUM_LEDS_STOLE; j++) {
-          uint8_t ledHue2 = rainbowHue + (j * 256 / NUM_LEDS_STOLE);
-          ledsStole[j] = CHSV(ledHue2, 255, breathBrightness);
-        }
-
-        // Step hue slowly for variation
-        rainbowHue += 1;
-      }
-    } break;
-
-
-    default: {
-      // Unknown background effect, turn off
-      backgroundEffect = 0;
-    } break;
+void loop() {
+#if OTA_ENABLED
+  pollWifiBringup();
+  // An update in flight owns the LEDs (OtaTask.h). With the pipeline
+  // running this task does not render, and onStart pauses the pipeline.
+  if (otaTask.updating()) {
+    otaTask.park();
+    delay(10);
+    return;
   }
+#endif
 
-  // No one-shot effects; ensure LEDs update when only background is active
-  if (currentEffect >= 0 && currentEffect <= 4) {
-    FastLED.show();
-  }
+#if DMX_INPUT
+  reportDmxStats();
+#endif
 
-  // Brief green flash on LED 0 to acknowledge any received packet
-  if (!otaWindowActive && !otaInProgress && packetFlash) {
-    if ((long)(millis() - packetFlashUntil) < 0) {
-      // Overlay a bright green pixel on ALL strips to make it very visible
-      leds1[0] = CRGB::Green;
-      leds2[0] = CRGB::Green;
-      leds3[0] = CRGB::Green;
-      leds4[0] = CRGB::Green;
-      ledsStole[0] = CRGB::Green;
-      FastLED.show();
+#if FRAME_PIPELINE
+  // Render and output move to their own tasks
+  if (!pipelineStarted) {
+    pipelineStarted = true;
+    pipeline.setClock(sharedNowUs);
+    if (pipeline.begin(handleDeferredWork, TARGET_FPS)) {
+      logBothLn("Frame pipeline: render on core 1, output on core 0");
     } else {
-      packetFlash = false;
+      logBothLn("Frame pipeline: task start failed; rendering on loop task");
     }
   }
+  if (pipeline.running()) {
+    reportOutputStats(pipeline.output(), pipeline.scheduler());
+    delay(10);
+    return;
+  }
+#endif
+
+  handleDeferredWork();
+
+  // Render background effect (if any) and the packet-receipt flash overlay
+  engine.tick(sharedNowUs());
+  engine.show();  // no-op unless a strand changed
 
   // Other non-blocking work can go here
 }
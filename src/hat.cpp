@@ -5,7 +5,14 @@
 #include <ESPmDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
+#include <WifiBringup.h>
+#include <OtaTask.h>
 #include <esp_wifi.h>
+#include <esp_timer.h>
+#include <EffectEngine.h>
+#include <SpellReceiver.h>
+#include <FramePipeline.h>
+#include <Trace.h>
 
 // OTA Configuration
 #define OTA_ENABLED 1
@@ -24,10 +31,14 @@
 #endif
 
 // Debug Configuration
-// Set to 1 to enable strand length cycling (helps identify physical strand mapping)
-// Set to 0 for normal operation
+// DEBUG_STRAND_CYCLING=1 lights growing lengths of each strand instead of
+// effects (helps identify physical strand mapping). It drives A and B
+// separately from loop(), so it also turns off the aliased mirror and the
+// frame pipeline. 0 for normal operation.
 #define DEBUG_MODE 0
-#define DEBUG_STRAND_CYCLING 1  // Enable strand length cycling to identify physical mapping
+#ifndef DEBUG_STRAND_CYCLING
+#define DEBUG_STRAND_CYCLING 0
+#endif
 
 /* ESP32-CAM (AI Thinker) pin notes (summary):
 - GPIO13/14/15 are SD interface pins; can be repurposed for WS2812 if SD not used.
@@ -59,38 +70,106 @@ Electrical guidance:
 // Dynamic ESP-NOW channel (default 1, pinned as needed)
 int espnowChannel = 1;
 
-// Brightness control
-uint8_t globalBrightness = 128;
-const uint8_t BRIGHTNESS_STEP = 16;
+// Strand B mirrors strand A. With no transform both controllers read ledsA,
+// halving render time and buffer memory. Setting any HAT_MIRROR_* transform
+// gives B its own buffer filled with a reversed/rotated/hue-shifted copy.
+#ifndef HAT_MIRROR_REVERSE
+#define HAT_MIRROR_REVERSE 0
+#endif
+#ifndef HAT_MIRROR_OFFSET
+#define HAT_MIRROR_OFFSET 0     // pixels
+#endif
+#ifndef HAT_MIRROR_HUE_SHIFT
+#define HAT_MIRROR_HUE_SHIFT 0  // 0-255
+#endif
+#if DEBUG_STRAND_CYCLING
+#define HAT_MIRROR_ALIASED 0    // strand cycling drives A and B independently
+#else
+#define HAT_MIRROR_ALIASED (!HAT_MIRROR_REVERSE && HAT_MIRROR_OFFSET == 0 && HAT_MIRROR_HUE_SHIFT == 0)
+#endif
+
+// Render on one core while the other clocks out the previous frame
+// (strand cycling writes the buffers from loop(), so it stays single-task)
+#ifndef FRAME_PIPELINE
+#define FRAME_PIPELINE (!DEBUG_STRAND_CYCLING)
+#endif
 
 CRGB ledsA[NUM_LEDS_STOLE];
+#if HAT_MIRROR_ALIASED
+CRGB* const ledsB = ledsA;  // one render buffer for both controllers
+#else
 CRGB ledsB[NUM_LEDS_STOLE];
+#endif
+#if FRAME_PIPELINE
+// Back buffers for the render task
+CRGB ledsA2[NUM_LEDS_STOLE];
+#if HAT_MIRROR_ALIASED
+CRGB* const ledsB2 = ledsA2;
+#else
+CRGB ledsB2[NUM_LEDS_STOLE];
+#endif
+#endif
+
+// Background effects (rainbow/breathing, tempo, brightness) live in the shared engine
+struct HatLayout : StrandLayout<NUM_LEDS_STOLE, NUM_LEDS_STOLE> {
+  static constexpr StrandMirror kMirror[kStrands] = {
+    kNoMirror,
+#if DEBUG_STRAND_CYCLING
+    kNoMirror,
+#else
+    {0, HAT_MIRROR_REVERSE != 0, HAT_MIRROR_OFFSET, HAT_MIRROR_HUE_SHIFT},
+#endif
+  };
+};
+EffectEngine<HatLayout> engine({ledsA, ledsB});
+#if FRAME_PIPELINE
+FramePipeline<HatLayout> pipeline(engine, {ledsA, ledsB}, {ledsA2, ledsB2});
+bool pipelineStarted = false;
+
+// Frame rate target; one 750-LED strand takes ~22.5 ms on the wire
+#ifndef TARGET_FPS
+#define TARGET_FPS 40
+#endif
+
+// Periodic LED output report: frames, time on the wire, time the renderer
+// spent blocked waiting for it, and frames that missed their deadline
+#ifndef OUTPUT_STATS_INTERVAL_MS
+#define OUTPUT_STATS_INTERVAL_MS 10000
+#endif
+unsigned long nextOutputStatsMs = 0;
+
+static void reportOutputStats(AsyncShow& out, FrameScheduler& sched) {
+  unsigned long now = millis();
+  if ((long)(now - nextOutputStatsMs) < 0) return;
+  nextOutputStatsMs = now + OUTPUT_STATS_INTERVAL_MS;
+  AsyncShow::Stats st = out.takeInterval();
+  FrameScheduler::Stats fs = sched.takeInterval();
+  Serial.printf("LED output: %lu frames in %lu ms, show avg %lu us, blocked %lu us, late %lu/%lu (worst %lu us)\n",
+                (unsigned long)st.shows, (unsigned long)OUTPUT_STATS_INTERVAL_MS,
+                (unsigned long)(st.shows ? st.showUs / st.shows : 0), (unsigned long)st.blockedUs,
+                (unsigned long)fs.late, (unsigned long)fs.frames, (unsigned long)fs.worstLateUs);
+}
+#endif
 
-typedef struct {
-  int effect_id;
-} SpellPacket;
+// Hot-path events (Trace.h): text lines, or binary records with TRACE_LOG=1
+TraceLog traceLog;
+static void traceOut(const uint8_t* data, size_t len) { Serial.write(data, len); }
 
-SpellPacket incoming;
-volatile int currentEffect = 0;  // updated by callback
-volatile bool effectUpdated = false;
-volatile bool packetFlash = false;
-unsigned long packetFlashUntil = 0;
+// ESP-NOW receive path (SpellReceiver.h): spells, clock beacons, state
+// frames and, with STREAM_FRAMES=1, pixel frames streamed by the staff, which
+// replace the effect on both strands while they keep arriving (shorter frames
+// are stretched to fit).
+// onRecv only queues; handleDeferredWork drains on the engine owner's task.
+SpellReceiver<HatLayout, NUM_LEDS_STOLE> spellRx(engine, traceLog, serialLogF);
 
-// Effect state
-int lastEffect = -1;
-int backgroundEffect = 0;   // 0=off, 1=rainbow, 2=breathing
-volatile bool otaInProgress = false;
+static uint32_t sharedNowUs() { return spellRx.sharedNowUs(); }
 
+// Idle ("off") unless OTA_ENABLED
+WifiBringup wifiBringup;  // polled from loop() until it connects or times out
 #if OTA_ENABLED
-const unsigned long OTA_WINDOW_MS = 25000;
-bool otaWindowActive = false;
-unsigned long otaWindowEndMs = 0;
-unsigned long otaVisualNextMs = 0;
-const unsigned long OTA_VISUAL_INTERVAL_MS = 30;
-uint8_t otaVisualHue = 160;
-uint8_t otaVisualPos = 0;
-
-// Built-in LED dim blink during OTA window
+OtaTask otaTask;          // ArduinoOTA for the whole uptime once WiFi is up
+
+// Built-in LED glows dimly while an update is written
 #ifndef BUILTIN_LED_PIN
 #define BUILTIN_LED_PIN 4
 #endif
@@ -104,31 +183,7 @@ uint8_t otaVisualPos = 0;
 #define LEDC_FREQ_HZ 5000
 #endif
 bool builtinLedReady = false;
-unsigned long builtinLedNextToggleMs = 0;
-const unsigned long BUILTIN_LED_TOGGLE_MS = 300;
-#endif
-
-// Tempo control for effects
-float tempoFactor = 1.0f;
-const float TEMPO_MIN = 0.25f;
-const float TEMPO_MAX = 4.0f;
-inline unsigned long tempoMs(unsigned long baseMs) {
-  float scaled = baseMs / tempoFactor;
-  if (scaled < 1.0f) scaled = 1.0f;
-  return (unsigned long)scaled;
-}
-
-// Rainbow
-uint8_t rainbowHue = 0;
-unsigned long nextRainbowMs = 0;
-const unsigned long RAINBOW_INTERVAL_MS = 20;
-
-// Breathing
-uint8_t breathBrightness = 0;
-int8_t breathStep = 4;
-unsigned long nextBreathMs = 0;
-const unsigned long BREATH_INTERVAL_MS = 15;
-
+#endif
 
 #if DEBUG_MODE
 int debugEffectIndex = 0;
@@ -148,36 +203,16 @@ const int STRAND_LENGTHS_COUNT = sizeof(STRAND_LENGTHS) / sizeof(STRAND_LENGTHS[
 int currentTestLength = STRAND_LENGTHS[0];
 #endif
 
-void onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
-  if (len >= (int)sizeof(SpellPacket)) {
-    memcpy((void*)&incoming, incomingData, sizeof(incoming));
-    int spell = incoming.effect_id;
-    currentEffect = spell;
-
-    // Spells mapping:
-    // 1-4: set background; 5-8: tempo/brightness controls
-    if (spell == 5) {
-      tempoFactor *= 0.85f;
-      if (tempoFactor < TEMPO_MIN) tempoFactor = TEMPO_MIN;
-    } else if (spell == 6) {
-      tempoFactor *= 1.15f;
-      if (tempoFactor > TEMPO_MAX) tempoFactor = TEMPO_MAX;
-    } else if (spell == 7) {
-      uint16_t b = globalBrightness;
-      if (b > BRIGHTNESS_STEP) b -= BRIGHTNESS_STEP; else b = 1;
-      globalBrightness = (uint8_t)b;
-      FastLED.setBrightness(globalBrightness);
-    } else if (spell == 8) {
-      uint16_t b = globalBrightness;
-      b = (b + BRIGHTNESS_STEP > 255) ? 255 : (b + BRIGHTNESS_STEP);
-      globalBrightness = (uint8_t)b;
-      FastLED.setBrightness(globalBrightness);
-    }
+void IRAM_ATTR onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  spellRx.onRecv(mac, incomingData, len);
+}
 
-    effectUpdated = true;
-    packetFlash = true;
-    packetFlashUntil = millis() + 120;
-  }
+// Reset-to-first-spell time for fast-reconnect measurements, logged once by
+// the receiver's first-spell hook. rxUs is esp_timer time, which starts at
+// boot (also after deep sleep).
+static void noteFirstSpell(const SpellEvent& ev) {
+  Serial.printf("Boot: first spell %lu ms after %s (WiFi: %s, ESP-NOW channel %d)\n",
+                (unsigned long)(ev.rxUs / 1000), resetKind(), wifiBringup.describe(), espnowChannel);
 }
 
 static void reinitEspNow() {
@@ -191,8 +226,131 @@ static void reinitEspNow() {
   Serial.printf("ESP-NOW reinitialized on channel %d\n", WiFi.channel());
 }
 
+#if OTA_ENABLED
+// WiFi associated (polled from loop): stay connected and serve OTA from
+// here on. ESP-NOW moves to the access point's channel with the radio.
+static void startOta() {
+  Serial.printf("WiFi connected after %lu ms (%s)\n", (unsigned long)wifiBringup.elapsedMs(),
+                wifiBringup.describe());
+  Serial.print("IP: ");
+  Serial.println(WiFi.localIP());
+  Serial.printf("WiFi channel: %d\n", WiFi.channel());
+  espnowChannel = WiFi.channel();
+  reinitEspNow();
+  wifiBringup.save(espnowChannel);  // next boot: no scan
+  wifiBringup.holdChannel((uint8_t)espnowChannel);  // a lost access point must not move ESP-NOW
+
+  ArduinoOTA.setHostname(OTA_HOSTNAME);
+  ArduinoOTA.setPassword(OTA_PASSWORD);
+
+  // Effects run until a transfer actually starts; then take the LEDs over
+  ArduinoOTA.onStart([]() {
+    if (!otaTask.beginUpdate()) Serial.println("OTA: renderer did not park in time");
+#if FRAME_PIPELINE
+    pipeline.pause();
+#endif
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 24);
+  });
+
+  ArduinoOTA.onEnd([]() {
+    fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Green);
+    fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Green);
+    FastLED.show();
+    delay(200);
+    FastLED.clear();
+    FastLED.show();
+  });
+
+  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+    if (total == 0) return;
+    uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
+    static uint32_t lastPct = 101U;
+    if (pct != lastPct) {
+      lastPct = pct;
+      Serial.printf("Progress: %u%%\r", pct);
+    }
+
+#if HAT_MIRROR_ALIASED
+    const uint32_t totalLeds = (uint32_t)NUM_LEDS_STOLE;  // B shows A's buffer
+#else
+    const uint32_t totalLeds = (uint32_t)NUM_LEDS_STOLE * 2U;
+#endif
+    uint32_t lit = (total > 0) ? ((uint64_t)progress * totalLeds) / total : 0;
+
+    FastLED.clear();
+    CRGB onColor = CHSV(160, 255, engine.brightness());
+
+    uint32_t remaining = lit;
+
+    uint32_t cA = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
+    if (cA > 0) fill_solid(ledsA, (int)cA, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS_STOLE) ? (remaining - (uint32_t)NUM_LEDS_STOLE) : 0;
+
+    uint32_t cB = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
+    if (cB > 0) fill_solid(ledsB, (int)cB, onColor);
+
+    FastLED.show();
+  });
+
+  ArduinoOTA.onError([](ota_error_t error) {
+    Serial.printf("OTA Error[%u]\n", error);
+    fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Red);
+    fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Red);
+    FastLED.show();
+    delay(1000);
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
+    engine.realign();  // full repaint over the progress bar
+    otaTask.endUpdate();
+#if FRAME_PIPELINE
+    pipeline.resume();
+#endif
+  });
+
+  ArduinoOTA.begin();
+  Serial.println("OTA Ready");
+  Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
+  if (!otaTask.begin()) Serial.println("OTA task failed to start; OTA disabled");
+}
+
+// No access point within WIFI_CONNECT_TIMEOUT_MS
+static void onWifiFailed() {
+  Serial.printf("WiFi failed after %lu ms; OTA disabled. Using ESP-NOW only...\n",
+                (unsigned long)wifiBringup.elapsedMs());
+  WiFi.disconnect(true, true);
+  WiFi.mode(WIFI_STA);
+  delay(100);
+  espnowChannel = 1;  // a staff without WiFi pins channel 1 too
+  reinitEspNow();  // the radio was restarted under it
+  Serial.printf("ESP-NOW only mode on channel %d (STA)\n", espnowChannel);
+}
+
+static void pollWifiBringup() {
+  switch (wifiBringup.poll()) {
+    case WIFI_BRINGUP_CONNECTED:
+      startOta();
+      break;
+    case WIFI_BRINGUP_FAILED:
+      onWifiFailed();
+      break;
+    case WIFI_BRINGUP_LOST:
+      Serial.printf("WiFi: access point lost; ESP-NOW stays on channel %d\n", espnowChannel);
+      break;
+    case WIFI_BRINGUP_RESTORED:
+      Serial.printf("WiFi: rejoined the access point on channel %d\n", espnowChannel);
+      break;
+    default:
+      break;
+  }
+}
+#endif
+
 void setup() {
   Serial.begin(115200);
+  if (!traceLog.begin(traceOut)) Serial.println("Trace: task failed to start");
   // Setup built-in LED PWM for status
 #if OTA_ENABLED
   ledcSetup(LEDC_CHANNEL_BUILTIN, LEDC_FREQ_HZ, LEDC_TIMER_BITS);
@@ -204,109 +362,26 @@ void setup() {
   // Initialize LEDs
   FastLED.addLeds<LED_TYPE, LED_PIN_A, COLOR_ORDER>(ledsA, NUM_LEDS_STOLE);
   FastLED.addLeds<LED_TYPE, LED_PIN_B, COLOR_ORDER>(ledsB, NUM_LEDS_STOLE);
-  FastLED.setBrightness(globalBrightness);
+  FastLED.setBrightness(engine.brightness());
   FastLED.clear();
   FastLED.show();
   Serial.println("Wizard Hat initialized");
   Serial.printf("Strand A: %d LEDs @ pin %d\n", NUM_LEDS_STOLE, LED_PIN_A);
-  Serial.printf("Strand B: %d LEDs @ pin %d\n", NUM_LEDS_STOLE, LED_PIN_B);
-  Serial.printf("Global brightness: %u/255\n", globalBrightness);
+  Serial.printf("Strand B: %d LEDs @ pin %d%s\n", NUM_LEDS_STOLE, LED_PIN_B,
+                HAT_MIRROR_ALIASED ? " (mirrors A's buffer)" : "");
+  Serial.printf("Global brightness: %u/255\n", engine.brightness());
   Serial.println("Hat is ready to receive spells from the staff!");
-  currentEffect = 1;  // start with rainbow
+  engine.applySpell(1);  // start with rainbow
 
 #if OTA_ENABLED
-  Serial.println("Connecting to WiFi for OTA...");
+  // Don't wait for the access point: ESP-NOW and the effects run from here,
+  // loop() picks up the result (pollWifiBringup)
+  Serial.println("Connecting to WiFi for OTA in the background...");
+  // Listen where the staff was last time: the cached access point's channel
+  if (uint8_t ch = wifiBringup.cachedEspNowChannel(WIFI_SSID)) espnowChannel = ch;
   WiFi.mode(WIFI_AP_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  wifiBringup.begin(WIFI_SSID, WIFI_PASSWORD);
   WiFi.setSleep(false);
-
-  int wifi_retry = 0;
-  while (WiFi.status() != WL_CONNECTED && wifi_retry < 20) {
-    delay(500);
-    Serial.print(".");
-    wifi_retry++;
-  }
-
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected");
-    Serial.print("IP: ");
-    Serial.println(WiFi.localIP());
-    Serial.printf("WiFi channel: %d\n", WiFi.channel());
-    espnowChannel = 1;
-    Serial.printf("ESP-NOW channel forced to %d\n", espnowChannel);
-
-    ArduinoOTA.setHostname(OTA_HOSTNAME);
-    ArduinoOTA.setPassword(OTA_PASSWORD);
-
-    ArduinoOTA.onStart([]() {
-      otaInProgress = true;
-      backgroundEffect = 0;
-      FastLED.clear();
-      FastLED.show();
-    });
-
-    ArduinoOTA.onEnd([]() {
-      fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Green);
-      fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Green);
-      FastLED.show();
-      delay(200);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-    });
-
-    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-      if (total == 0) return;
-      uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
-      static uint32_t lastPct = 101U;
-      if (pct != lastPct) {
-        lastPct = pct;
-        Serial.printf("Progress: %u%%\r", pct);
-      }
-
-      const uint32_t totalLeds = (uint32_t)NUM_LEDS_STOLE * 2U;
-      uint32_t lit = (total > 0) ? ((uint64_t)progress * totalLeds) / total : 0;
-
-      FastLED.clear();
-      CRGB onColor = CHSV(160, 255, globalBrightness);
-
-      uint32_t remaining = lit;
-
-      uint32_t cA = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
-      if (cA > 0) fill_solid(ledsA, (int)cA, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS_STOLE) ? (remaining - (uint32_t)NUM_LEDS_STOLE) : 0;
-
-      uint32_t cB = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
-      if (cB > 0) fill_solid(ledsB, (int)cB, onColor);
-
-      FastLED.show();
-    });
-
-    ArduinoOTA.onError([](ota_error_t error) {
-      Serial.printf("OTA Error[%u]\n", error);
-      fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Red);
-      fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Red);
-      FastLED.show();
-      delay(1000);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-    });
-
-    ArduinoOTA.begin();
-    Serial.println("OTA Ready");
-    Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
-    otaWindowActive = true;
-    otaWindowEndMs = millis() + OTA_WINDOW_MS;
-    Serial.printf("OTA upload window active for %lu ms\n", OTA_WINDOW_MS);
-  } else {
-    Serial.println("\nWiFi failed; OTA disabled. Using ESP-NOW only...");
-    WiFi.disconnect(true, true);
-    WiFi.mode(WIFI_STA);
-    delay(100);
-    esp_wifi_set_channel((uint8_t)espnowChannel, WIFI_SECOND_CHAN_NONE);
-    Serial.printf("ESP-NOW only mode on channel %d (STA)\n", espnowChannel);
-  }
 #else
   WiFi.mode(WIFI_STA);
 #endif
@@ -316,113 +391,74 @@ void setup() {
     return;
   }
   esp_now_register_recv_cb(onRecv);
+  spellRx.onFirstSpell(noteFirstSpell);
+#if LINK_RSSI
+  if (!spellRx.link().enableRssi()) Serial.println("Link health: no RSSI (promiscuous RX off)");
+#endif
 
 #if DEBUG_MODE
   Serial.println("DEBUG MODE: effect cycling");
   nextDebugEffectMs = millis() + DEBUG_EFFECT_DURATION_MS;
-  currentEffect = DEBUG_EFFECTS[0];
-  backgroundEffect = currentEffect;
+  engine.applySpell(DEBUG_EFFECTS[0]);
 #endif
 }
 
-void loop() {
-#if OTA_ENABLED
-  if (otaWindowActive) {
-    ArduinoOTA.handle();
-
-    if (!otaInProgress) {
-      unsigned long now = millis();
-      if ((long)(now - otaVisualNextMs) >= 0) {
-        otaVisualNextMs = now + OTA_VISUAL_INTERVAL_MS;
-        FastLED.clear();
-        int head = otaVisualPos % NUM_LEDS_STOLE;
-        ledsA[head] = CHSV(otaVisualHue, 220, globalBrightness);
-        ledsB[head] = CHSV(otaVisualHue + 64, 220, globalBrightness);
-        if (NUM_LEDS_STOLE > 1) {
-          int tA = (head + NUM_LEDS_STOLE - 1) % NUM_LEDS_STOLE;
-          int tB = tA;
-          ledsA[tA] = CHSV(otaVisualHue, 220, globalBrightness / 4);
-          ledsB[tB] = CHSV(otaVisualHue + 64, 220, globalBrightness / 4);
-        }
-        otaVisualPos = (otaVisualPos + 1) % NUM_LEDS_STOLE;
-        otaVisualHue++;
-        FastLED.show();
-
-        // Dim pulsing built-in LED during OTA window (very low peak)
-#if OTA_ENABLED
-        if (builtinLedReady) {
-          static uint8_t phase = 0; // 0..255
-          phase += 4; // pulse speed
-          uint8_t tri = (phase < 128) ? phase : (255 - phase); // 0..127 triangle wave
-          const uint8_t MAX_DUTY = 8; // very dim peak
-          uint8_t duty = (uint16_t)tri * MAX_DUTY / 127;
-          ledcWrite(LEDC_CHANNEL_BUILTIN, duty);
-        }
-#endif
-      }
-    }
-
-    if ((long)(millis() - otaWindowEndMs) >= 0 && !otaInProgress) {
-      otaWindowActive = false;
-      WiFi.disconnect(true, true);
-      WiFi.mode(WIFI_STA);
-      delay(100);
-      esp_wifi_set_channel((uint8_t)espnowChannel, WIFI_SECOND_CHAN_NONE);
-      reinitEspNow();
-      FastLED.clear();
-      FastLED.show();
-#if OTA_ENABLED
-      if (builtinLedReady) {
-        ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
-      }
-#endif
-      Serial.printf("OTA window closed; switched to ESP-NOW STA mode on channel %d\n", espnowChannel);
-    }
+// Deferred spell handling (onRecv only queues spells). Runs on whichever task
+// owns the engine: loop() before the frame pipeline starts, the render task after.
+static void handleDeferredWork() {
+  spellRx.drain();
+  // Streamed frames replace the effect. In the pipeline the back buffers may
+  // be a swap behind, so copy every frame.
+  engine.setExternal(spellRx.updateStream(engine.kAllStrands, true) ? engine.kAllStrands : 0);
 
-    if (otaWindowActive) {
-      return;
-    }
+#if DEBUG_MODE
+  unsigned long now = millis();
+  if ((long)(now - nextDebugEffectMs) >= 0) {
+    debugEffectIndex = (debugEffectIndex + 1) % DEBUG_EFFECTS_COUNT;
+    const int effect = DEBUG_EFFECTS[debugEffectIndex];
+    engine.applySpell(effect);
+    nextDebugEffectMs = now + DEBUG_EFFECT_DURATION_MS;
+    const char* effectNames[] = {"Off", "Rainbow", "Breathing"};
+    Serial.printf("DEBUG: Switching to %d (%s)\n", effect, effect < 3 ? effectNames[effect] : "Unknown");
   }
 #endif
+}
 
-  if (effectUpdated) {
-    effectUpdated = false;
-    Serial.printf("Received effect %d\n", (int)currentEffect);
+void loop() {
+#if OTA_ENABLED
+  pollWifiBringup();
+  // An update in flight owns the LEDs (OtaTask.h). With the pipeline
+  // running this task does not render, and onStart pauses the pipeline.
+  if (otaTask.updating()) {
+    otaTask.park();
+    delay(10);
+    return;
   }
-
-  if (lastEffect != currentEffect) {
-    lastEffect = currentEffect;
-    switch (currentEffect) {
-      case 0:
-      case 3:
-      case 4:
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      case 1:
-        backgroundEffect = 1;
-        rainbowHue = 0;
-        nextRainbowMs = millis();
-        break;
-      case 2:
-        backgroundEffect = 2;
-        breathBrightness = globalBrightness / 10;
-        breathStep = abs(breathStep);
-        nextBreathMs = millis();
-        break;
-      default:
-        break;
+#endif
+  spellRx.reportLink();
+
+#if FRAME_PIPELINE
+  // Render and output move to their own tasks
+  if (!pipelineStarted) {
+    pipelineStarted = true;
+    pipeline.setClock(sharedNowUs);
+    if (pipeline.begin(handleDeferredWork, TARGET_FPS)) {
+      Serial.println("Frame pipeline: render on core 1, output on core 0");
+    } else {
+      Serial.println("Frame pipeline: task start failed; rendering on loop task");
     }
   }
-
-  unsigned long now = millis();
-
-  if (otaInProgress) {
+  if (pipeline.running()) {
+    reportOutputStats(pipeline.output(), pipeline.scheduler());
+    delay(10);
     return;
   }
+#endif
+
+  handleDeferredWork();
 
 #if DEBUG_STRAND_CYCLING
+  unsigned long now = millis();
   // Strand length cycling mode - helps identify which physical strand is which
   if ((long)(now - nextStrandCycleMs) >= 0) {
     strandCycleIndex = (strandCycleIndex + 1) % STRAND_LENGTHS_COUNT;
@@ -450,79 +486,7 @@ void loop() {
   return;
 #endif
 
-#if DEBUG_MODE
-  if ((long)(now - nextDebugEffectMs) >= 0) {
-    debugEffectIndex = (debugEffectIndex + 1) % DEBUG_EFFECTS_COUNT;
-    currentEffect = DEBUG_EFFECTS[debugEffectIndex];
-    nextDebugEffectMs = now + DEBUG_EFFECT_DURATION_MS;
-    const char* effectNames[] = {"Off", "Rainbow", "Breathing"};
-    Serial.printf("DEBUG: Switching to %d (%s)\n", currentEffect, currentEffect < 3 ? effectNames[currentEffect] : "Unknown");
-  }
-#endif
-
   // Render background effect
-  switch (backgroundEffect) {
-    case 0: {
-      // Off
-    } break;
-
-    case 1: {
-      if ((long)(now - nextRainbowMs) >= 0) {
-        nextRainbowMs = now + tempoMs(RAINBOW_INTERVAL_MS);
-        for (int i = 0; i < NUM_LEDS_STOLE; i++) {
-          uint8_t hue = rainbowHue + (i * 256 / NUM_LEDS_STOLE);
-          ledsA[i] = CHSV(hue, 255, globalBrightness);
-          ledsB[i] = CHSV(hue, 255, globalBrightness);
-        }
-        rainbowHue += 1;
-      }
-    } break;
-
-    case 2: {
-      if ((long)(now - nextBreathMs) >= 0) {
-        nextBreathMs = now + tempoMs(BREATH_INTERVAL_MS);
-        uint8_t maxBreath = globalBrightness;
-        uint8_t minBreath = globalBrightness / 10;
-
-        int16_t b = (int16_t)breathBrightness + breathStep;
-        if (b >= maxBreath) {
-          b = maxBreath;
-          breathStep = -breathStep;
-        } else if (b <= minBreath) {
-          b = minBreath;
-          breathStep = -breathStep;
-        }
-        breathBrightness = (uint8_t)b;
-
-        for (int i = 0; i < NUM_LEDS_STOLE; i++) {
-          uint8_t hue = rainbowHue + (i * 256 / NUM_LEDS_STOLE);
-          ledsA[i] = CHSV(hue, 255, breathBrightness);
-          ledsB[i] = CHSV(hue, 255, breathBrightness);
-        }
-        rainbowHue += 1;
-      }
-    } break;
-
-
-    default:
-      backgroundEffect = 0;
-      break;
-  }
-
-  if (currentEffect >= 0 && currentEffect <= 4) {
-    FastLED.show();
-  }
-
-  // Brief green flash at index 0 on packet receipt
-  if (!otaWindowActive && !otaInProgress && packetFlash) {
-    if ((long)(millis() - packetFlashUntil) < 0) {
-      ledsA[0] = CRGB::Green;
-      ledsA[0].nscale8(globalBrightness);
-      ledsB[0] = CRGB::Green;
-      ledsB[0].nscale8(globalBrightness);
-      FastLED.show();
-    } else {
-      packetFlash = false;
-    }
-  }
+  engine.tick(sharedNowUs());
+  engine.show();  // no-op unless a strand changed
 }
@@ -5,7 +5,15 @@
 #include <ESPmDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
+#include <WifiBringup.h>
+#include <OtaTask.h>
 #include <esp_wifi.h>
+#include <esp_timer.h>
+#include <EffectEngine.h>
+#include <SpellReceiver.h>
+#include <AsyncShow.h>
+#include <FrameScheduler.h>
+#include <Trace.h>
 
 // OTA Configuration
 // Set your WiFi credentials for OTA updates
@@ -70,49 +78,66 @@ Electrical guidance:
 // Dynamic ESP-NOW channel (defaults to 1, updated to AP channel if connected during OTA)
 int espnowChannel = 1;
 
-// Global brightness control (0-255)
-// Adjust this value to change maximum brightness for all effects
-uint8_t globalBrightness = 128;  // Full brightness (adjust as needed)
-const uint8_t BRIGHTNESS_STEP = 16; // Step used by spells 7/8
-
 CRGB leds1[NUM_LEDS];
 CRGB leds2[NUM_LEDS];
 CRGB leds3[NUM_LEDS];
 CRGB leds4[NUM_LEDS];
 CRGB ledsStole[NUM_LEDS_STOLE];
 
-typedef struct {
-  int effect_id;
-} SpellPacket;
-
-SpellPacket incoming;
-volatile int currentEffect = 0;  // updated in ISR/callback
-
-// Deferred-work flags/state to keep onRecv minimal and non-blocking
-volatile bool effectUpdated = false;   // for deferred Serial logging
-volatile bool packetFlash = false;        // transient visual pulse on any received packet
-unsigned long packetFlashUntil = 0;
-// Control request flags (set in onRecv, handled in loop)
-volatile bool tempoDownRequested = false;
-volatile bool tempoUpRequested = false;
-volatile bool brightnessDownRequested = false;
-volatile bool brightnessUpRequested = false;
-
-// Effect state
-int lastEffect = -1;
-int backgroundEffect = 0;  // Current background effect (0=off, 1=rainbow, 2=breathing)
-volatile bool otaInProgress = false;  // Flag to stop effects during OTA
+// Background effects, tempo and brightness (0-255) live in the shared engine.
+// Strand order must match the FastLED.addLeds() order in setup().
+using ReceiverLayout = StrandLayout<NUM_LEDS, NUM_LEDS, NUM_LEDS, NUM_LEDS, NUM_LEDS_STOLE>;
+EffectEngine<ReceiverLayout> engine({leds1, leds2, leds3, leds4, ledsStole});
+// show() runs on its own task so spell handling never waits on the wire
+AsyncShow ledOutput;
+
+// Frame rate target; five 250-LED strands take ~37 ms on the wire
+#ifndef TARGET_FPS
+#define TARGET_FPS 25
+#endif
+FrameScheduler frameScheduler(TARGET_FPS);
+
+// Periodic LED output report: frames, time on the wire, time the renderer
+// spent blocked waiting for it, and frames that missed their deadline
+#ifndef OUTPUT_STATS_INTERVAL_MS
+#define OUTPUT_STATS_INTERVAL_MS 10000
+#endif
+unsigned long nextOutputStatsMs = 0;
+
+static void reportOutputStats(AsyncShow& out, FrameScheduler& sched) {
+  unsigned long now = millis();
+  if ((long)(now - nextOutputStatsMs) < 0) return;
+  nextOutputStatsMs = now + OUTPUT_STATS_INTERVAL_MS;
+  AsyncShow::Stats st = out.takeInterval();
+  FrameScheduler::Stats fs = sched.takeInterval();
+  Serial.printf("LED output: %lu frames in %lu ms, show avg %lu us, blocked %lu us, late %lu/%lu (worst %lu us)\n",
+                (unsigned long)st.shows, (unsigned long)OUTPUT_STATS_INTERVAL_MS,
+                (unsigned long)(st.shows ? st.showUs / st.shows : 0), (unsigned long)st.blockedUs,
+                (unsigned long)fs.late, (unsigned long)fs.frames, (unsigned long)fs.worstLateUs);
+}
+
+// Hot-path events (Trace.h): text lines, or binary records with TRACE_LOG=1
+TraceLog traceLog;
+static void traceOut(const uint8_t* data, size_t len) { Serial.write(data, len); }
+
+// ESP-NOW receive path (SpellReceiver.h): spells, clock beacons, state
+// frames and, with STREAM_FRAMES=1, pixel frames streamed by the staff, which
+// replace the effect on STREAM_STRAND_MASK while they keep arriving (stretched
+// to each strand).
+// onRecv only queues; loop() drains.
+SpellReceiver<ReceiverLayout, NUM_LEDS_STOLE> spellRx(engine, traceLog, serialLogF);
+#ifndef STREAM_STRAND_MASK
+#define STREAM_STRAND_MASK (1u << 4)  // ledsStole
+#endif
+
+static uint32_t sharedNowUs() { return spellRx.sharedNowUs(); }
+
+// Idle ("off") unless OTA_ENABLED
+WifiBringup wifiBringup;  // polled from loop() until it connects or times out
 #if OTA_ENABLED
-const unsigned long OTA_WINDOW_MS = 25000;  // OTA upload window after boot (25s)
-bool otaWindowActive = false;
-unsigned long otaWindowEndMs = 0;
-// Visual indicator state during OTA window
-unsigned long otaVisualNextMs = 0;
-const unsigned long OTA_VISUAL_INTERVAL_MS = 30;
-uint8_t otaVisualHue = 160; // blue-ish indicator
-uint8_t otaVisualPos = 0;
-
-// Built-in LED dim blink during OTA window
+OtaTask otaTask;          // ArduinoOTA for the whole uptime once WiFi is up
+
+// Built-in LED glows dimly while an update is written
 #ifndef BUILTIN_LED_PIN
 #define BUILTIN_LED_PIN 4
 #endif
@@ -126,34 +151,8 @@ uint8_t otaVisualPos = 0;
 #define LEDC_FREQ_HZ 5000
 #endif
 bool builtinLedReady = false;
-uint8_t builtinLedDuty = 0;
-unsigned long builtinLedNextToggleMs = 0;
-const unsigned long BUILTIN_LED_TOGGLE_MS = 300;
 #endif
 
- // Tempo control (applies to all background effects)
-float tempoFactor = 1.0f;        // 1.0 = normal speed
-const float TEMPO_MIN = 0.25f;   // 0.25x (very slow)
-const float TEMPO_MAX = 4.0f;    // 4x (very fast)
-inline unsigned long tempoMs(unsigned long baseMs) {
-  float scaled = baseMs / tempoFactor;
-  if (scaled < 1.0f) scaled = 1.0f;
-  return (unsigned long)scaled;
-}
-
-// Background rainbow effect (effect 1)
-uint8_t rainbowHue = 0;
-unsigned long nextRainbowMs = 0;
-const unsigned long RAINBOW_INTERVAL_MS = 20;  // update rate for smooth animation
-
-// Background breathing effect (effect 2)
-uint8_t breathBrightness = 0;
-int8_t breathStep = 4;                     // brightness step per tick
-unsigned long nextBreathMs = 0;
-const unsigned long BREATH_INTERVAL_MS = 15;  // update rate
-
-
-
 #if DEBUG_MODE
 // Debug mode variables for automatic effect cycling
 int debugEffectIndex = 0;
@@ -163,32 +162,16 @@ const int DEBUG_EFFECTS[] = {1, 2, 3, 0};  // Effects to cycle through
 const int DEBUG_EFFECTS_COUNT = sizeof(DEBUG_EFFECTS) / sizeof(DEBUG_EFFECTS[0]);
 #endif
 
-void onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
-  // Keep callback minimal: parse/copy and set flags only
-  if (len >= (int)sizeof(SpellPacket)) {
-    memcpy((void*)&incoming, incomingData, sizeof(incoming));
-    int spell = incoming.effect_id;
-    currentEffect = spell; // keep for logging
-
-    // Map spells:
-    // 1-4: set base background effect (4=Off)
-    // 5: tempo down, 6: tempo up, 7: brightness down, 8: brightness up
-    if (spell == 5) {
-      tempoDownRequested = true;
-    } else if (spell == 6) {
-      tempoUpRequested = true;
-    } else if (spell == 7) {
-      brightnessDownRequested = true;
-    } else if (spell == 8) {
-      brightnessUpRequested = true;
-    }
+void IRAM_ATTR onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  spellRx.onRecv(mac, incomingData, len);
+}
 
-    // Signal loop() to do any heavier work
-    effectUpdated = true;   // deferred Serial logging
-    // Visual pulse to confirm radio reception regardless of effect mapping
-    packetFlash = true;
-    packetFlashUntil = millis() + 120; // ~120ms green blip
-  }
+// Reset-to-first-spell time for fast-reconnect measurements, logged once by
+// the receiver's first-spell hook. rxUs is esp_timer time, which starts at
+// boot (also after deep sleep).
+static void noteFirstSpell(const SpellEvent& ev) {
+  Serial.printf("Boot: first spell %lu ms after %s (WiFi: %s, ESP-NOW channel %d)\n",
+                (unsigned long)(ev.rxUs / 1000), resetKind(), wifiBringup.describe(), espnowChannel);
 }
 
 static void reinitEspNow() {
@@ -203,8 +186,171 @@ static void reinitEspNow() {
   Serial.printf("ESP-NOW reinitialized on channel %d\n", WiFi.channel());
 }
 
+#if OTA_ENABLED
+// WiFi associated (polled from loop): stay connected and serve OTA from
+// here on. ESP-NOW moves to the access point's channel with the radio.
+static void startOta() {
+  Serial.printf("WiFi connected after %lu ms (%s)\n", (unsigned long)wifiBringup.elapsedMs(),
+                wifiBringup.describe());
+  Serial.print("IP address: ");
+  Serial.println(WiFi.localIP());
+  Serial.printf("WiFi channel: %d\n", WiFi.channel());
+  espnowChannel = WiFi.channel();
+  reinitEspNow();
+  wifiBringup.save(espnowChannel);  // next boot: no scan
+  wifiBringup.holdChannel((uint8_t)espnowChannel);  // a lost access point must not move ESP-NOW
+  
+  // Configure OTA
+  ArduinoOTA.setHostname(OTA_HOSTNAME);
+  ArduinoOTA.setPassword(OTA_PASSWORD);
+  
+  ArduinoOTA.onStart([]() {
+    String type;
+    if (ArduinoOTA.getCommand() == U_FLASH) {
+      type = "sketch";
+    } else {  // U_SPIFFS
+      type = "filesystem";
+    }
+    Serial.println("Start updating " + type);
+    // Effects ran until now; take the LEDs over for the progress bar
+    if (!otaTask.beginUpdate()) Serial.println("OTA: renderer did not park in time");
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 24);
+  });
+  
+  ArduinoOTA.onEnd([]() {
+    Serial.println("\nEnd");
+    // Brief green success flash
+    fill_solid(leds1, NUM_LEDS, CRGB::Green);
+    fill_solid(leds2, NUM_LEDS, CRGB::Green);
+    fill_solid(leds3, NUM_LEDS, CRGB::Green);
+    fill_solid(leds4, NUM_LEDS, CRGB::Green);
+    fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Green);
+    FastLED.show();
+    delay(200);
+    FastLED.clear();
+    FastLED.show();
+  });
+  
+  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+    if (total == 0) {
+      Serial.printf("Progress: %u/%u\r", progress, total);
+      return;
+    }
+    uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
+    static uint32_t lastPct = 101U;
+    if (pct != lastPct) {
+      lastPct = pct;
+      Serial.printf("Progress: %u%%\r", pct);
+    }
+
+    // Visual OTA progress across all strips (blue bar fill)
+    // Map progress 0..total to 0..(NUM_LEDS * NUM_STRIPS)
+    const uint32_t totalLeds = (uint32_t)NUM_LEDS * (uint32_t)NUM_STRIPS;
+    uint32_t lit = (total > 0) ? ((uint64_t)progress * totalLeds) / total : 0;
+
+    // Clear all LEDs, then fill lit portion in order: strip1 -> strip4
+    FastLED.clear();
+
+    uint8_t hue = 160; // blue-ish
+    CRGB onColor = CHSV(hue, 255, engine.brightness());
+
+    uint32_t remaining = lit;
+
+    // Strip 1
+    uint32_t c1 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c1 > 0) fill_solid(leds1, (int)c1, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
+
+    // Strip 2
+    uint32_t c2 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c2 > 0) fill_solid(leds2, (int)c2, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
+
+    // Strip 3
+    uint32_t c3 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c3 > 0) fill_solid(leds3, (int)c3, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
+
+    // Strip 4
+    uint32_t c4 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
+    if (c4 > 0) fill_solid(leds4, (int)c4, onColor);
+
+    FastLED.show();
+  });
+  
+  ArduinoOTA.onError([](ota_error_t error) {
+    Serial.printf("Error[%u]: ", error);
+    if (error == OTA_AUTH_ERROR) {
+      Serial.println("Auth Failed");
+    } else if (error == OTA_BEGIN_ERROR) {
+      Serial.println("Begin Failed");
+    } else if (error == OTA_CONNECT_ERROR) {
+      Serial.println("Connect Failed");
+    } else if (error == OTA_RECEIVE_ERROR) {
+      Serial.println("Receive Failed");
+    } else if (error == OTA_END_ERROR) {
+      Serial.println("End Failed");
+    }
+    // Flash red on error
+    fill_solid(leds1, NUM_LEDS, CRGB::Red);
+    fill_solid(leds2, NUM_LEDS, CRGB::Red);
+    fill_solid(leds3, NUM_LEDS, CRGB::Red);
+    fill_solid(leds4, NUM_LEDS, CRGB::Red);
+    fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Red);
+    FastLED.show();
+    delay(1000);
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
+    engine.realign();  // full repaint over the progress bar
+    otaTask.endUpdate();
+  });
+  
+  ArduinoOTA.begin();
+  Serial.println("OTA Ready");
+  Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
+  if (!otaTask.begin()) Serial.println("OTA task failed to start; OTA disabled");
+}
+
+// No access point within WIFI_CONNECT_TIMEOUT_MS
+static void onWifiFailed() {
+  Serial.printf("WiFi connection failed after %lu ms. OTA disabled.\n", (unsigned long)wifiBringup.elapsedMs());
+  Serial.println("Continuing with ESP-NOW only...");
+  // Pure ESP-NOW STA mode on fixed channel (no SoftAP)
+  WiFi.disconnect(true, true);
+  WiFi.mode(WIFI_STA);
+  delay(100);
+  espnowChannel = 1;  // a staff without WiFi pins channel 1 too
+  esp_wifi_set_channel((uint8_t)espnowChannel, WIFI_SECOND_CHAN_NONE);
+  Serial.printf("ESP-NOW only mode on channel %d (STA)\n", espnowChannel);
+  reinitEspNow();
+}
+
+static void pollWifiBringup() {
+  switch (wifiBringup.poll()) {
+    case WIFI_BRINGUP_CONNECTED:
+      startOta();
+      break;
+    case WIFI_BRINGUP_FAILED:
+      onWifiFailed();
+      break;
+    case WIFI_BRINGUP_LOST:
+      Serial.printf("WiFi: access point lost; ESP-NOW stays on channel %d\n", espnowChannel);
+      break;
+    case WIFI_BRINGUP_RESTORED:
+      Serial.printf("WiFi: rejoined the access point on channel %d\n", espnowChannel);
+      break;
+    default:
+      break;
+  }
+}
+#endif
+
 void setup() {
   Serial.begin(115200);
+  if (!traceLog.begin(traceOut)) Serial.println("Trace: task failed to start");
   // Setup built-in LED PWM if not conflicting with a used data pin
 #if defined(BUILTIN_LED_PIN)
   // If LED_PIN_STOLE shares GPIO4, skip to avoid contention
@@ -229,165 +375,26 @@ void setup() {
   FastLED.addLeds<LED_TYPE, LED_PIN_3, COLOR_ORDER>(leds3, NUM_LEDS);
   FastLED.addLeds<LED_TYPE, LED_PIN_4, COLOR_ORDER>(leds4, NUM_LEDS);
   FastLED.addLeds<LED_TYPE, LED_PIN_STOLE, COLOR_ORDER>(ledsStole, NUM_LEDS_STOLE);
-  FastLED.setBrightness(globalBrightness);  // Use global brightness setting
+  FastLED.setBrightness(engine.brightness());
   FastLED.clear();
   FastLED.show();
+  if (!ledOutput.begin()) Serial.println("LED output task failed; using blocking show()");
   Serial.println("WS2812B LED Strip Receiver initialized");
   Serial.printf("Controlling %d LEDs per strip across %d strips on pins: %d,%d,%d,%d\n", NUM_LEDS, NUM_STRIPS, LED_PIN_1, LED_PIN_2, LED_PIN_3, LED_PIN_4);
   Serial.printf("Stole strand: %d LEDs on pin %d\n", NUM_LEDS_STOLE, LED_PIN_STOLE);
-  Serial.printf("Global brightness set to: %d/255\n", globalBrightness);
+  Serial.printf("Global brightness set to: %d/255\n", engine.brightness());
   // Default to a visible background effect so LEDs show after boot
-  currentEffect = 1;
+  engine.applySpell(1);
 
 #if OTA_ENABLED
-  // Connect to WiFi for OTA updates
-  Serial.println("Connecting to WiFi for OTA...");
+  // Don't wait for the access point: ESP-NOW and the effects run from here,
+  // loop() picks up the result (pollWifiBringup)
+  Serial.println("Connecting to WiFi for OTA in the background...");
+  // Listen where the staff was last time: the cached access point's channel
+  if (uint8_t ch = wifiBringup.cachedEspNowChannel(WIFI_SSID)) espnowChannel = ch;
   WiFi.mode(WIFI_AP_STA);  // Both AP and Station mode for ESP-NOW + WiFi
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  wifiBringup.begin(WIFI_SSID, WIFI_PASSWORD);
   WiFi.setSleep(false);  // Disable WiFi modem sleep to improve OTA stability
-  
-  // Wait for connection with timeout
-  int wifi_retry = 0;
-  while (WiFi.status() != WL_CONNECTED && wifi_retry < 20) {
-    delay(500);
-    Serial.print(".");
-    wifi_retry++;
-  }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected!");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-    Serial.printf("WiFi channel: %d\n", WiFi.channel());
-    // Force ESP-NOW channel to 1 for compatibility with the sender
-    espnowChannel = 1;
-    Serial.printf("ESP-NOW channel forced to %d\n", espnowChannel);
-    
-    // Configure OTA
-    ArduinoOTA.setHostname(OTA_HOSTNAME);
-    ArduinoOTA.setPassword(OTA_PASSWORD);
-    
-    ArduinoOTA.onStart([]() {
-      String type;
-      if (ArduinoOTA.getCommand() == U_FLASH) {
-        type = "sketch";
-      } else {  // U_SPIFFS
-        type = "filesystem";
-      }
-      Serial.println("Start updating " + type);
-      // Stop all effects and turn off LEDs during update
-      otaInProgress = true;
-      backgroundEffect = 0;
-      FastLED.clear();
-      FastLED.show();
-    });
-    
-    ArduinoOTA.onEnd([]() {
-      Serial.println("\nEnd");
-      // Brief green success flash
-      fill_solid(leds1, NUM_LEDS, CRGB::Green);
-      fill_solid(leds2, NUM_LEDS, CRGB::Green);
-      fill_solid(leds3, NUM_LEDS, CRGB::Green);
-      fill_solid(leds4, NUM_LEDS, CRGB::Green);
-      fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Green);
-      FastLED.show();
-      delay(200);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-    });
-    
-    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-      if (total == 0) {
-        Serial.printf("Progress: %u/%u\r", progress, total);
-        return;
-      }
-      uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
-      static uint32_t lastPct = 101U;
-      if (pct != lastPct) {
-        lastPct = pct;
-        Serial.printf("Progress: %u%%\r", pct);
-      }
-
-      // Visual OTA progress across all strips (blue bar fill)
-      // Map progress 0..total to 0..(NUM_LEDS * NUM_STRIPS)
-      const uint32_t totalLeds = (uint32_t)NUM_LEDS * (uint32_t)NUM_STRIPS;
-      uint32_t lit = (total > 0) ? ((uint64_t)progress * totalLeds) / total : 0;
-
-      // Clear all LEDs, then fill lit portion in order: strip1 -> strip4
-      FastLED.clear();
-
-      uint8_t hue = 160; // blue-ish
-      CRGB onColor = CHSV(hue, 255, globalBrightness);
-
-      uint32_t remaining = lit;
-
-      // Strip 1
-      uint32_t c1 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c1 > 0) fill_solid(leds1, (int)c1, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
-
-      // Strip 2
-      uint32_t c2 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c2 > 0) fill_solid(leds2, (int)c2, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
-
-      // Strip 3
-      uint32_t c3 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c3 > 0) fill_solid(leds3, (int)c3, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS) ? (remaining - (uint32_t)NUM_LEDS) : 0;
-
-      // Strip 4
-      uint32_t c4 = remaining > (uint32_t)NUM_LEDS ? (uint32_t)NUM_LEDS : remaining;
-      if (c4 > 0) fill_solid(leds4, (int)c4, onColor);
-
-      FastLED.show();
-    });
-    
-    ArduinoOTA.onError([](ota_error_t error) {
-      Serial.printf("Error[%u]: ", error);
-      if (error == OTA_AUTH_ERROR) {
-        Serial.println("Auth Failed");
-      } else if (error == OTA_BEGIN_ERROR) {
-        Serial.println("Begin Failed");
-      } else if (error == OTA_CONNECT_ERROR) {
-        Serial.println("Connect Failed");
-      } else if (error == OTA_RECEIVE_ERROR) {
-        Serial.println("Receive Failed");
-      } else if (error == OTA_END_ERROR) {
-        Serial.println("End Failed");
-      }
-      // Flash red on error
-      fill_solid(leds1, NUM_LEDS, CRGB::Red);
-      fill_solid(leds2, NUM_LEDS, CRGB::Red);
-      fill_solid(leds3, NUM_LEDS, CRGB::Red);
-      fill_solid(leds4, NUM_LEDS, CRGB::Red);
-      fill_solid(ledsStole, NUM_LEDS_STOLE, CRGB::Red);
-      FastLED.show();
-      delay(1000);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-    });
-    
-    ArduinoOTA.begin();
-    Serial.println("OTA Ready");
-    Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
-    // Start limited OTA window
-    otaWindowActive = true;
-    otaWindowEndMs = millis() + OTA_WINDOW_MS;
-    Serial.printf("OTA upload window active for %lu ms\n", OTA_WINDOW_MS);
-  } else {
-    Serial.println("\nWiFi connection failed. OTA disabled.");
-    Serial.println("Continuing with ESP-NOW only...");
-    // Pure ESP-NOW STA mode on fixed channel (no SoftAP)
-    WiFi.disconnect(true, true);
-    WiFi.mode(WIFI_STA);
-    delay(100);
-    esp_wifi_set_channel((uint8_t)espnowChannel, WIFI_SECOND_CHAN_NONE);
-    Serial.printf("ESP-NOW only mode on channel %d (STA)\n", espnowChannel);
-    reinitEspNow();
-  }
 #else
   WiFi.mode(WIFI_STA);
 #endif
@@ -398,291 +405,62 @@ void setup() {
   }
 
   esp_now_register_recv_cb(onRecv);
+  spellRx.onFirstSpell(noteFirstSpell);
+#if LINK_RSSI
+  if (!spellRx.link().enableRssi()) Serial.println("Link health: no RSSI (promiscuous RX off)");
+#endif
   
 #if DEBUG_MODE
   Serial.println("DEBUG MODE: Automatic effect cycling enabled");
   Serial.println("Effects will cycle every 1 second: Rainbow -> Breathing -> Off");
   nextDebugEffectMs = millis() + DEBUG_EFFECT_DURATION_MS;
-  currentEffect = DEBUG_EFFECTS[0];  // Start with first effect
-  backgroundEffect = currentEffect;  // Set initial background effect
+  engine.applySpell(DEBUG_EFFECTS[0]);  // Set initial background effect
 #endif
 }
 
 void loop() {
 #if OTA_ENABLED
-  // During the initial OTA window, handle OTA and show a special LED indicator.
-  if (otaWindowActive) {
-    ArduinoOTA.handle();
-
-    if (!otaInProgress) {
-      unsigned long now = millis();
-      if ((long)(now - otaVisualNextMs) >= 0) {
-        otaVisualNextMs = now + OTA_VISUAL_INTERVAL_MS;
-        // Render a colorful comet animation across all strips to indicate "upload mode"
-        FastLED.clear();
-
-        uint8_t hue0 = otaVisualHue;
-        uint8_t hue1 = otaVisualHue + 42;
-        uint8_t hue2 = otaVisualHue + 84;
-        uint8_t hue3 = otaVisualHue + 126;
-
-        int head = otaVisualPos % NUM_LEDS;
-
-        // Strip 1
-        leds1[head] = CHSV(hue0, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t1 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds1[t1] = CHSV(hue0, 220, globalBrightness / 4);
-        }
-
-        // Strip 2
-        leds2[head] = CHSV(hue1, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t2 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds2[t2] = CHSV(hue1, 220, globalBrightness / 4);
-        }
-
-        // Strip 3
-        leds3[head] = CHSV(hue2, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t3 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds3[t3] = CHSV(hue2, 220, globalBrightness / 4);
-        }
-
-        // Strip 4
-        leds4[head] = CHSV(hue3, 220, globalBrightness);
-        if (NUM_LEDS > 1) {
-          int t4 = (head + NUM_LEDS - 1) % NUM_LEDS;
-          leds4[t4] = CHSV(hue3, 220, globalBrightness / 4);
-        }
-
-        otaVisualPos = (otaVisualPos + 1) % NUM_LEDS;
-        otaVisualHue++; // slowly cycle hues for a prettier effect
-        FastLED.show();
-
-        // Dim pulsing built-in LED during OTA window (very low peak)
-        if (builtinLedReady) {
-          static uint8_t phase = 0; // 0..255
-          phase += 4; // pulse speed
-          uint8_t tri = (phase < 128) ? phase : (255 - phase); // 0..127 triangle wave
-          const uint8_t MAX_DUTY = 8; // very dim peak
-          uint8_t duty = (uint16_t)tri * MAX_DUTY / 127;
-          ledcWrite(LEDC_CHANNEL_BUILTIN, duty);
-        }
-      }
-    }
-
-    // Close OTA window after timeout (unless an OTA is currently active)
-    if ((long)(millis() - otaWindowEndMs) >= 0 && !otaInProgress) {
-      otaWindowActive = false;
-      // Switch to pure ESP-NOW STA mode and force channel
-      WiFi.disconnect(true, true);
-      WiFi.mode(WIFI_STA);
-      delay(100);
-      esp_wifi_set_channel((uint8_t)espnowChannel, WIFI_SECOND_CHAN_NONE);
-      reinitEspNow();
-      FastLED.clear();
-      FastLED.show();
-      // Turn off built-in LED after OTA window closes
-      if (builtinLedReady) {
-        ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
-      }
-      Serial.printf("OTA window closed; switching to ESP-NOW receiver STA mode on channel %d\n", espnowChannel);
-      Serial.printf("Current channel after switch: %d\n", WiFi.channel());
-    }
-
-    // While in OTA window, skip normal effect rendering
-    if (otaWindowActive) {
-      return;
-    }
+  pollWifiBringup();
+  // An update in flight owns the LEDs (OtaTask.h) once our last frame is
+  // off the wire
+  if (otaTask.updating()) {
+    if (!ledOutput.busy()) otaTask.park();
+    delay(10);
+    return;
   }
 #endif
-
-  // Deferred logging to avoid Serial in callback
-  if (effectUpdated) {
-    effectUpdated = false;
-    int effect = currentEffect; // read once
-    Serial.printf("Received effect %d\n", effect);
-  }
-
-  // Handle control requests from spells 5-8
-  if (tempoDownRequested) {
-    tempoDownRequested = false;
-    tempoFactor *= 0.85f; // slow down ~15%
-    if (tempoFactor < TEMPO_MIN) tempoFactor = TEMPO_MIN;
-    Serial.printf("Tempo decreased. tempoFactor=%.2f\n", tempoFactor);
-  }
-  if (tempoUpRequested) {
-    tempoUpRequested = false;
-    tempoFactor *= 1.15f; // speed up ~15%
-    if (tempoFactor > TEMPO_MAX) tempoFactor = TEMPO_MAX;
-    Serial.printf("Tempo increased. tempoFactor=%.2f\n", tempoFactor);
-  }
-  if (brightnessDownRequested) {
-    brightnessDownRequested = false;
-    uint16_t b = globalBrightness;
-    if (b > BRIGHTNESS_STEP) b -= BRIGHTNESS_STEP; else b = 1;
-    globalBrightness = (uint8_t)b;
-    FastLED.setBrightness(globalBrightness);
-    Serial.printf("Brightness decreased to %u/255\n", globalBrightness);
-  }
-  if (brightnessUpRequested) {
-    brightnessUpRequested = false;
-    uint16_t b = globalBrightness;
-    b = (b + BRIGHTNESS_STEP > 255) ? 255 : (b + BRIGHTNESS_STEP);
-    globalBrightness = (uint8_t)b;
-    FastLED.setBrightness(globalBrightness);
-    Serial.printf("Brightness increased to %u/255\n", globalBrightness);
-  }
-
-  // Detect effect change and reset state as needed
-  if (lastEffect != currentEffect) {
-    lastEffect = currentEffect;
-
-    // Reset per-effect state for background effects only
-    switch (currentEffect) {
-      case 0: // Off - clear background effect
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      case 1: // Background rainbow
-        backgroundEffect = 1;
-        rainbowHue = 0;
-        nextRainbowMs = millis();
-        break;
-      case 2: // Background breathing
-        backgroundEffect = 2;
-        breathBrightness = globalBrightness / 10;
-        breathStep = abs(breathStep);
-        nextBreathMs = millis();
-        break;
-      case 3:
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      case 4: // Off (spell 4)
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      default:
-        // Ignore non-background spells (5-8) here
-        break;
-    }
-  }
+  spellRx.reportLink();
+  spellRx.drain();
 
   unsigned long now = millis();
 
-  // Skip all effects if OTA is in progress
-  if (otaInProgress) {
-    return;
-  }
-
 #if DEBUG_MODE
   // Debug mode: automatically cycle background effects
   if ((long)(now - nextDebugEffectMs) >= 0) {
     debugEffectIndex = (debugEffectIndex + 1) % DEBUG_EFFECTS_COUNT;
-    currentEffect = DEBUG_EFFECTS[debugEffectIndex];
+    const int effect = DEBUG_EFFECTS[debugEffectIndex];
+    engine.applySpell(effect);
     nextDebugEffectMs = now + DEBUG_EFFECT_DURATION_MS;
     
     const char* effectNames[] = {"Off", "Rainbow", "Breathing"};
-    Serial.printf("DEBUG: Switching to background effect %d (%s)\n", currentEffect, 
-                  currentEffect < 3 ? effectNames[currentEffect] : "Unknown");
+    Serial.printf("DEBUG: Switching to background effect %d (%s)\n", effect, effect < 3 ? effectNames[effect] : "Unknown");
   }
 #endif
 
-  // First, render background effect (if any)
-  switch (backgroundEffect) {
-    case 0: {
-      // Off - no background effect
-    } break;
-
-    case 1: {
-      // Background Rainbow: continuous rainbow cycling
-      if ((long)(now - nextRainbowMs) >= 0) {
-        nextRainbowMs = now + tempoMs(RAINBOW_INTERVAL_MS);
-
-        // Create rainbow effect across all LEDs
-        for (int i = 0; i < NUM_LEDS; i++) {
-          uint8_t ledHue = rainbowHue + (i * 256 / NUM_LEDS);
-          leds1[i] = CHSV(ledHue, 255, globalBrightness);
-          leds2[i] = CHSV(ledHue, 255, globalBrightness);
-          leds3[i] = CHSV(ledHue, 255, globalBrightness);
-          leds4[i] = CHSV(ledHue, 255, globalBrightness);
-        }
-        // Stole strand (scaled to its length)
-        for (int j = 0; j < NUM_LEDS_STOLE; j++) {
-          uint8_t ledHue2 = rainbowHue + (j * 256 / NUM_LEDS_STOLE);
-          ledsStole[j] = CHSV(ledHue2, 255, globalBrightness);
-        }
-
-        rainbowHue += 1;  // wraps at 256
-      }
-    } break;
-
-    case 2: {
-      // Background Breathing: continuous breathing effect
-      if ((long)(now - nextBreathMs) >= 0) {
-        nextBreathMs = now + tempoMs(BREATH_INTERVAL_MS);
-
-        uint8_t maxBreath = globalBrightness;
-        uint8_t minBreath = globalBrightness / 10;
-
-        // Update brightness with bounds
-        int16_t b = (int16_t)breathBrightness + breathStep;
-        if (b >= maxBreath) {
-          b = maxBreath;
-          breathStep = -breathStep; // start decreasing
-        } else if (b <= minBreath) {
-          b = minBreath;
-          breathStep = -breathStep; // start increasing
-        }
-        breathBrightness = (uint8_t)b;
-
-        // Apply rainbow with breathing brightness
-        for (int i = 0; i < NUM_LEDS; i++) {
-          uint8_t ledHue = rainbowHue + (i * 256 / NUM_LEDS);
-          leds1[i] = CHSV(ledHue, 255, breathBrightness);
-          leds2[i] = CHSV(ledHue, 255, breathBrightness);
-          leds3[i] = CHSV(ledHue, 255, breathBrightness);
-          leds4[i] = CHSV(ledHue, 255, breathBrightness);
-        }
-        // Stole strand (scaled to its length)
-        for (int j = 0; j < NUM_LEDS_STOLE; j++) {
-          uint8_t ledHue2 = rainbowHue + (j * 256 / NUM_LEDS_STOLE);
-          ledsStole[j] = CHSV(ledHue2, 255, breathBrightness);
-        }
-
-        // Step hue slowly for variation
-        rainbowHue += 1;
-      }
-    } break;
-
-
-    default: {
-      // Unknown background effect, turn off
-      backgroundEffect = 0;
-    } break;
+  // Render background effect (if any) and the packet-receipt flash overlay.
+  // The buffers are read while a transfer is in flight, so skip the tick until
+  // it is done; the time-based animation clock catches up on the next one.
+  if (!ledOutput.busy()) {
+    // Writes the LED buffers, so only while no transfer is in flight. One
+    // buffer set: it keeps the last copy, so only copy new frames.
+    engine.setExternal(spellRx.updateStream(STREAM_STRAND_MASK, false) ? STREAM_STRAND_MASK : 0);
+    engine.tick(sharedNowUs());
+    if (engine.takeDirty()) ledOutput.start();  // returns immediately
   }
+  reportOutputStats(ledOutput, frameScheduler);
 
-  // No one-shot effects; ensure LEDs update when only background is active
-  if (currentEffect >= 0 && currentEffect <= 4) {
-    FastLED.show();
-  }
-
-  // Brief green flash on LED 0 to acknowledge any received packet
-  if (!otaWindowActive && !otaInProgress && packetFlash) {
-    if ((long)(millis() - packetFlashUntil) < 0) {
-      // Overlay a green pixel without disturbing the rest much
-      leds1[0] = CRGB::Green;
-      leds1[0].nscale8(globalBrightness);
-      FastLED.show();
-    } else {
-      packetFlash = false;
-    }
-  }
+  // Sleep until the next frame deadline instead of spinning
+  frameScheduler.wait();
 
   // Other non-blocking work can go here
 }
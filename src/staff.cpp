@@ -3,60 +3,66 @@
 #include <WiFi.h>
 #include <FastLED.h>
 #include <esp_wifi.h>
+#include <esp_timer.h>
 #include <ESPmDNS.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
+#include <WifiBringup.h>
+#include <OtaTask.h>
 #include <stdarg.h>
+#include <EffectEngine.h>
+#include <SpellPacket.h>
+#include <ReliableLink.h>
+#include <SpellQueue.h>
+#include <LinkHealth.h>
+#include <SpellSchedule.h>
+#include <StateSync.h>
+#include <PixelStream.h>
+#include <AsyncShow.h>
+#include <FrameScheduler.h>
+#include <NetSerial.h>
+#include <Trace.h>
+#include <Console.h>
 
 #ifndef DEBUG_NET_SERIAL
 #define DEBUG_NET_SERIAL 1
 #endif
 
 #if DEBUG_NET_SERIAL
-WiFiServer debugServer(23);
-WiFiClient debugClient;
+// Log calls only queue the line; a background task writes it to Serial and
+// the telnet client (see NetSerial.h)
+NetSerial netSerial;
 unsigned long nextTouchLogMs = 0;
 
-static void debugBegin() {
-  debugServer.begin();
-  debugServer.setNoDelay(true);
-}
-
-static void debugAcceptClient() {
-  if (!debugClient || !debugClient.connected()) {
-    WiFiClient n = debugServer.available();
-    if (n) {
-      if (debugClient) debugClient.stop();
-      debugClient = n;
-      debugClient.setNoDelay(true);
-      Serial.println("NetSerial: client connected");
-    }
-  }
-}
+static void debugBegin() { netSerial.listen(); }
 
 static void debugPrint(const char* s) {
-  if (debugClient && debugClient.connected()) debugClient.print(s);
+  if (netSerial.clientConnected()) netSerial.print(NetSerial::TO_CLIENT, s);
 }
 
 static void debugPrintln(const char* s) {
-  if (debugClient && debugClient.connected()) {
-    debugClient.print(s);
-    debugClient.print("\r\n");
-  }
+  if (netSerial.clientConnected()) netSerial.print(NetSerial::TO_CLIENT, s, "\r\n");
 }
 
 static void debugPrintf(const char* fmt, ...) {
-  if (!(debugClient && debugClient.connected())) return;
-  char buf[256];
+  if (!netSerial.clientConnected()) return;
   va_list ap;
   va_start(ap, fmt);
-  vsnprintf(buf, sizeof(buf), fmt, ap);
+  netSerial.vprintf(NetSerial::TO_CLIENT, fmt, ap);
   va_end(ap);
-  debugClient.print(buf);
 }
 
-static void logBoth(const char* s) { Serial.print(s); debugPrint(s); }
-static void logBothLn(const char* s) { Serial.println(s); debugPrintln(s); }
+static void logBoth(const char* s) { netSerial.print(NetSerial::TO_BOTH, s); }
+static void logBothLn(const char* s) { netSerial.print(NetSerial::TO_BOTH, s, "\r\n"); }
+static void logBothF(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  netSerial.vprintf(NetSerial::TO_BOTH, fmt, ap);
+  va_end(ap);
+}
+#else
+static void logBoth(const char* s) { Serial.print(s); }
+static void logBothLn(const char* s) { Serial.println(s); }
 static void logBothF(const char* fmt, ...) {
   char buf[256];
   va_list ap;
@@ -64,7 +70,6 @@ static void logBothF(const char* fmt, ...) {
   vsnprintf(buf, sizeof(buf), fmt, ap);
   va_end(ap);
   Serial.print(buf);
-  if (debugClient && debugClient.connected()) debugClient.print(buf);
 }
 #endif
 
@@ -72,9 +77,19 @@ static void logBothF(const char* fmt, ...) {
 bool debugActive = false;
 #endif
 
+// Hot-path events (Trace.h): text lines, or binary records with TRACE_LOG=1
+TraceLog traceLog;
+static void traceOut(const uint8_t* data, size_t len) {
+#if DEBUG_NET_SERIAL
+  netSerial.write(NetSerial::TO_BOTH, data, len);
+#else
+  Serial.write(data, len);
+#endif
+}
+
 // Staff: ESP-NOW controller with 2 LED strands + 3 capacitive touch sensors
 // Uses "stole" LED count/config for both strands, broadcasts spells to receivers,
-// and exposes a 25s OTA window on boot with status indicators.
+// and serves OTA in the background whenever WiFi is connected.
 
 // ===================== OTA/WiFi Config =====================
 #define OTA_ENABLED 1
@@ -111,6 +126,9 @@ bool debugActive = false;
 #ifndef ESPNOW_CHANNEL
 #define ESPNOW_CHANNEL 1
 #endif
+// Channel the hidden SoftAP pins: the cached access point's if there is one
+// (WifiBringup.h), so receivers that cached it too hear us before WiFi is up
+uint8_t espnowChannel = ESPNOW_CHANNEL;
 
 // Capacitive touch pins (ESP32 touch-capable pins)
 // 2-pin layout: GPIO12 and GPIO14
@@ -132,7 +150,7 @@ bool debugActive = false;
 #define TOUCH_DELTA 10  // lowered threshold delta for more sensitive touch detection
 #endif
 
-// Built-in LED dim blink during OTA window (DISABLED: GPIO4 now used for touch)
+// Built-in LED dim glow during OTA updates (DISABLED: GPIO4 now used for touch)
 // #ifndef BUILTIN_LED_PIN
 // #define BUILTIN_LED_PIN 4
 // #endif
@@ -147,46 +165,81 @@ bool debugActive = false;
 #endif
 
 // ===================== Global State =====================
-uint8_t globalBrightness = 128;
-const uint8_t BRIGHTNESS_STEP = 16;
-
-// Background effect state (mirrors receivers for cohesion)
+// Background effect selection (mirrors receivers for cohesion)
 int currentEffect = 1;  // 0/4=off, 1=rainbow, 2=breathing
-int lastEffect = -1;
-int backgroundEffect = 0;
 
 // ===================== Simple 2-Button Spell UI =====================
 // Button 1 (Pad 0): Cycle effects (1->2->3->1)
 // Button 2 (Pad 1): Brightness up (spell 8)
 // Both buttons: Brightness down (spell 7)
 
-// Rainbow
-uint8_t rainbowHue = 0;
-unsigned long nextRainbowMs = 0;
-const unsigned long RAINBOW_INTERVAL_MS = 20;
-
-// Breathing
-uint8_t breathBrightness = 0;
-int8_t breathStep = 4;
-unsigned long nextBreathMs = 0;
-const unsigned long BREATH_INTERVAL_MS = 15;
-
-// Tempo control
-float tempoFactor = 1.0f;
-const float TEMPO_MIN = 0.25f;
-const float TEMPO_MAX = 4.0f;
-inline unsigned long tempoMs(unsigned long baseMs) {
-  float scaled = baseMs / tempoFactor;
-  if (scaled < 1.0f) scaled = 1.0f;
-  return (unsigned long)scaled;
-}
+// Outgoing wire format: 2 = SpellPacketV2 (seq, timestamp, params, CRC),
+// 1 = legacy 4-byte int for receivers that predate v2
+#ifndef SPELL_WIRE_VERSION
+#define SPELL_WIRE_VERSION 2
+#endif
 
-// ESP-NOW spell packet
+// ESP-NOW spell packet (v1 layout)
 typedef struct {
   int effect_id;
 } SpellPacket;
 
 SpellPacket spell;
+uint32_t spellSeq = 0;  // v2 sequence number (spells and beacons)
+
+// Clock master: receivers lock their animation clock to these beacons
+// (ClockSync.h). v1-only receivers would flash on every beacon, so they are
+// sent only with the v2 wire format.
+#ifndef SYNC_BEACON_INTERVAL_MS
+#define SYNC_BEACON_INTERVAL_MS 1000
+#endif
+unsigned long nextSyncBeaconMs = 0;
+
+// Absolute effect state (StateSync.h) so receivers that missed spells or
+// joined late converge within one interval. v2 wire format only, like beacons.
+#ifndef STATE_SYNC_INTERVAL_MS
+#define STATE_SYNC_INTERVAL_MS 1000
+#endif
+unsigned long nextStateSyncMs = 0;
+
+// Reliable mode: spells ask for ACKs and are retransmitted with backoff until
+// every receiver that has answered before confirms (ReliableLink.h). Only
+// enable once all receivers run a build that drops duplicates; older ones
+// would apply each retransmitted brightness/tempo step again.
+#ifndef RELIABLE_SPELLS
+#define RELIABLE_SPELLS 0
+#endif
+#if RELIABLE_SPELLS && SPELL_WIRE_VERSION < 2
+#error "RELIABLE_SPELLS needs SPELL_WIRE_VERSION 2"
+#endif
+#if RELIABLE_SPELLS
+ReliableSender<> reliable;
+AckQueue ackQueue;  // filled by onRecv, drained by loop()
+#endif
+uint32_t spellSendErrors = 0;  // esp_now_send() calls that failed outright
+LinkHealth linkHealth;  // send results, and with RELIABLE_SPELLS the ACK senders
+
+// Scheduled spells: each one names an instant SPELL_LEAD_MS after it is sent,
+// and the staff and every synced receiver apply it then, on the same frame.
+// Must cover radio latency plus one frame of the slowest receiver (25 fps).
+// 0 applies spells on arrival, as before.
+#ifndef SPELL_LEAD_MS
+#define SPELL_LEAD_MS 60
+#endif
+SpellSchedule<> localSpells;  // the staff's own copy of spells in flight
+
+// Pixel streaming: broadcast strand A's rendered frames (PixelStream.h) so
+// receivers show exactly what the staff shows instead of their own effects.
+// Fragments have their own seq counter, away from the spell dedupe window.
+#ifndef STREAM_FRAMES
+#define STREAM_FRAMES 0
+#endif
+#ifndef STREAM_FPS
+#define STREAM_FPS 30  // unchanged frames still go out, as one tiny delta fragment
+#endif
+#if STREAM_FRAMES && SPELL_WIRE_VERSION < 2
+#error "STREAM_FRAMES needs SPELL_WIRE_VERSION 2"
+#endif
 
 // Broadcast address (ff:ff:ff:ff:ff:ff)
 uint8_t broadcastAddress[] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
@@ -195,9 +248,71 @@ uint8_t broadcastAddress[] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
 CRGB ledsA[NUM_LEDS_STOLE];
 CRGB ledsB[NUM_LEDS_STOLE];
 
-// Packet send visual ack
-volatile bool packetFlash = false;
-unsigned long packetFlashUntil = 0;
+// Background effects, tempo and brightness live in the shared engine.
+// Only strand A is driven (strand B's pin is a touch pad).
+using StaffLayout = StrandLayout<NUM_LEDS_STOLE>;
+EffectEngine<StaffLayout> engine({ledsA});
+#if STREAM_FRAMES
+PixelStreamSender<NUM_LEDS_STOLE> pixelStream;
+uint32_t streamSeq = 0;
+uint32_t nextStreamUs = 0;
+uint32_t streamSendErrors = 0;
+#endif
+// show() runs on its own task so touch polling never waits on the wire
+AsyncShow ledOutput;
+
+// Frame rate target; loop() (touch polling included) runs once per frame
+#ifndef TARGET_FPS
+#define TARGET_FPS 60
+#endif
+FrameScheduler frameScheduler(TARGET_FPS);
+#if FRAME_PROFILE
+// Per loop(): the whole iteration up to the frame wait, the radio work
+// (beacons, state, retries) and the engine tick; show is in ledOutput
+TimingHistogram loopTimes;
+TimingHistogram radioTimes;
+TimingHistogram renderTimes;
+#endif
+
+// Periodic LED output report: frames, time on the wire, time the renderer
+// spent blocked waiting for it, and frames that missed their deadline
+#ifndef OUTPUT_STATS_INTERVAL_MS
+#define OUTPUT_STATS_INTERVAL_MS 10000
+#endif
+unsigned long nextOutputStatsMs = 0;
+
+static void reportOutputStats(AsyncShow& out, FrameScheduler& sched) {
+  unsigned long now = millis();
+  if ((long)(now - nextOutputStatsMs) < 0) return;
+  nextOutputStatsMs = now + OUTPUT_STATS_INTERVAL_MS;
+  AsyncShow::Stats st = out.takeInterval();
+  FrameScheduler::Stats fs = sched.takeInterval();
+  logBothF("LED output: %lu frames in %lu ms, show avg %lu us, blocked %lu us, late %lu/%lu (worst %lu us)\n",
+           (unsigned long)st.shows, (unsigned long)OUTPUT_STATS_INTERVAL_MS,
+           (unsigned long)(st.shows ? st.showUs / st.shows : 0), (unsigned long)st.blockedUs,
+           (unsigned long)fs.late, (unsigned long)fs.frames, (unsigned long)fs.worstLateUs);
+#if RELIABLE_SPELLS
+  ReliableSender<>::Stats rs = reliable.takeInterval();
+  if (rs.sent || rs.retries || rs.failed) {
+    logBothF("Spell delivery: %lu sent, %lu delivered (avg %lu us, max %lu us), %lu retries, %lu failed, %u peers\n",
+             (unsigned long)rs.sent, (unsigned long)rs.delivered,
+             (unsigned long)(rs.delivered ? rs.latencySumUs / rs.delivered : 0), (unsigned long)rs.latencyMaxUs,
+             (unsigned long)rs.retries, (unsigned long)rs.failed, reliable.peers());
+  }
+#endif
+#if STREAM_FRAMES
+  PixelStreamSender<NUM_LEDS_STOLE>::Stats ps = pixelStream.takeInterval();
+  logBothF("Pixel stream: %lu frames, %lu fragments, %lu bytes (%lu%% of raw), %lu send errors so far\n",
+           (unsigned long)ps.frames, (unsigned long)ps.fragments, (unsigned long)ps.bytes,
+           (unsigned long)(ps.rawBytes ? (uint64_t)ps.bytes * 100 / ps.rawBytes : 0),
+           (unsigned long)streamSendErrors);
+#endif
+  static uint32_t reportedSendErrors = 0;
+  if (spellSendErrors != reportedSendErrors) {
+    reportedSendErrors = spellSendErrors;
+    logBothF("ESP-NOW send errors so far: %lu\n", (unsigned long)reportedSendErrors);
+  }
+}
 
 // Touch state
 struct TouchChan {
@@ -212,6 +327,7 @@ TouchChan touchChans[2] = {
   {TOUCH_PIN_1, 0, 0, false, 0},
   {TOUCH_PIN_2, 0, 0, false, 0},
 };
+uint16_t touchDelta = TOUCH_DELTA;  // console "touch" changes it at runtime
 
 // Combo detection state
 const unsigned long HOLD_THRESHOLD_MS = 300;  // 0.3s to register as "hold"
@@ -231,68 +347,468 @@ static uint16_t sampleTouch(int pin, int samples) {
 }
 
 static void calibrateTouch() {
-  Serial.println("Calibrating capacitive touch baselines...");
-#if DEBUG_NET_SERIAL
-  debugPrintln("Calibrating capacitive touch baselines...");
-#endif
+  logBothLn("Calibrating capacitive touch baselines...");
   for (int i = 0; i < 2; ++i) {
     uint16_t base = sampleTouch(touchChans[i].pin, TOUCH_SAMPLES);
     touchChans[i].baseline = base;
-    uint16_t delta = (base > 1) ? (uint16_t)min((uint16_t)TOUCH_DELTA, (uint16_t)(base - 1)) : 0;
+    uint16_t delta = (base > 1) ? (uint16_t)min(touchDelta, (uint16_t)(base - 1)) : 0;
     uint16_t thr = (uint16_t)(base - delta);
     touchChans[i].threshold = thr;
     touchChans[i].pressed = false;
-    Serial.printf(" Touch pin %d: baseline=%u, threshold=%u\n", touchChans[i].pin, base, thr);
-#if DEBUG_NET_SERIAL
-    debugPrintf(" Touch pin %d: baseline=%u, threshold=%u\n", touchChans[i].pin, base, thr);
-#endif
+    logBothF(" Touch pin %d: baseline=%u, threshold=%u\n", touchChans[i].pin, base, thr);
   }
 }
 
-// ===================== OTA Window/Status =====================
+// ===================== OTA/Status =====================
 #if OTA_ENABLED
-const unsigned long OTA_WINDOW_MS = 25000;  // 25 seconds
-bool otaWindowActive = false;
-volatile bool otaInProgress = false;
-unsigned long otaWindowEndMs = 0;
-unsigned long otaVisualNextMs = 0;
-const unsigned long OTA_VISUAL_INTERVAL_MS = 30;
-uint8_t otaVisualHue = 160; // blue-ish
-uint16_t otaVisualPos = 0;  // index into NUM_LEDS_STOLE per strand
+WifiBringup wifiBringup;  // polled from loop() until it connects or times out
+OtaTask otaTask;          // ArduinoOTA for the whole uptime once WiFi is up
 
 bool builtinLedReady = false;
-unsigned long builtinLedNextToggleMs = 0;
-const unsigned long BUILTIN_LED_TOGGLE_MS = 300;
 #endif
 
 // ===================== ESP-NOW =====================
-static void sendSpell(int id) {
+// Apply a spell to the staff's own LEDs, exactly as the receivers do
+static void applyLocalSpell(const SpellEvent& ev) {
+  engine.applySpell(ev.spell);
+  if (ev.flags & SPELL_HAS_BRIGHTNESS) engine.setBrightness(ev.brightness);
+  if (ev.flags & SPELL_HAS_TEMPO) engine.setTempoQ16(ev.tempoQ16);
+  if (ev.spell == 7 || ev.spell == 8) logBothF("Brightness: %u/255\n", engine.brightness());
+  if (ev.flags & SPELL_HAS_TEMPO) logBothF("Tempo: %.2fx\n", engine.tempo());
+}
+
+// Broadcast a spell and apply it locally at its scheduled instant.
+// params: SpellParamFlags; brightness is the staff's current value, tempo is
+// tempoQ16 (the staff's own tempo changes only when the spell executes).
+static void sendSpell(int id, uint8_t params = 0, uint32_t tempoQ16 = 0) {
+  SpellEvent ev;
+#if SPELL_WIRE_VERSION >= 2
+  SpellPacketV2 pkt = {};
+  pkt.spell = (int16_t)id;
+  pkt.flags = params;
+  if (params & SPELL_HAS_BRIGHTNESS) pkt.brightness = engine.brightness();
+  if (params & SPELL_HAS_TEMPO) pkt.tempoQ16 = tempoQ16;
+#if SPELL_LEAD_MS > 0
+  pkt.flags |= SPELL_HAS_EXEC_AT;
+  pkt.leadMs = SPELL_LEAD_MS;
+#endif
+#if RELIABLE_SPELLS
+  pkt.flags |= SPELL_ACK_REQUESTED;
+#endif
+  sealSpellPacket(pkt, ++spellSeq, (uint64_t)esp_timer_get_time());
+  if (esp_now_send(broadcastAddress, (uint8_t *)&pkt, sizeof(pkt)) != ESP_OK) spellSendErrors++;
+#if RELIABLE_SPELLS
+  reliable.track(pkt, micros());  // a failed first send is simply retried
+#endif
+  decodeSpell((const uint8_t *)&pkt, sizeof(pkt), micros(), ev);  // local copy, same fields
+#else
   spell.effect_id = id;
   esp_now_send(broadcastAddress, (uint8_t *)&spell, sizeof(spell));
-  Serial.printf("Cast spell %d\n", id);
-#if DEBUG_NET_SERIAL
-  debugPrintf("Cast spell %d\n", id);
+  ev = {id, (uint32_t)micros(), 0, 0, tempoQ16, 0, 1, params, engine.brightness(), 0, 0};
 #endif
-  packetFlash = true;
-  packetFlashUntil = millis() + 120;
+  traceLog.record(TRACE_SPELL_CAST, id, spellSeq);
+  engine.flashPacket(micros());  // TX ack on LED 0
+  // micros() is the shared clock on the staff
+  if (!(ev.flags & SPELL_HAS_EXEC_AT) || !localSpells.add(ev, SpellSchedule<>::executeAt(ev), micros())) {
+    applyLocalSpell(ev);
+  }
 }
 
+// Console changes, applied by loop() before the next frame
+enum ConsoleOpCode : uint8_t {
+  CONSOLE_BRIGHTNESS,
+  CONSOLE_TEMPO,
+  CONSOLE_FPS,
+  CONSOLE_SPELL,
+  CONSOLE_TOUCH_DELTA,
+  CONSOLE_RECAL,
+};
+ConsoleQueue consoleOps;
+
+static void applyConsoleOps() {
+  ConsoleOp op;
+  while (consoleOps.pop(op)) {
+    switch (op.code) {
+      case CONSOLE_BRIGHTNESS:
+        engine.setBrightness((uint8_t)op.value);
+        logBothF("Console: brightness %u/255\n", engine.brightness());
+        break;
+      case CONSOLE_TEMPO:
+        engine.setTempoQ16((uint32_t)op.value);
+        logBothF("Console: tempo %.2fx\n", engine.tempo());
+        break;
+      case CONSOLE_FPS:
+        frameScheduler.setTargetFps((uint16_t)op.value);
+        logBothF("Console: %u fps\n", frameScheduler.targetFps());
+        break;
+      case CONSOLE_SPELL:
+        if (op.value >= 1 && op.value <= 4) currentEffect = op.value;
+        sendSpell(op.value);
+        break;
+      case CONSOLE_TOUCH_DELTA:
+        touchDelta = (uint16_t)op.value;
+        logBothF("Console: touch delta %u\n", touchDelta);
+        break;
+      case CONSOLE_RECAL:
+        calibrateTouch();
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Runs on the WiFi task once each frame has gone out (or failed to)
+static void onSent(const uint8_t* mac, esp_now_send_status_t status) {
+  linkHealth.onSent(status == ESP_NOW_SEND_SUCCESS);
+}
+
+#if RELIABLE_SPELLS
+void IRAM_ATTR onRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  // Runs on the WiFi task: only ACKs are expected here
+  AckEvent ack;
+  const uint32_t rxUs = micros();
+  const bool valid = decodeAck(mac, incomingData, len, rxUs, ack);
+  if (valid) ackQueue.push(ack);
+  linkHealth.onFrame(mac, incomingData, len, valid, rxUs / 1000);
+}
+
+// Apply queued ACKs and retransmit spells whose backoff expired
+static void serviceReliableSpells() {
+  AckEvent ack;
+  while (ackQueue.pop(ack)) reliable.onAck(ack);
+  while (const SpellPacketV2* pkt = reliable.due(micros())) {
+    if (esp_now_send(broadcastAddress, (const uint8_t *)pkt, sizeof(*pkt)) != ESP_OK) spellSendErrors++;
+  }
+}
+#endif
+
+// Staff clock beacon; micros() is the low half of the same esp_timer clock,
+// so the staff's own effects already run on the shared clock
+static void sendSyncBeacon() {
+#if SPELL_WIRE_VERSION >= 2
+  SyncBeacon beacon = {};
+  sealFrame(beacon, SPELL_MSG_SYNC, ++spellSeq, (uint64_t)esp_timer_get_time());
+  esp_now_send(broadcastAddress, (uint8_t *)&beacon, sizeof(beacon));
+#endif
+}
+
+#if STREAM_FRAMES
+// Broadcast the frame in ledsA at STREAM_FPS. Reads the buffer only, so it
+// may overlap the LED transfer started from the same frame.
+static void streamFrame() {
+  const uint32_t now = micros();
+  if ((int32_t)(now - nextStreamUs) < 0) return;
+  nextStreamUs = now + 1000000 / STREAM_FPS;
+  pixelStream.sendFrame(ledsA, NUM_LEDS_STOLE, (uint64_t)esp_timer_get_time(), streamSeq,
+                        [](const uint8_t* data, int len) {
+                          if (esp_now_send(broadcastAddress, data, len) != ESP_OK) streamSendErrors++;
+                        });
+}
+#endif
+
+// Broadcast the running effect state as of the last tick
+static void sendStateSync() {
+#if SPELL_WIRE_VERSION >= 2
+  StateSync frame = {};
+  fillStateSync(frame, engine.state());
+  sealFrame(frame, SPELL_MSG_STATE, ++spellSeq, (uint64_t)esp_timer_get_time());
+  if (esp_now_send(broadcastAddress, (uint8_t *)&frame, sizeof(frame)) != ESP_OK) spellSendErrors++;
+#endif
+}
 
 // ===================== Setup & Loop =====================
+#if OTA_ENABLED
+// WiFi associated (polled from loop): serve OTA and NetSerial from here on
+static void startOta() {
+  Serial.printf("WiFi connected for OTA after %lu ms (%s)\n", (unsigned long)wifiBringup.elapsedMs(),
+                wifiBringup.describe());
+  Serial.print("IP: ");
+  Serial.println(WiFi.localIP());
+  Serial.printf("WiFi channel: %d\n", WiFi.channel());
+  // The SoftAP, and with it ESP-NOW, moved to the access point's channel
+  espnowChannel = (uint8_t)WiFi.channel();
+  wifiBringup.save(espnowChannel);  // next boot: no scan
+  wifiBringup.holdChannel(espnowChannel);  // a lost access point must not move ESP-NOW
+
+  // Configure OTA
+  ArduinoOTA.setHostname(OTA_HOSTNAME);
+  ArduinoOTA.setPassword(OTA_PASSWORD);
+
+  ArduinoOTA.onStart([]() {
+    String type = (ArduinoOTA.getCommand() == U_FLASH) ? "sketch" : "filesystem";
+    Serial.println("Start updating " + type);
+    // Effects and touch ran until now; take the LEDs over for the progress bar
+    if (!otaTask.beginUpdate()) Serial.println("OTA: renderer did not park in time");
+    FastLED.clear();
+    FastLED.show();
+    // steady dim built-in LED during update
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 24);
+  });
+
+  ArduinoOTA.onEnd([]() {
+    Serial.println("\nEnd OTA");
+    // Brief green success flash across both strands
+    fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Green);
+    fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Green);
+    FastLED.show();
+    delay(200);
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
+  });
+
+  ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+    if (total == 0) return;
+    uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
+    static uint32_t lastPct = 101U;
+    if (pct != lastPct) {
+      lastPct = pct;
+      Serial.printf("OTA Progress: %u%%\r", pct);
+    }
+
+    // Visual OTA progress (blue bar fill across A then B)
+    const uint32_t totalLeds = (uint32_t)NUM_LEDS_STOLE * 2U;
+    uint32_t lit = ((uint64_t)progress * totalLeds) / total;
+
+    FastLED.clear();
+    CRGB onColor = CHSV(160, 255, engine.brightness());
+
+    uint32_t remaining = lit;
+    uint32_t cA = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
+    if (cA > 0) fill_solid(ledsA, (int)cA, onColor);
+    remaining = (remaining > (uint32_t)NUM_LEDS_STOLE) ? (remaining - (uint32_t)NUM_LEDS_STOLE) : 0;
+
+    uint32_t cB = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
+    if (cB > 0) fill_solid(ledsB, (int)cB, onColor);
+
+    FastLED.show();
+  });
+
+  ArduinoOTA.onError([](ota_error_t error) {
+    Serial.printf("OTA Error[%u]\n", error);
+    // Flash red on error
+    fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Red);
+    fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Red);
+    FastLED.show();
+    delay(1000);
+    FastLED.clear();
+    FastLED.show();
+    if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
+    engine.realign();  // full repaint over the progress bar
+    otaTask.endUpdate();
+  });
+
+  ArduinoOTA.begin();
+  Serial.println("OTA Ready");
+  Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
+  if (!otaTask.begin()) Serial.println("OTA task failed to start; OTA disabled");
+#if DEBUG_NET_SERIAL
+  if (!debugActive) {
+    debugBegin();
+    debugActive = true;
+    Serial.println("NetSerial: started on TCP port 23");
+  }
+#endif
+}
+
+// No access point within WIFI_CONNECT_TIMEOUT_MS
+static void onWifiFailed() {
+  Serial.printf("WiFi connection failed after %lu ms. OTA disabled; continuing with ESP-NOW only.\n",
+                (unsigned long)wifiBringup.elapsedMs());
+  // Stop the STA retrying (it hops channels) and pin the default channel again
+  WiFi.disconnect();
+  if (espnowChannel != ESPNOW_CHANNEL) {
+    espnowChannel = ESPNOW_CHANNEL;
+    WiFi.softAP("wr-sync", "", espnowChannel, 1 /* hidden */);
+  }
+  Serial.printf("ESP-NOW on channel %d\n", espnowChannel);
+}
+
+static void pollWifiBringup() {
+  switch (wifiBringup.poll()) {
+    case WIFI_BRINGUP_CONNECTED:
+      startOta();
+      break;
+    case WIFI_BRINGUP_FAILED:
+      onWifiFailed();
+      break;
+    case WIFI_BRINGUP_LOST:
+      Serial.printf("WiFi: access point lost; ESP-NOW stays on channel %d\n", espnowChannel);
+      break;
+    case WIFI_BRINGUP_RESTORED:
+      Serial.printf("WiFi: rejoined the access point on channel %d\n", espnowChannel);
+      break;
+    default:
+      break;
+  }
+}
+#endif
+
+#if DEBUG_NET_SERIAL
+// ===================== NetSerial console =====================
+// Console.h: reads answer right away, changes go through consoleOps
+static void consoleReply(const char* s) { debugPrint(s); }
+
+static void postConsoleOp(uint8_t code, int32_t value) {
+  if (!consoleOps.push({code, value})) consoleReply("Busy, try again\r\n");
+}
+
+static void cmdStats(const ConsoleArgs&) {
+  debugPrintf("Uptime %lu s, free heap %lu B\r\n", (unsigned long)(millis() / 1000), (unsigned long)ESP.getFreeHeap());
+  debugPrintf("Effect %d, brightness %u/255, tempo %.2fx\r\n", currentEffect, engine.brightness(), engine.tempo());
+  const FrameScheduler::Stats fs = frameScheduler.stats();
+  const AsyncShow::Stats st = ledOutput.stats();
+  debugPrintf("Frames %lu at %u fps target (%lu late), shows %lu (avg %lu us), blocked %lu ms\r\n",
+              (unsigned long)fs.frames, frameScheduler.targetFps(), (unsigned long)fs.late, (unsigned long)st.shows,
+              (unsigned long)(st.shows ? st.showUs / st.shows : 0), (unsigned long)(st.blockedUs / 1000));
+  debugPrintf("Spells: last seq %lu, %lu send errors, %u scheduled\r\n", (unsigned long)spellSeq,
+              (unsigned long)spellSendErrors, localSpells.pending());
+  for (int i = 0; i < 2; ++i) {
+    debugPrintf("Touch pin %d: baseline=%u, press at drop >= %u\r\n", touchChans[i].pin, touchChans[i].baseline,
+                touchDelta);
+  }
+#if OTA_ENABLED
+  debugPrintf("WiFi: %s, ESP-NOW channel %d, RSSI %d dBm\r\n", wifiBringup.describe(), espnowChannel,
+              WiFi.status() == WL_CONNECTED ? WiFi.RSSI() : 0);
+#endif
+  debugPrintf("Dropped log lines %lu, trace records %lu\r\n", (unsigned long)netSerial.dropped(),
+              (unsigned long)traceLog.dropped());
+}
+
+static void cmdLink(const ConsoleArgs&) {
+  debugPrintf("Sent %lu frames, %lu failed on air, %lu refused by esp_now_send\r\n", (unsigned long)linkHealth.sent(),
+              (unsigned long)linkHealth.sendFailed(), (unsigned long)spellSendErrors);
+  char line[128];
+  const uint32_t now = millis();
+  for (uint8_t i = 0; i < linkHealth.peers(); i++) {
+    if (linkHealth.format(line, sizeof(line), i, now) > 0) consoleReply(line);
+  }
+  if (linkHealth.others()) debugPrintf("%lu frames from untracked senders\r\n", (unsigned long)linkHealth.others());
+}
+
+#if FRAME_PROFILE
+static void replyHistogram(const TimingHistogram& h, const char* name) {
+  char line[64];
+  if (h.format(line, sizeof(line), name) > 0) consoleReply(line);
+}
+
+// Timing histograms since boot or the last "prof reset" (FrameProfile.h)
+static void cmdProf(const ConsoleArgs& args) {
+  if (args.argc > 1 && strcmp(args.argv[1], "reset") == 0) {
+    loopTimes.reset();
+    radioTimes.reset();
+    renderTimes.reset();
+    engine.kernelTimes().reset();
+    ledOutput.showTimes().reset();
+#if OTA_ENABLED
+    otaTask.handleTimes().reset();
+#endif
+    consoleReply("Profile: cleared\r\n");
+    return;
+  }
+  consoleReply(kProfileHeader);
+  replyHistogram(loopTimes, "loop");
+  replyHistogram(radioTimes, "radio");
+  replyHistogram(renderTimes, "render");
+  replyHistogram(engine.kernelTimes(), "kernel");
+  replyHistogram(ledOutput.showTimes(), "show");
+#if OTA_ENABLED
+  replyHistogram(otaTask.handleTimes(), "ota");
+#endif
+}
+#endif
+
+static void cmdBrightness(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 0, 255, v)) return consoleReply("Usage: brightness <0-255>\r\n");
+  postConsoleOp(CONSOLE_BRIGHTNESS, v);
+}
+
+static void cmdTempo(const ConsoleArgs& args) {
+  float v;
+  if (!args.toFloat(1, 0.25f, 4.0f, v)) return consoleReply("Usage: tempo <0.25-4.0>\r\n");
+  postConsoleOp(CONSOLE_TEMPO, (int32_t)(v * Q16_ONE));
+}
+
+static void cmdFps(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 1, 120, v)) return consoleReply("Usage: fps <1-120>\r\n");
+  postConsoleOp(CONSOLE_FPS, v);
+}
+
+static void cmdSpell(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 0, 255, v)) return consoleReply("Usage: spell <id>\r\n");
+  postConsoleOp(CONSOLE_SPELL, v);
+}
+
+static void cmdTouch(const ConsoleArgs& args) {
+  long v;
+  if (!args.toInt(1, 1, 200, v)) return consoleReply("Usage: touch <delta 1-200>\r\n");
+  postConsoleOp(CONSOLE_TOUCH_DELTA, v);
+}
+
+static void cmdRecal(const ConsoleArgs&) { postConsoleOp(CONSOLE_RECAL, 0); }
+
+// Pixels as last handed to the output; a frame that lands mid-dump may mix
+// two frames
+static void cmdDump(const ConsoleArgs& args) {
+  long strand, first = 0, count = 16;
+  if (!args.toInt(1, 0, FastLED.count() - 1, strand) || (args.argc > 2 && !args.toInt(2, 0, 65535, first)) ||
+      (args.argc > 3 && !args.toInt(3, 1, 256, count))) {
+    return consoleReply("Usage: dump <strand 0> [first] [count <= 256]\r\n");
+  }
+  CLEDController& c = FastLED[strand];
+  const CRGB* px = c.leds();
+  const long end = min((long)c.size(), first + count);
+  char line[NET_SERIAL_LINE];
+  for (long i = first; i < end; i += 16) {
+    int n = snprintf(line, sizeof(line), "%ld/%3ld:", strand, i);
+    for (long j = i; j < end && j < i + 16; j++) {
+      n += snprintf(line + n, sizeof(line) - n, " %02x%02x%02x", px[j].r, px[j].g, px[j].b);
+    }
+    snprintf(line + n, sizeof(line) - n, "\r\n");
+    consoleReply(line);
+  }
+}
+
+static const ConsoleCommand consoleCommands[] = {
+    {"stats", "stats: frames, spells, touch, WiFi", cmdStats},
+    {"link", "link: ESP-NOW send results; ACK senders with RELIABLE_SPELLS", cmdLink},
+#if FRAME_PROFILE
+    {"prof", "prof [reset]: timing histograms", cmdProf},
+#endif
+    {"brightness", "brightness <0-255>", cmdBrightness},
+    {"tempo", "tempo <0.25-4.0>", cmdTempo},
+    {"fps", "fps <1-120>: loop and touch polling rate", cmdFps},
+    {"spell", "spell <id>: cast, as if from the pads", cmdSpell},
+    {"touch", "touch <delta>: drop below baseline that counts as a press", cmdTouch},
+    {"recal", "recal: re-measure touch baselines (hands off the pads)", cmdRecal},
+    {"dump", "dump <strand 0> [first] [count]: pixels as RRGGBB", cmdDump},
+};
+
+static void onNetSerialLine(const char* line) { runConsoleLine(consoleCommands, line, consoleReply); }
+#endif
+
 void setup() {
   Serial.begin(115200);
   delay(50);
   Serial.println("ESP-NOW Staff (2 LED strands + 3 cap-touch + OTA)");
 #if DEBUG_NET_SERIAL
-  Serial.println("NetSerial: will start after OTA window (post-OTA).");
+  if (!netSerial.begin()) Serial.println("NetSerial: log task failed to start");
+  netSerial.onLine(onNetSerialLine);
+  Serial.println("NetSerial: telnet port opens once WiFi connects.");
 #endif
+  if (!traceLog.begin(traceOut)) Serial.println("Trace: task failed to start");
 
   // LEDs (Strand B disabled: GPIO14 used for touch pad 3)
   FastLED.addLeds<LED_TYPE, LED_PIN_A, COLOR_ORDER>(ledsA, NUM_LEDS_STOLE);
   // FastLED.addLeds<LED_TYPE, LED_PIN_B, COLOR_ORDER>(ledsB, NUM_LEDS_STOLE);
-  FastLED.setBrightness(globalBrightness);
+  FastLED.setBrightness(engine.brightness());
   FastLED.clear();
   FastLED.show();
+  if (!ledOutput.begin()) Serial.println("LED output task failed; using blocking show()");
   Serial.printf("Strand A: %d LEDs @ pin %d\n", NUM_LEDS_STOLE, LED_PIN_A);
   Serial.printf("Strand B: DISABLED (GPIO14 used for touch pad 3)\n");
 
@@ -302,11 +818,14 @@ void setup() {
   // ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
   builtinLedReady = false;
 
+#if OTA_ENABLED
+  if (uint8_t ch = wifiBringup.cachedEspNowChannel(WIFI_SSID)) espnowChannel = ch;
+#endif
   // WiFi/ESP-NOW: Start with SoftAP FIRST to pin channel (critical for ESP-NOW)
   WiFi.mode(WIFI_AP_STA);
   WiFi.setSleep(false);
   // Hidden SoftAP on fixed channel to pin radio for ESP-NOW (MUST be before esp_now_init)
-  WiFi.softAP("wr-sync", "", ESPNOW_CHANNEL, 1 /* hidden */);
+  WiFi.softAP("wr-sync", "", espnowChannel, 1 /* hidden */);
   delay(100);
   
   // Initialize ESP-NOW AFTER SoftAP is created
@@ -322,111 +841,20 @@ void setup() {
   if (esp_now_add_peer(&peerInfo) != ESP_OK) {
     Serial.println("Failed to add broadcast peer");
   }
-  Serial.printf("ESP-NOW initialized on channel %d\n", ESPNOW_CHANNEL);
+  esp_now_register_send_cb(onSent);
+#if RELIABLE_SPELLS
+  esp_now_register_recv_cb(onRecv);
+#if LINK_RSSI
+  if (!linkHealth.enableRssi()) Serial.println("Link health: no RSSI (promiscuous RX off)");
+#endif
+#endif
+  Serial.printf("ESP-NOW initialized on channel %d\n", espnowChannel);
 
 #if OTA_ENABLED
-  // Connect STA for OTA
-  Serial.println("Connecting to WiFi for OTA...");
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  int wifi_retry = 0;
-  while (WiFi.status() != WL_CONNECTED && wifi_retry < 20) {
-    delay(500);
-    Serial.print(".");
-    wifi_retry++;
-  }
-
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected for OTA");
-    Serial.print("IP: ");
-    Serial.println(WiFi.localIP());
-    Serial.printf("WiFi channel: %d\n", WiFi.channel());
-
-    // Configure OTA
-    ArduinoOTA.setHostname(OTA_HOSTNAME);
-    ArduinoOTA.setPassword(OTA_PASSWORD);
-
-    ArduinoOTA.onStart([]() {
-      String type = (ArduinoOTA.getCommand() == U_FLASH) ? "sketch" : "filesystem";
-      Serial.println("Start updating " + type);
-      otaInProgress = true;
-      backgroundEffect = 0;
-      FastLED.clear();
-      FastLED.show();
-      // steady dim built-in LED during update
-      if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 24);
-    });
-
-    ArduinoOTA.onEnd([]() {
-      Serial.println("\nEnd OTA");
-      // Brief green success flash across both strands
-      fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Green);
-      fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Green);
-      FastLED.show();
-      delay(200);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-      if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
-#if DEBUG_NET_SERIAL
-      if (!debugActive) {
-        debugBegin();
-        debugActive = true;
-        Serial.println("NetSerial: started on TCP port 23 (post-OTA end)");
-      }
-#endif
-    });
-
-    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-      if (total == 0) return;
-      uint32_t pct = (static_cast<uint32_t>(progress) * 100U) / static_cast<uint32_t>(total);
-      static uint32_t lastPct = 101U;
-      if (pct != lastPct) {
-        lastPct = pct;
-        Serial.printf("OTA Progress: %u%%\r", pct);
-      }
-
-      // Visual OTA progress (blue bar fill across A then B)
-      const uint32_t totalLeds = (uint32_t)NUM_LEDS_STOLE * 2U;
-      uint32_t lit = ((uint64_t)progress * totalLeds) / total;
-
-      FastLED.clear();
-      CRGB onColor = CHSV(160, 255, globalBrightness);
-
-      uint32_t remaining = lit;
-      uint32_t cA = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
-      if (cA > 0) fill_solid(ledsA, (int)cA, onColor);
-      remaining = (remaining > (uint32_t)NUM_LEDS_STOLE) ? (remaining - (uint32_t)NUM_LEDS_STOLE) : 0;
-
-      uint32_t cB = remaining > (uint32_t)NUM_LEDS_STOLE ? (uint32_t)NUM_LEDS_STOLE : remaining;
-      if (cB > 0) fill_solid(ledsB, (int)cB, onColor);
-
-      FastLED.show();
-    });
-
-    ArduinoOTA.onError([](ota_error_t error) {
-      Serial.printf("OTA Error[%u]\n", error);
-      // Flash red on error
-      fill_solid(ledsA, NUM_LEDS_STOLE, CRGB::Red);
-      fill_solid(ledsB, NUM_LEDS_STOLE, CRGB::Red);
-      FastLED.show();
-      delay(1000);
-      FastLED.clear();
-      FastLED.show();
-      otaInProgress = false;
-      if (builtinLedReady) ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
-    });
-
-    ArduinoOTA.begin();
-    Serial.println("OTA Ready");
-    Serial.printf("Hostname: %s\n", OTA_HOSTNAME);
-
-    // Start 25s OTA window
-    otaWindowActive = true;
-    otaWindowEndMs = millis() + OTA_WINDOW_MS;
-    Serial.printf("OTA upload window active for %lu ms\n", OTA_WINDOW_MS);
-  } else {
-    Serial.println("\nWiFi connection failed. OTA disabled; continuing with ESP-NOW only.");
-  }
+  // Connect STA for OTA without waiting: ESP-NOW is already up, and loop()
+  // picks up the result (pollWifiBringup)
+  Serial.println("Connecting to WiFi for OTA in the background...");
+  wifiBringup.begin(WIFI_SSID, WIFI_PASSWORD);
 #endif
 
   // Touch calibration
@@ -434,6 +862,7 @@ void setup() {
 
   // Start with visible background
   currentEffect = 1;
+  engine.applySpell(currentEffect);
   Serial.println("\n=== SIMPLE 2-BUTTON SPELL UI ===");
   Serial.println("Top Button: Cycle Effects (Rainbow -> Breathing -> Off)");
   Serial.println("Bottom Button: Tempo Up");
@@ -444,93 +873,40 @@ void setup() {
 }
 
 void loop() {
-#if DEBUG_NET_SERIAL
-  if (debugActive) debugAcceptClient();
-#endif
 #if OTA_ENABLED
-  // During the initial OTA window, handle OTA and show a status indicator.
-  if (otaWindowActive) {
-    ArduinoOTA.handle();
-
-    if (!otaInProgress) {
-      unsigned long now = millis();
-      if ((long)(now - otaVisualNextMs) >= 0) {
-        otaVisualNextMs = now + OTA_VISUAL_INTERVAL_MS;
-
-        // Render a colorful comet animation across both strands to indicate "upload mode"
-        FastLED.clear();
-
-        int head = otaVisualPos % NUM_LEDS_STOLE;
-        ledsA[head] = CHSV(otaVisualHue, 220, globalBrightness);
-        ledsB[head] = CHSV(otaVisualHue + 64, 220, globalBrightness);
-
-        if (NUM_LEDS_STOLE > 1) {
-          int t = (head + NUM_LEDS_STOLE - 1) % NUM_LEDS_STOLE;
-          ledsA[t] = CHSV(otaVisualHue, 220, globalBrightness / 4);
-          ledsB[t] = CHSV(otaVisualHue + 64, 220, globalBrightness / 4);
-        }
-
-        otaVisualPos = (otaVisualPos + 1) % NUM_LEDS_STOLE;
-        otaVisualHue++; // slowly cycle hues
-        FastLED.show();
-
-        // Dim pulsing built-in LED during OTA window (very low peak)
-        if (builtinLedReady) {
-          static uint8_t phase = 0; // 0..255
-          phase += 4; // pulse speed
-          uint8_t tri = (phase < 128) ? phase : (255 - phase); // 0..127 triangle wave
-          const uint8_t MAX_DUTY = 8; // very dim peak
-          uint8_t duty = (uint16_t)tri * MAX_DUTY / 127;
-          ledcWrite(LEDC_CHANNEL_BUILTIN, duty);
-        }
-      }
-    }
-
-    // Close OTA window after timeout (unless an OTA is currently active)
-    if ((long)(millis() - otaWindowEndMs) >= 0 && !otaInProgress) {
-      otaWindowActive = false;
-      FastLED.clear();
-      FastLED.show();
-      // Turn off built-in LED after OTA window closes
-      if (builtinLedReady) {
-        ledcWrite(LEDC_CHANNEL_BUILTIN, 0);
-      }
-      Serial.printf("OTA window closed; continuing normal staff operation on ESPNOW channel %d\n", ESPNOW_CHANNEL);
-#if DEBUG_NET_SERIAL
-      if (!debugActive) {
-        debugBegin();
-        debugActive = true;
-        Serial.println("NetSerial: started on TCP port 23 (post-OTA)");
-      }
+  pollWifiBringup();
+  // An update in flight owns the LEDs (OtaTask.h) once our last frame is
+  // off the wire
+  if (otaTask.updating()) {
+    if (!ledOutput.busy()) otaTask.park();
+    delay(10);
+    return;
+  }
 #endif
-    }
+  PROFILE_BEGIN(loopStart);
 
-    // While in OTA window, skip normal effect rendering
-    if (otaWindowActive) {
-      return;
-    }
+  PROFILE_BEGIN(radioStart);
+  if ((long)(millis() - nextSyncBeaconMs) >= 0) {
+    nextSyncBeaconMs = millis() + SYNC_BEACON_INTERVAL_MS;
+    sendSyncBeacon();
+  }
+  // Not while our own spells are pending: receivers would briefly adopt the
+  // state from before them
+  if ((long)(millis() - nextStateSyncMs) >= 0 && localSpells.pending() == 0) {
+    nextStateSyncMs = millis() + STATE_SYNC_INTERVAL_MS;
+    sendStateSync();
   }
+#if RELIABLE_SPELLS
+  serviceReliableSpells();
 #endif
+  PROFILE_END(radioTimes, radioStart);
 
   // Optional: Serial number input fallback (0-9 to send exact spell)
   if (Serial.available()) {
     char c = Serial.read();
     if (c >= '0' && c <= '9') {
       int id = c - '0';
-      if (id >= 1 && id <= 4) {
-        currentEffect = id;
-      }
-      if (id == 7) {
-        uint16_t b = globalBrightness;
-        if (b > BRIGHTNESS_STEP) b -= BRIGHTNESS_STEP; else b = 1;
-        globalBrightness = (uint8_t)b;
-        FastLED.setBrightness(globalBrightness);
-      } else if (id == 8) {
-        uint16_t b = globalBrightness;
-        b = (b + BRIGHTNESS_STEP > 255) ? 255 : (b + BRIGHTNESS_STEP);
-        globalBrightness = (uint8_t)b;
-        FastLED.setBrightness(globalBrightness);
-      }
+      if (id >= 1 && id <= 4) currentEffect = id;
       sendSpell(id);
     }
   }
@@ -545,8 +921,8 @@ void loop() {
   uint16_t base1 = touchChans[1].baseline;
   uint16_t drop0 = (val0 < base0) ? (base0 - val0) : 0;
   uint16_t drop1 = (val1 < base1) ? (base1 - val1) : 0;
-  bool isPressed0 = (drop0 >= TOUCH_DELTA);
-  bool isPressed1 = (drop1 >= TOUCH_DELTA);
+  bool isPressed0 = (drop0 >= touchDelta);
+  bool isPressed1 = (drop1 >= touchDelta);
   
   bool wasPressed0 = touchChans[0].pressed;
   bool wasPressed1 = touchChans[1].pressed;
@@ -559,21 +935,21 @@ void loop() {
   if (isPressed0 && !wasPressed0) {
     touchChans[0].pressStartMs = now;
     pad0_held = false;
-    Serial.printf("Pad 0 pressed at %lu ms\n", now);
+    traceLog.record(TRACE_PAD_PRESS, 0, now);
   }
   
   // Pad 1 press (rising edge)
   if (isPressed1 && !wasPressed1) {
     touchChans[1].pressStartMs = now;
     pad1_held = false;
-    Serial.printf("Pad 1 pressed at %lu ms\n", now);
+    traceLog.record(TRACE_PAD_PRESS, 1, now);
   }
   
   // Both pressed together (rising edge)
   if (bothPressed && !wasBothPressed) {
     bothPressStartMs = now;
     bothPressedTogether = true;
-    Serial.printf("Both pads pressed together at %lu ms\n", now);
+    traceLog.record(TRACE_PAD_BOTH_PRESS, now);
   }
   
   // ===== HOLD DETECTION (while pressed) =====
@@ -581,42 +957,32 @@ void loop() {
   // Pad 0 hold detection
   if (isPressed0 && !pad0_held && (now - touchChans[0].pressStartMs) >= HOLD_THRESHOLD_MS) {
     pad0_held = true;
-    Serial.printf("Pad 0 held (> %lu ms)\n", HOLD_THRESHOLD_MS);
+    traceLog.record(TRACE_PAD_HOLD, 0, HOLD_THRESHOLD_MS);
   }
   
   // Pad 1 hold detection
   if (isPressed1 && !pad1_held && (now - touchChans[1].pressStartMs) >= HOLD_THRESHOLD_MS) {
     pad1_held = true;
-    Serial.printf("Pad 1 held (> %lu ms)\n", HOLD_THRESHOLD_MS);
+    traceLog.record(TRACE_PAD_HOLD, 1, HOLD_THRESHOLD_MS);
   }
   
   // ===== COMBO ACTIONS =====
   
   // Hold Pad 0 + Tap Pad 1 (Pad 1 release while Pad 0 still held)
   if (!isPressed1 && wasPressed1 && isPressed0 && pad0_held && !pad1_held) {
-    Serial.println("COMBO: Hold Top + Tap Bottom -> Brightness Down");
-    uint16_t b = globalBrightness;
-    if (b > BRIGHTNESS_STEP) b -= BRIGHTNESS_STEP; else b = 1;
-    globalBrightness = (uint8_t)b;
-    FastLED.setBrightness(globalBrightness);
+    traceLog.record(TRACE_COMBO_DIM);
     sendSpell(7);  // Brightness down
-    Serial.printf("Brightness: %u/255\n", globalBrightness);
   }
   
   // Hold Pad 1 + Tap Pad 0 (Pad 0 release while Pad 1 still held)
   if (!isPressed0 && wasPressed0 && isPressed1 && pad1_held && !pad0_held) {
-    Serial.println("COMBO: Hold Bottom + Tap Top -> Brightness Up");
-    uint16_t b = globalBrightness;
-    b = (b + BRIGHTNESS_STEP > 255) ? 255 : (b + BRIGHTNESS_STEP);
-    globalBrightness = (uint8_t)b;
-    FastLED.setBrightness(globalBrightness);
+    traceLog.record(TRACE_COMBO_BRIGHTEN);
     sendSpell(8);  // Brightness up
-    Serial.printf("Brightness: %u/255\n", globalBrightness);
   }
   
   // Both held > 0.4s (while both still pressed)
   if (bothPressed && bothPressedTogether && (now - bothPressStartMs) >= BOTH_HOLD_THRESHOLD_MS) {
-    Serial.println("COMBO: Both held > 0.4s -> Shoot Animation");
+    traceLog.record(TRACE_COMBO_SHOOT);
     sendSpell(12);  // One-shot shoot animation
     bothPressedTogether = false;  // Prevent repeated triggers
   }
@@ -626,26 +992,19 @@ void loop() {
   if (!bothPressed) {
     // Pad 0 tap (release while not held, and pad 1 not pressed)
     if (!isPressed0 && wasPressed0 && !pad0_held && !isPressed1) {
-      Serial.println("TAP: Top Button -> Cycle Effect");
       currentEffect++;
       if (currentEffect > 3) currentEffect = 1;
+      traceLog.record(TRACE_TAP_TOP, currentEffect);
       sendSpell(currentEffect);
-      const char* effectNames[] = {"", "Rainbow", "Breathing", "Off"};
-      Serial.printf("Effect: %s\n", effectNames[currentEffect]);
     }
     
     // Pad 1 tap (release while not held, and pad 0 not pressed)
     if (!isPressed1 && wasPressed1 && !pad1_held && !isPressed0) {
-      Serial.println("TAP: Bottom Button -> Toggle Tempo");
       static bool tempoFast = false;
-      if (tempoFast) {
-        tempoFactor = 1.0f;  // normal speed
-      } else {
-        tempoFactor = 2.0f;  // fast mode
-      }
       tempoFast = !tempoFast;
-      sendSpell(10);  // Tempo toggle
-      Serial.printf("Tempo toggled: %.2fx\n", tempoFactor);
+      traceLog.record(TRACE_TAP_BOTTOM, tempoFast);
+      // Tempo toggle, carrying the new tempo: fast mode or normal speed
+      sendSpell(10, SPELL_HAS_TEMPO, tempoFast ? 2 * Q16_ONE : Q16_ONE);
     }
   }
   
@@ -653,18 +1012,18 @@ void loop() {
   
   // Pad 0 release (falling edge)
   if (!isPressed0 && wasPressed0) {
-    Serial.printf("Pad 0 released (held: %s)\n", pad0_held ? "yes" : "no");
+    traceLog.record(TRACE_PAD_RELEASE, 0, pad0_held);
   }
   
   // Pad 1 release (falling edge)
   if (!isPressed1 && wasPressed1) {
-    Serial.printf("Pad 1 released (held: %s)\n", pad1_held ? "yes" : "no");
+    traceLog.record(TRACE_PAD_RELEASE, 1, pad1_held);
   }
   
   // Both released (falling edge)
   if (!bothPressed && wasBothPressed) {
     bothPressedTogether = false;
-    Serial.println("Both pads released");
+    traceLog.record(TRACE_PAD_BOTH_RELEASE);
   }
   
   // Update state
@@ -679,108 +1038,32 @@ void loop() {
     uint16_t v1 = touchRead(touchChans[1].pin);
     uint16_t d0 = (v0 < touchChans[0].baseline) ? (touchChans[0].baseline - v0) : 0;
     uint16_t d1 = (v1 < touchChans[1].baseline) ? (touchChans[1].baseline - v1) : 0;
-    logBothF("T1 pin=%d val=%u drop=%u base=%u | T2 pin=%d val=%u drop=%u base=%u (thrDelta=%d)\r\n",
-      touchChans[0].pin, v0, d0, touchChans[0].baseline,
-      touchChans[1].pin, v1, d1, touchChans[1].baseline,
-      (int)TOUCH_DELTA
-    );
-  }
-#endif
-
-  // Detect effect changes and reset state
-  if (lastEffect != currentEffect) {
-    lastEffect = currentEffect;
-    switch (currentEffect) {
-      case 0:
-      case 4:
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      case 1:
-        backgroundEffect = 1;
-        rainbowHue = 0;
-        nextRainbowMs = millis();
-        break;
-      case 2:
-        backgroundEffect = 2;
-        breathBrightness = globalBrightness / 10;
-        breathStep = abs(breathStep);
-        nextBreathMs = millis();
-        break;
-      case 3:
-        backgroundEffect = 0;
-        FastLED.clear();
-        FastLED.show();
-        break;
-      default:
-        break;
-    }
+    traceLog.record(TRACE_TOUCH_SAMPLE, touchChans[0].pin, v0, d0, touchChans[0].baseline);
+    traceLog.record(TRACE_TOUCH_SAMPLE, touchChans[1].pin, v1, d1, touchChans[1].baseline);
   }
+#endif
 
-  // Render background effect (reuse 'now' from touch handling above)
-
-  switch (backgroundEffect) {
-    case 0: {
-      // Off
-    } break;
-
-    case 1: {
-      if ((long)(now - nextRainbowMs) >= 0) {
-        nextRainbowMs = now + tempoMs(RAINBOW_INTERVAL_MS);
-        for (int i = 0; i < NUM_LEDS_STOLE; i++) {
-          uint8_t hue = rainbowHue + (i * 256 / NUM_LEDS_STOLE);
-          ledsA[i] = CHSV(hue, 255, globalBrightness);
-          ledsB[i] = CHSV(hue, 255, globalBrightness);
-        }
-        rainbowHue += 1;
-      }
-    } break;
-
-    case 2: {
-      if ((long)(now - nextBreathMs) >= 0) {
-        nextBreathMs = now + tempoMs(BREATH_INTERVAL_MS);
-        uint8_t maxBreath = globalBrightness;
-        uint8_t minBreath = globalBrightness / 10;
-
-        int16_t b = (int16_t)breathBrightness + breathStep;
-        if (b >= maxBreath) {
-          b = maxBreath;
-          breathStep = -breathStep;
-        } else if (b <= minBreath) {
-          b = minBreath;
-          breathStep = -breathStep;
-        }
-        breathBrightness = (uint8_t)b;
-
-        for (int i = 0; i < NUM_LEDS_STOLE; i++) {
-          uint8_t hue = rainbowHue + (i * 256 / NUM_LEDS_STOLE);
-          ledsA[i] = CHSV(hue, 255, breathBrightness);
-          ledsB[i] = CHSV(hue, 255, breathBrightness);
-        }
-        rainbowHue += 1;
-      }
-    } break;
-
-
-    default:
-      backgroundEffect = 0;
-      break;
+  applyConsoleOps();
+
+  // Our own scheduled spells, on the same instant as the receivers
+  SpellEvent due;
+  while (localSpells.popDue(micros(), due)) applyLocalSpell(due);
+
+  // Render background effect plus the TX-ack overlay. The buffer is read while
+  // a transfer is in flight, so skip the tick until it is done; the
+  // time-based animation clock catches up on the next one.
+  if (!ledOutput.busy()) {
+    PROFILE_BEGIN(tickStart);
+    engine.tick(micros());
+    PROFILE_END(renderTimes, tickStart);
+    if (engine.takeDirty()) ledOutput.start();  // returns immediately
+#if STREAM_FRAMES
+    streamFrame();
+#endif
   }
+  reportOutputStats(ledOutput, frameScheduler);
+  PROFILE_END(loopTimes, loopStart);
 
-  // Show frame for background effects and/or packet flash overlay
-  if (currentEffect >= 0 && currentEffect <= 4) {
-    // Overlay short green pixel as TX ack at LED 0
-    if (packetFlash) {
-      if ((long)(millis() - packetFlashUntil) < 0) {
-        ledsA[0] = CRGB::Green;
-        ledsA[0].nscale8(globalBrightness);
-        ledsB[0] = CRGB::Green;
-        ledsB[0].nscale8(globalBrightness);
-      } else {
-        packetFlash = false;
-      }
-    }
-    FastLED.show();
-  }
+  // Sleep until the next frame deadline instead of spinning
+  frameScheduler.wait();
 }
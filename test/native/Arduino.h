@@ -0,0 +1,20 @@
+#pragma once
+
+// Just enough of the Arduino core for the portable WizardFx headers to build
+// in the native test env. Time only moves when a test sets testMillis.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+#define IRAM_ATTR
+
+inline unsigned long testMillis = 0;
+
+inline unsigned long millis() { return testMillis; }
+inline unsigned long micros() { return testMillis * 1000; }
@@ -0,0 +1,20 @@
+#pragma once
+
+// The part of FastLED's CRGB the stream codec uses: three packed bytes,
+// compared by value.
+
+#include <stdint.h>
+
+struct CRGB {
+  uint8_t r = 0;
+  uint8_t g = 0;
+  uint8_t b = 0;
+
+  CRGB() = default;
+  CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+
+  bool operator==(const CRGB& o) const { return r == o.r && g == o.g && b == o.b; }
+  bool operator!=(const CRGB& o) const { return !(*this == o); }
+};
+
+static_assert(sizeof(CRGB) == 3, "CRGB is copied as raw RGB bytes");
@@ -0,0 +1,52 @@
+#pragma once
+
+// A fake ESP-NOW driver for sendSpellAck (ReliableLink.h): a peer table and
+// the last frame sent. Tests reset it with testEspNowReset().
+
+#include <string.h>
+
+#include "esp_wifi.h"
+
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
+
+struct esp_now_peer_info_t {
+  uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+  uint8_t channel;
+  bool encrypt;
+};
+
+struct TestEspNow {
+  uint8_t peers[8][ESP_NOW_ETH_ALEN];
+  int peerCount;
+  uint8_t sentTo[ESP_NOW_ETH_ALEN];
+  uint8_t sent[ESP_NOW_MAX_DATA_LEN];
+  int sentLen;
+  int sends;
+};
+
+inline TestEspNow testEspNow = {};
+
+inline void testEspNowReset() { testEspNow = {}; }
+
+inline bool esp_now_is_peer_exist(const uint8_t* mac) {
+  for (int i = 0; i < testEspNow.peerCount; i++) {
+    if (memcmp(testEspNow.peers[i], mac, ESP_NOW_ETH_ALEN) == 0) return true;
+  }
+  return false;
+}
+
+inline esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer) {
+  if (testEspNow.peerCount == 8) return ESP_FAIL;
+  memcpy(testEspNow.peers[testEspNow.peerCount++], peer->peer_addr, ESP_NOW_ETH_ALEN);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_now_send(const uint8_t* mac, const uint8_t* data, size_t len) {
+  if (len > ESP_NOW_MAX_DATA_LEN) return ESP_FAIL;
+  memcpy(testEspNow.sentTo, mac, ESP_NOW_ETH_ALEN);
+  memcpy(testEspNow.sent, data, len);
+  testEspNow.sentLen = (int)len;
+  testEspNow.sends++;
+  return ESP_OK;
+}
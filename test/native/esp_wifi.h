@@ -0,0 +1,11 @@
+#pragma once
+
+// LinkHealth.h includes esp_wifi.h for its LINK_RSSI=1 promiscuous path only;
+// the native tests build with LINK_RSSI=0 and need just the error type.
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
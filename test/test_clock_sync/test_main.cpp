@@ -0,0 +1,117 @@
+// Shared clock (ClockSync.h): beacon decoding, the first anchor, the
+// offset/drift loop converging under latency jitter, and re-anchoring.
+
+#include <ClockSync.h>
+#include <unity.h>
+
+static constexpr uint64_t BEACON_US = 1000000;  // SYNC_BEACON_INTERVAL_MS on the staff
+
+void setUp() {}
+void tearDown() {}
+
+// Staff clock for a receiver clock value: a fixed offset and a rate error
+static uint64_t master(uint64_t localUs, int64_t offsetUs, int64_t ppb) {
+  return (uint64_t)((int64_t)localUs + offsetUs + (int64_t)localUs * ppb / 1000000000LL);
+}
+
+// Deterministic radio latency jitter, 0..jitterUs
+static uint64_t jitter(uint32_t& x, uint32_t jitterUs) {
+  x = x * 1664525u + 1013904223u;
+  return jitterUs ? (x >> 8) % (jitterUs + 1) : 0;
+}
+
+// Feed n beacons, one per BEACON_US from startUs; returns the local time after the last
+static uint64_t run(ClockSync& c, uint64_t startUs, int n, int64_t offsetUs, int64_t ppb, uint32_t jitterUs) {
+  uint32_t x = 99;
+  uint64_t local = startUs;
+  for (int i = 0; i < n; i++) {
+    const uint64_t sent = local - jitter(x, jitterUs);  // stamped before the radio delay
+    c.addSample({master(sent, offsetUs, ppb), local});
+    local += BEACON_US;
+  }
+  return local;
+}
+
+static void test_decode_sync_beacon() {
+  SyncBeacon b = {};
+  sealFrame(b, SPELL_MSG_SYNC, 3, 0x123456789AULL);
+  ClockSample s = {1, 2};
+  TEST_ASSERT_TRUE(decodeSync(reinterpret_cast<const uint8_t*>(&b), sizeof(b), 777, s));
+  TEST_ASSERT_TRUE(s.masterUs == 0x123456789AULL);
+  TEST_ASSERT_TRUE(s.localUs == 777);
+
+  // A spell is not a beacon, and a rejected frame leaves the sample alone
+  SpellPacketV2 p = {};
+  sealSpellPacket(p, 4, 5);
+  TEST_ASSERT_FALSE(decodeSync(reinterpret_cast<const uint8_t*>(&p), sizeof(p), 888, s));
+  b.crc ^= 1;
+  TEST_ASSERT_FALSE(decodeSync(reinterpret_cast<const uint8_t*>(&b), sizeof(b), 888, s));
+  TEST_ASSERT_TRUE(s.localUs == 777);
+}
+
+static void test_first_beacon_anchors() {
+  ClockSync c;
+  TEST_ASSERT_FALSE(c.synced());
+  TEST_ASSERT_TRUE(c.toShared(5000) == 5000);  // local clock until the first beacon
+
+  TEST_ASSERT_TRUE(c.addSample({10000000, 4000000}));
+  TEST_ASSERT_TRUE(c.synced());
+  TEST_ASSERT_EQUAL_UINT32(0, c.steps());
+  TEST_ASSERT_TRUE(c.offsetUs(4000000) == 6000000);
+  TEST_ASSERT_TRUE(c.toShared(4500000) == 10500000);
+}
+
+static void test_offset_and_drift_converge() {
+  // Staff 2.5 s ahead and 80 ppm fast, up to 400 us of latency jitter
+  const int64_t offset = 2500000, ppb = 80000;
+  ClockSync c;
+  const uint64_t end = run(c, 3000000, 300, offset, ppb, 400);
+  TEST_ASSERT_EQUAL_UINT32(300, c.beacons());
+  TEST_ASSERT_EQUAL_UINT32(0, c.steps());
+  TEST_ASSERT_TRUE(c.driftPpb() > ppb - 10000 && c.driftPpb() < ppb + 10000);
+
+  // Prediction between beacons stays within the jitter band
+  for (uint64_t t = end; t < end + BEACON_US; t += 100000) {
+    const int64_t err = (int64_t)(c.toShared(t) - master(t, offset, ppb));
+    TEST_ASSERT_TRUE(err > -600 && err < 200);
+  }
+}
+
+static void test_drift_is_clamped() {
+  // Out of crystal spec: the estimate stops at MAX_DRIFT_PPB rather than chasing it
+  ClockSync c;
+  run(c, 0, 100, 0, 500000, 0);
+  TEST_ASSERT_EQUAL_INT32(ClockSync::MAX_DRIFT_PPB, c.driftPpb());
+  TEST_ASSERT_EQUAL_UINT32(0, c.steps());
+}
+
+static void test_large_error_reanchors() {
+  ClockSync c;
+  const uint64_t local = run(c, 0, 20, 1000000, 0, 0);
+  TEST_ASSERT_EQUAL_UINT32(0, c.steps());
+
+  // Staff reboot: its clock starts over near zero
+  TEST_ASSERT_TRUE(c.addSample({50000, local}));
+  TEST_ASSERT_EQUAL_UINT32(1, c.steps());
+  TEST_ASSERT_TRUE(c.toShared(local) == 50000);
+
+  // Just inside the threshold is corrected, not stepped
+  const uint64_t next = local + BEACON_US;
+  TEST_ASSERT_FALSE(c.addSample({50000 + BEACON_US + ClockSync::STEP_THRESHOLD_US, next}));
+  TEST_ASSERT_EQUAL_INT32(ClockSync::STEP_THRESHOLD_US, c.lastErrorUs());
+  TEST_ASSERT_EQUAL_UINT32(1, c.steps());
+
+  // A beacon stamped no later than the reference cannot be extrapolated
+  TEST_ASSERT_TRUE(c.addSample({60000 + BEACON_US, next}));
+  TEST_ASSERT_EQUAL_UINT32(2, c.steps());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_decode_sync_beacon);
+  RUN_TEST(test_first_beacon_anchors);
+  RUN_TEST(test_offset_and_drift_converge);
+  RUN_TEST(test_drift_is_clamped);
+  RUN_TEST(test_large_error_reanchors);
+  return UNITY_END();
+}
@@ -0,0 +1,238 @@
+// sACN and Art-Net parsing (DmxInput.h): well-formed data and sync packets,
+// then truncated and inconsistent ones, then a frame through DmxInput.
+
+#include <DmxInput.h>
+#include <unity.h>
+
+#include <vector>
+
+using Packet = std::vector<uint8_t>;
+
+void setUp() {}
+void tearDown() {}
+
+static void put16(Packet& d, size_t at, uint16_t v) {
+  d[at] = (uint8_t)(v >> 8);
+  d[at + 1] = (uint8_t)v;
+}
+
+static void put32(Packet& d, size_t at, uint32_t v) {
+  put16(d, at, (uint16_t)(v >> 16));
+  put16(d, at + 2, (uint16_t)v);
+}
+
+static void putRootLayer(Packet& d, uint32_t vector) {
+  put16(d, 0, 0x0010);
+  put16(d, 2, 0);
+  memcpy(&d[4], dmxwire::ACN_ID, sizeof(dmxwire::ACN_ID));
+  put32(d, 18, vector);
+}
+
+// E1.31 data packet carrying `slots` bytes after the start code
+static Packet sacnData(uint16_t universe, uint8_t seq, uint16_t slots, uint8_t fill = 0x11) {
+  Packet d(dmxwire::SACN_SLOTS_AT + slots, 0);
+  putRootLayer(d, dmxwire::VECTOR_ROOT_DATA);
+  put32(d, 40, dmxwire::VECTOR_FRAMING_DATA);
+  d[111] = seq;
+  put16(d, 113, universe);
+  d[117] = 0x02;
+  d[118] = 0xA1;
+  put16(d, 123, (uint16_t)(slots + 1));
+  for (uint16_t i = 0; i < slots; i++) d[dmxwire::SACN_SLOTS_AT + i] = (uint8_t)(fill + i);
+  return d;
+}
+
+static Packet sacnSync(uint16_t syncAddress, uint8_t seq) {
+  Packet d(dmxwire::SACN_SYNC_LEN, 0);
+  putRootLayer(d, dmxwire::VECTOR_ROOT_EXTENDED);
+  put32(d, 40, dmxwire::VECTOR_FRAMING_SYNC);
+  d[44] = seq;
+  put16(d, 45, syncAddress);
+  return d;
+}
+
+static Packet artnet(uint16_t op, size_t len) {
+  Packet d(len, 0);
+  memcpy(&d[0], dmxwire::ARTNET_ID, sizeof(dmxwire::ARTNET_ID));
+  d[8] = (uint8_t)op;
+  d[9] = (uint8_t)(op >> 8);
+  return d;
+}
+
+static Packet artDmx(uint16_t universe, uint8_t seq, uint16_t slots, uint8_t fill = 0x22) {
+  Packet d = artnet(dmxwire::OP_DMX, dmxwire::ARTDMX_HEADER + slots);
+  d[12] = seq;
+  d[14] = (uint8_t)universe;
+  d[15] = (uint8_t)(universe >> 8);
+  put16(d, 16, slots);
+  for (uint16_t i = 0; i < slots; i++) d[dmxwire::ARTDMX_HEADER + i] = (uint8_t)(fill + i);
+  return d;
+}
+
+static DmxPacketKind parse(const Packet& d, DmxPacket& p, size_t len) { return parseDmxPacket(d.data(), len, p); }
+static DmxPacketKind parse(const Packet& d, DmxPacket& p) { return parse(d, p, d.size()); }
+
+static void test_sacn_data() {
+  Packet d = sacnData(7, 200, 510);
+  put16(d, 109, 42);
+  DmxPacket p;
+  TEST_ASSERT_EQUAL(DMX_DATA, parse(d, p));
+  TEST_ASSERT_EQUAL(DMX_SACN, p.protocol);
+  TEST_ASSERT_EQUAL_UINT16(7, p.universe);
+  TEST_ASSERT_EQUAL_UINT16(42, p.syncAddress);
+  TEST_ASSERT_EQUAL_UINT8(200, p.sequence);
+  TEST_ASSERT_FALSE(p.preview);
+  TEST_ASSERT_FALSE(p.terminated);
+  TEST_ASSERT_EQUAL_UINT16(510, p.slotCount);
+  TEST_ASSERT_TRUE(p.slots == d.data() + dmxwire::SACN_SLOTS_AT);
+
+  d[112] = 0x80 | 0x40;
+  TEST_ASSERT_EQUAL(DMX_DATA, parse(d, p));
+  TEST_ASSERT_TRUE(p.preview);
+  TEST_ASSERT_TRUE(p.terminated);
+
+  // A trailing byte past the slot count is tolerated; slots stay as declared
+  d.push_back(0);
+  TEST_ASSERT_EQUAL(DMX_DATA, parse(d, p));
+  TEST_ASSERT_EQUAL_UINT16(510, p.slotCount);
+}
+
+static void test_sacn_sync() {
+  const Packet d = sacnSync(42, 9);
+  DmxPacket p;
+  TEST_ASSERT_EQUAL(DMX_SYNC, parse(d, p));
+  TEST_ASSERT_EQUAL(DMX_SACN, p.protocol);
+  TEST_ASSERT_EQUAL_UINT16(42, p.universe);
+  TEST_ASSERT_EQUAL_UINT8(9, p.sequence);
+}
+
+static void test_sacn_rejects_bad_lengths() {
+  DmxPacket p;
+  const Packet d = sacnData(1, 0, 510);
+  for (size_t len = 0; len < d.size(); len++) TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p, len));
+
+  const Packet s = sacnSync(1, 0);
+  for (size_t len = 0; len < s.size(); len++) TEST_ASSERT_EQUAL(DMX_NONE, parse(s, p, len));
+
+  Packet c = sacnData(1, 0, 3);
+  put16(c, 123, 0);  // no start code
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(c, p));
+  put16(c, 123, 5);  // claims more slots than the datagram holds
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(c, p));
+
+  Packet big = sacnData(1, 0, 513);  // one slot over DMX512
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(big, p));
+}
+
+static void test_sacn_rejects_malformed() {
+  DmxPacket p;
+  const Packet good = sacnData(1, 0, 3);
+  Packet d = good;
+  d[4] = 'X';  // ACN packet identifier
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+  d = good;
+  put32(d, 18, 0x7);  // root vector
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+  d = good;
+  put32(d, 40, dmxwire::VECTOR_FRAMING_SYNC);  // sync framing under a data root
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+  d = good;
+  d[118] = 0xA0;  // DMP address type
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+  d = good;
+  d[125] = 0xDD;  // per-address priority start code
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+  d = good;
+  put16(d, 113, 0);  // universe 0 is reserved
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+}
+
+static void test_artnet_data_and_sync() {
+  const Packet d = artDmx(0x1234, 5, 512);
+  DmxPacket p;
+  TEST_ASSERT_EQUAL(DMX_DATA, parse(d, p));
+  TEST_ASSERT_EQUAL(DMX_ARTNET, p.protocol);
+  TEST_ASSERT_EQUAL_UINT16(0x1234, p.universe);
+  TEST_ASSERT_EQUAL_UINT8(5, p.sequence);
+  TEST_ASSERT_EQUAL_UINT16(512, p.slotCount);
+  TEST_ASSERT_TRUE(p.slots == d.data() + dmxwire::ARTDMX_HEADER);
+
+  Packet high = artDmx(0x1234, 5, 2);
+  high[15] |= 0x80;  // bit 15 is not part of the port-address
+  TEST_ASSERT_EQUAL(DMX_DATA, parse(high, p));
+  TEST_ASSERT_EQUAL_UINT16(0x1234, p.universe);
+
+  const Packet s = artnet(dmxwire::OP_SYNC, 14);
+  TEST_ASSERT_EQUAL(DMX_SYNC, parse(s, p));
+  TEST_ASSERT_EQUAL(DMX_ARTNET, p.protocol);
+
+  const Packet poll = artnet(0x2000, 14);  // ArtPoll: not ours
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(poll, p));
+}
+
+static void test_artnet_rejects_bad_lengths() {
+  DmxPacket p;
+  const Packet d = artDmx(1, 1, 12);
+  for (size_t len = 0; len < d.size(); len++) TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p, len));
+
+  const Packet s = artnet(dmxwire::OP_SYNC, 14);
+  for (size_t len = 0; len < s.size(); len++) TEST_ASSERT_EQUAL(DMX_NONE, parse(s, p, len));
+
+  Packet big = artDmx(1, 1, 514);
+  put16(big, 16, 514);  // over DMX512 even though the bytes are there
+  TEST_ASSERT_EQUAL(DMX_NONE, parse(big, p));
+}
+
+static void test_garbage_is_ignored() {
+  DmxPacket p;
+  Packet d(DMX_MAX_PACKET);
+  uint32_t x = 1;
+  for (int round = 0; round < 1000; round++) {
+    for (uint8_t& b : d) b = (uint8_t)((x = x * 1664525u + 1013904223u) >> 24);
+    TEST_ASSERT_EQUAL(DMX_NONE, parse(d, p));
+  }
+}
+
+static void test_input_publishes_complete_frames() {
+  // Two strands of 200 and 100 pixels: universes 1-2 and 3
+  static DmxInput<300, 4> in;
+  const uint16_t strands[] = {200, 100};
+  TEST_ASSERT_TRUE(in.begin(strands, 2, 1));
+  TEST_ASSERT_EQUAL_UINT8(3, in.universes());
+
+  Packet u1 = sacnData(1, 0, 510, 0x10);
+  Packet u2 = artDmx(2, 1, 90, 0x20);
+  Packet u3 = sacnData(3, 0, 300, 0x30);
+  TEST_ASSERT_FALSE(in.onPacket(u1.data(), u1.size(), 0));
+  TEST_ASSERT_FALSE(in.onPacket(u2.data(), u2.size(), 0));
+  TEST_ASSERT_TRUE(in.onPacket(u3.data(), u3.size(), 0));
+
+  bool fresh = false;
+  const uint8_t* f = in.frame(&fresh);
+  TEST_ASSERT_TRUE(fresh);
+  TEST_ASSERT_EQUAL_MEMORY(&u1[dmxwire::SACN_SLOTS_AT], f, 510);
+  TEST_ASSERT_EQUAL_MEMORY(&u2[dmxwire::ARTDMX_HEADER], f + 170 * 3, 90);
+  TEST_ASSERT_EQUAL_MEMORY(&u3[dmxwire::SACN_SLOTS_AT], f + 200 * 3, 300);
+  in.frame(&fresh);
+  TEST_ASSERT_FALSE(fresh);
+
+  // A straggler is dropped, a short datagram is ignored
+  TEST_ASSERT_FALSE(in.onPacket(u1.data(), u1.size(), 1));
+  TEST_ASSERT_EQUAL_UINT32(1, in.universeStats(0).outOfOrder);
+  TEST_ASSERT_FALSE(in.onPacket(u1.data(), 100, 1));
+  TEST_ASSERT_EQUAL_UINT32(1, in.stats().ignored);
+  TEST_ASSERT_EQUAL_UINT32(1, in.stats().frames);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sacn_data);
+  RUN_TEST(test_sacn_sync);
+  RUN_TEST(test_sacn_rejects_bad_lengths);
+  RUN_TEST(test_sacn_rejects_malformed);
+  RUN_TEST(test_artnet_data_and_sync);
+  RUN_TEST(test_artnet_rejects_bad_lengths);
+  RUN_TEST(test_garbage_is_ignored);
+  RUN_TEST(test_input_publishes_complete_frames);
+  return UNITY_END();
+}
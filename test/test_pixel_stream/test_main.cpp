@@ -0,0 +1,193 @@
+// Pixel streaming (PixelStream.h): the RLE/XOR-RLE codec on its own, then
+// whole frames from PixelStreamSender through PixelStreamReceiver.
+
+#include <PixelStream.h>
+#include <unity.h>
+
+#include <vector>
+
+static constexpr uint16_t N = 750;
+
+using Fragment = std::vector<uint8_t>;
+
+static PixelStreamSender<N> sender;
+static PixelStreamReceiver<N> receiver;
+static CRGB frame[N];
+static CRGB out[N];
+
+void setUp() {}
+void tearDown() {}
+
+// Noise no run encoding can shrink, with one lit pixel at `dot`
+static void render(CRGB* px, uint16_t n, uint16_t dot) {
+  uint32_t x = 12345;
+  for (uint16_t i = 0; i < n; i++) {
+    x = x * 1103515245u + 12345u;
+    px[i] = CRGB(x >> 24, x >> 16, x >> 8);
+  }
+  px[dot % n] = CRGB(255, 255, 255);
+}
+
+static std::vector<Fragment> send(const CRGB* px, uint16_t n) {
+  static uint32_t seq = 0;
+  std::vector<Fragment> frags;
+  sender.sendFrame(px, n, 0, seq, [&](const uint8_t* d, int len) { frags.emplace_back(d, d + len); });
+  return frags;
+}
+
+static bool feed(const Fragment& f) { return receiver.onFragment(f.data(), (int)f.size()); }
+
+static uint8_t encodingOf(const Fragment& f) {
+  return reinterpret_cast<const StreamFragmentHeader*>(f.data())->encoding;
+}
+
+static void test_rle_round_trip() {
+  CRGB px[600];
+  for (int i = 0; i < 600; i++) px[i] = CRGB(0, 0, 0);
+  for (int i = 100; i < 110; i++) px[i] = CRGB(i, 2 * i, 3 * i);  // short unique stretch
+  for (int i = 300; i < 600; i++) px[i] = CRGB(9, 8, 7);          // a run longer than 255
+
+  uint8_t buf[1024];
+  int used = 0;
+  TEST_ASSERT_EQUAL(600, pixelstream::encodeRle(px, nullptr, 0, 600, buf, sizeof(buf), &used));
+  TEST_ASSERT_EQUAL(0, used % 4);
+  CRGB dec[600];
+  TEST_ASSERT_TRUE(pixelstream::decodeRle(buf, used, dec, nullptr, 600));
+  TEST_ASSERT_EQUAL_MEMORY(px, dec, sizeof(px));
+}
+
+static void test_rle_stops_at_capacity() {
+  CRGB px[100];
+  for (int i = 0; i < 100; i++) px[i] = CRGB(i, 0, 0);  // no runs: 4 bytes per pixel
+
+  uint8_t buf[40];
+  int used = 0;
+  const uint16_t covered = pixelstream::encodeRle(px, nullptr, 20, 100, buf, sizeof(buf), &used);
+  TEST_ASSERT_EQUAL(10, covered);
+  TEST_ASSERT_EQUAL(40, used);
+  CRGB dec[10];
+  TEST_ASSERT_TRUE(pixelstream::decodeRle(buf, used, dec, nullptr, covered));
+  TEST_ASSERT_EQUAL_MEMORY(&px[20], dec, sizeof(dec));
+}
+
+static void test_xor_rle_round_trip() {
+  CRGB base[N], px[N];
+  render(base, N, 10);
+  render(px, N, 400);
+
+  static uint8_t buf[4 * N];
+  int used = 0;
+  TEST_ASSERT_EQUAL(N, pixelstream::encodeRle(px, base, 0, N, buf, sizeof(buf), &used));
+  // Two changed pixels; the unchanged stretches between them take 1 + 2 + 2 runs of at most 255
+  TEST_ASSERT_EQUAL(7 * 4, used);
+  CRGB dec[N];
+  TEST_ASSERT_TRUE(pixelstream::decodeRle(buf, used, dec, base, N));
+  TEST_ASSERT_EQUAL_MEMORY(px, dec, sizeof(px));
+}
+
+static void test_rle_rejects_bad_runs() {
+  CRGB dec[8];
+  const uint8_t zeroRun[] = {0, 1, 2, 3, 8, 1, 2, 3};
+  TEST_ASSERT_FALSE(pixelstream::decodeRle(zeroRun, sizeof(zeroRun), dec, nullptr, 8));
+  const uint8_t tooLong[] = {5, 1, 2, 3, 5, 1, 2, 3};
+  TEST_ASSERT_FALSE(pixelstream::decodeRle(tooLong, sizeof(tooLong), dec, nullptr, 8));
+  const uint8_t tooShort[] = {3, 1, 2, 3, 4, 1, 2, 3};
+  TEST_ASSERT_FALSE(pixelstream::decodeRle(tooShort, sizeof(tooShort), dec, nullptr, 8));
+  const uint8_t exact[] = {3, 1, 2, 3, 5, 1, 2, 3};
+  TEST_ASSERT_TRUE(pixelstream::decodeRle(exact, sizeof(exact), dec, nullptr, 8));
+}
+
+static void test_frames_round_trip() {
+  // A keyframe and then deltas, each shown exactly as sent
+  for (uint16_t f = 0; f < 3; f++) {
+    render(frame, N, f);
+    const std::vector<Fragment> frags = send(frame, N);
+    TEST_ASSERT_EQUAL(f == 0 ? 11 : 1, (int)frags.size());
+    TEST_ASSERT_EQUAL(f == 0 ? STREAM_RAW : STREAM_XOR_RLE, encodingOf(frags[0]));
+    for (size_t i = 0; i < frags.size(); i++) {
+      TEST_ASSERT_EQUAL(i + 1 == frags.size(), feed(frags[i]));
+    }
+    TEST_ASSERT_TRUE(receiver.takeFresh());
+    TEST_ASSERT_FALSE(receiver.takeFresh());
+    receiver.blit(out, N);
+    TEST_ASSERT_EQUAL_MEMORY(frame, out, sizeof(frame));
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, receiver.stats().frames);
+}
+
+static void test_duplicates_do_not_complete_a_frame() {
+  // Runs up to the next keyframe so every fragment below is raw
+  for (uint16_t f = 3; f < STREAM_KEYFRAME_EVERY; f++) {
+    render(frame, N, f);
+    for (const Fragment& frag : send(frame, N)) feed(frag);
+  }
+  render(frame, N, 500);
+  const std::vector<Fragment> frags = send(frame, N);
+  TEST_ASSERT_EQUAL(STREAM_RAW, encodingOf(frags[0]));
+  const uint32_t frames = receiver.stats().frames;
+  for (size_t i = 0; i + 1 < frags.size(); i++) {
+    TEST_ASSERT_FALSE(feed(frags[i]));
+    TEST_ASSERT_FALSE(feed(frags[i]));
+  }
+  TEST_ASSERT_FALSE(feed(frags[0]));
+  TEST_ASSERT_EQUAL_UINT32(frames, receiver.stats().frames);
+  TEST_ASSERT_TRUE(feed(frags.back()));
+  TEST_ASSERT_FALSE(feed(frags.back()));  // frame already complete
+  receiver.blit(out, N);
+  TEST_ASSERT_EQUAL_MEMORY(frame, out, sizeof(frame));
+}
+
+static void test_lost_base_waits_for_keyframe() {
+  const uint32_t dropped = receiver.stats().dropped;
+  // Frame 16: lose it entirely, so every delta after it has no base
+  render(frame, N, 600);
+  send(frame, N);
+  CRGB shown[N];
+  receiver.blit(shown, N);
+  for (uint16_t f = 17; f < 2 * STREAM_KEYFRAME_EVERY; f++) {
+    render(frame, N, f);
+    for (const Fragment& frag : send(frame, N)) TEST_ASSERT_FALSE(feed(frag));
+  }
+  TEST_ASSERT_TRUE(receiver.stats().dropped > dropped);
+  receiver.blit(out, N);
+  TEST_ASSERT_EQUAL_MEMORY(shown, out, sizeof(shown));  // previous frame stays up
+
+  render(frame, N, 700);
+  bool completed = false;
+  for (const Fragment& frag : send(frame, N)) completed = feed(frag);
+  TEST_ASSERT_TRUE(completed);
+  receiver.blit(out, N);
+  TEST_ASSERT_EQUAL_MEMORY(frame, out, sizeof(frame));
+}
+
+static void test_corrupt_fragments_are_rejected() {
+  render(frame, N, 1);
+  std::vector<Fragment> frags = send(frame, N);
+  const uint32_t bad = receiver.stats().badFragments;
+  Fragment f = frags[0];
+  f[sizeof(StreamFragmentHeader)] ^= 0x40;
+  TEST_ASSERT_FALSE(feed(f));
+  TEST_ASSERT_FALSE(receiver.onFragment(frags[0].data(), (int)sizeof(StreamFragmentHeader)));
+  TEST_ASSERT_EQUAL_UINT32(bad + 2, receiver.stats().badFragments);
+}
+
+static void test_blit_scales_to_strand_length() {
+  CRGB small[N / 2];
+  receiver.blit(small, N / 2);
+  for (uint16_t i = 0; i < N / 2; i++) TEST_ASSERT_TRUE(small[i] == out[2 * i]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_rle_round_trip);
+  RUN_TEST(test_rle_stops_at_capacity);
+  RUN_TEST(test_xor_rle_round_trip);
+  RUN_TEST(test_rle_rejects_bad_runs);
+  // These share one sender/receiver pair and run in order
+  RUN_TEST(test_frames_round_trip);
+  RUN_TEST(test_duplicates_do_not_complete_a_frame);
+  RUN_TEST(test_lost_base_waits_for_keyframe);
+  RUN_TEST(test_corrupt_fragments_are_rejected);
+  RUN_TEST(test_blit_scales_to_strand_length);
+  return UNITY_END();
+}
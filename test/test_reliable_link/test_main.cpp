@@ -0,0 +1,286 @@
+// Reliable spell delivery (ReliableLink.h): SeqWindow and LinkHealth's
+// sequence tracking across the 32-bit wrap, the ACK frame, and ReliableSender
+// retries, peer learning and peer slot reuse.
+
+#include <LinkHealth.h>
+#include <ReliableLink.h>
+#include <unity.h>
+
+static constexpr uint32_t F = ReliableSender<>::FIRST_RETRY_US;
+
+void setUp() { testEspNowReset(); }
+void tearDown() {}
+
+static const uint8_t* macOf(uint8_t id) {
+  static uint8_t mac[ESP_NOW_ETH_ALEN];
+  const uint8_t m[ESP_NOW_ETH_ALEN] = {0x24, 0x6f, 0x28, 0xaa, 0xbb, id};
+  memcpy(mac, m, sizeof(m));
+  return mac;
+}
+
+static SpellPacketV2 spell(uint32_t seq) {
+  SpellPacketV2 p = {};
+  p.spell = 1;
+  p.flags = SPELL_ACK_REQUESTED;
+  sealSpellPacket(p, seq, seq * 1000ULL);
+  return p;
+}
+
+static AckEvent ackFrom(uint8_t id, uint32_t seq, uint32_t rxUs) {
+  AckEvent a = {};
+  memcpy(a.mac, macOf(id), ESP_NOW_ETH_ALEN);
+  a.seq = seq;
+  a.rxUs = rxUs;
+  return a;
+}
+
+// Let every pending spell run out its retries; returns the time afterwards
+template <typename Sender>
+static uint32_t exhaust(Sender& rs, uint32_t t) {
+  for (int i = 0; i < 1000; i++) {
+    t += 10000;
+    while (rs.due(t)) {}
+  }
+  return t;
+}
+
+static void test_seq_window_rejects_duplicates() {
+  SeqWindow w;
+  TEST_ASSERT_TRUE(w.accept(10));
+  TEST_ASSERT_FALSE(w.accept(10));
+  TEST_ASSERT_TRUE(w.accept(12));
+  TEST_ASSERT_TRUE(w.accept(11));  // late, but never seen
+  TEST_ASSERT_FALSE(w.accept(11));
+  TEST_ASSERT_FALSE(w.accept(12));
+  TEST_ASSERT_EQUAL_UINT32(3, w.duplicates());
+
+  // A jump past the bitmap forgets what it covered; the oldest slot is still tracked
+  TEST_ASSERT_TRUE(w.accept(50));
+  TEST_ASSERT_TRUE(w.accept(19));
+  TEST_ASSERT_FALSE(w.accept(19));
+  TEST_ASSERT_EQUAL_UINT32(4, w.duplicates());
+}
+
+static void test_seq_window_wraps() {
+  SeqWindow w;
+  TEST_ASSERT_TRUE(w.accept(0xFFFFFFFE));
+  TEST_ASSERT_TRUE(w.accept(1));
+  TEST_ASSERT_TRUE(w.accept(0xFFFFFFFF));
+  TEST_ASSERT_TRUE(w.accept(0));
+  TEST_ASSERT_FALSE(w.accept(0xFFFFFFFE));
+  TEST_ASSERT_FALSE(w.accept(0));
+  TEST_ASSERT_TRUE(w.accept(2));
+  TEST_ASSERT_EQUAL_UINT32(2, w.duplicates());
+}
+
+static void test_seq_window_restarts_far_back() {
+  SeqWindow w;
+  TEST_ASSERT_TRUE(w.accept(1000));
+  // 32 or more below the top: the sender restarted, so the seq counts as new
+  TEST_ASSERT_TRUE(w.accept(968));
+  TEST_ASSERT_TRUE(w.accept(969));
+  TEST_ASSERT_FALSE(w.accept(968));
+  TEST_ASSERT_TRUE(w.accept(1000));  // the old top is ahead of the new window
+  TEST_ASSERT_EQUAL_UINT32(1, w.duplicates());
+}
+
+static void frame(LinkHealth& h, uint8_t type, uint32_t seq) {
+  SyncBeacon b = {};
+  sealFrame(b, type, seq, 0);
+  h.onFrame(macOf(1), reinterpret_cast<const uint8_t*>(&b), sizeof(b), true, 0);
+}
+
+static void test_link_health_tracks_seq_across_wrap() {
+  static LinkHealth h;
+  frame(h, SPELL_MSG_SYNC, 0xFFFFFFFE);
+  frame(h, SPELL_MSG_SPELL, 0xFFFFFFFF);
+  frame(h, SPELL_MSG_STATE, 1);
+  TEST_ASSERT_EQUAL_UINT8(1, h.peers());
+  const LinkPeer& p = h.peer(0);
+  TEST_ASSERT_EQUAL_UINT32(1, p.missing);  // seq 0
+
+  frame(h, SPELL_MSG_SYNC, 0);  // late arrival fills the gap
+  TEST_ASSERT_EQUAL_UINT32(0, p.missing);
+  frame(h, SPELL_MSG_SYNC, 0);
+  frame(h, SPELL_MSG_SYNC, 0xFFFFFFFE);
+  TEST_ASSERT_EQUAL_UINT32(2, p.duplicates);
+
+  frame(h, SPELL_MSG_ACK, 0);  // echoes the spell's seq: not counted
+  frame(h, SPELL_MSG_SYNC, 4);
+  TEST_ASSERT_EQUAL_UINT32(2, p.missing);
+  TEST_ASSERT_EQUAL_UINT32(2, p.duplicates);
+  TEST_ASSERT_EQUAL_UINT32(0, p.restarts);
+  TEST_ASSERT_EQUAL_UINT32(8, p.received);
+
+  h.onFrame(macOf(1), reinterpret_cast<const uint8_t*>("junk"), 4, false, 0);
+  TEST_ASSERT_EQUAL_UINT32(1, p.malformed);
+}
+
+static void test_link_health_detects_restarts() {
+  static LinkHealth h;
+  frame(h, SPELL_MSG_SYNC, 5000);
+  frame(h, SPELL_MSG_SYNC, 5000 + LinkHealth::kRestartGap + 1);  // too far ahead
+  TEST_ASSERT_EQUAL_UINT32(1, h.peer(0).restarts);
+  TEST_ASSERT_EQUAL_UINT32(0, h.peer(0).missing);
+  frame(h, SPELL_MSG_SYNC, 3);  // rebooted sender counting from the start
+  TEST_ASSERT_EQUAL_UINT32(2, h.peer(0).restarts);
+  frame(h, SPELL_MSG_SYNC, 4);
+  frame(h, SPELL_MSG_SYNC, 3);
+  TEST_ASSERT_EQUAL_UINT32(1, h.peer(0).duplicates);
+  TEST_ASSERT_EQUAL_UINT32(0, h.peer(0).missing);
+}
+
+static void test_ack_round_trip() {
+  TEST_ASSERT_EQUAL(ESP_OK, sendSpellAck(macOf(7), 42, 0x123456789AULL));
+  TEST_ASSERT_EQUAL(ESP_OK, sendSpellAck(macOf(7), 43, 0));
+  TEST_ASSERT_EQUAL_INT(1, testEspNow.peerCount);  // registered once
+  TEST_ASSERT_EQUAL_INT(2, testEspNow.sends);
+
+  TEST_ASSERT_EQUAL(ESP_OK, sendSpellAck(macOf(7), 42, 0x123456789AULL));
+  AckEvent ev;
+  TEST_ASSERT_TRUE(decodeAck(testEspNow.sentTo, testEspNow.sent, testEspNow.sentLen, 99, ev));
+  TEST_ASSERT_EQUAL_MEMORY(macOf(7), ev.mac, ESP_NOW_ETH_ALEN);
+  TEST_ASSERT_EQUAL_UINT32(42, ev.seq);
+  TEST_ASSERT_TRUE(ev.senderUs == 0x123456789AULL);
+  TEST_ASSERT_EQUAL_UINT32(99, ev.rxUs);
+
+  const SpellPacketV2 p = spell(42);  // a spell is not an ACK
+  TEST_ASSERT_FALSE(decodeAck(macOf(7), reinterpret_cast<const uint8_t*>(&p), sizeof(p), 99, ev));
+}
+
+static void test_no_peers_first_ack_delivers() {
+  ReliableSender<> rs;
+  rs.track(spell(1), 1000);
+  rs.onAck(ackFrom(1, 1, 6000));
+  TEST_ASSERT_EQUAL_UINT8(1, rs.peers());
+  TEST_ASSERT_EQUAL_UINT32(1, rs.stats().delivered);
+  TEST_ASSERT_EQUAL_UINT32(5000, rs.stats().latencyMaxUs);
+
+  // With nobody known, an unanswered spell is given up rather than resent
+  ReliableSender<> lonely;
+  lonely.track(spell(2), 0);
+  TEST_ASSERT_NULL(lonely.due(F));
+  TEST_ASSERT_EQUAL_UINT32(1, lonely.stats().failed);
+  TEST_ASSERT_EQUAL_UINT32(0, lonely.stats().retries);
+}
+
+static void test_retries_back_off_then_fail() {
+  ReliableSender<> rs;
+  rs.track(spell(1), 0);
+  rs.onAck(ackFrom(1, 1, 0));
+
+  rs.track(spell(2), 0);
+  TEST_ASSERT_NULL(rs.due(F - 1));
+  uint32_t t = F, backoff = F;
+  for (uint8_t i = 0; i < ReliableSender<>::MAX_RETRIES; i++) {
+    const SpellPacketV2* p = rs.due(t);
+    TEST_ASSERT_NOT_NULL(p);
+    TEST_ASSERT_EQUAL_UINT32(2, p->hdr.seq);
+    TEST_ASSERT_NULL(rs.due(t));  // once per slot
+    backoff *= 2;
+    TEST_ASSERT_NULL(rs.due(t + backoff - 1));
+    t += backoff;
+  }
+  TEST_ASSERT_NULL(rs.due(t));
+  TEST_ASSERT_EQUAL_UINT32(ReliableSender<>::MAX_RETRIES, rs.stats().retries);
+  TEST_ASSERT_EQUAL_UINT32(1, rs.stats().failed);
+  TEST_ASSERT_EQUAL_UINT8(1, rs.peers());  // one miss is not enough to forget it
+}
+
+static void test_every_known_peer_must_ack() {
+  ReliableSender<> rs;
+  rs.track(spell(1), 0);
+  rs.onAck(ackFrom(1, 1, 0));
+  rs.onAck(ackFrom(2, 1, 0));  // late to a delivered spell, but now known
+  TEST_ASSERT_EQUAL_UINT8(2, rs.peers());
+
+  rs.track(spell(2), 0);
+  rs.onAck(ackFrom(1, 2, 1000));
+  rs.onAck(ackFrom(1, 2, 2000));  // a duplicate ACK does not stand in for peer 2
+  TEST_ASSERT_EQUAL_UINT32(1, rs.stats().delivered);
+  TEST_ASSERT_NOT_NULL(rs.due(F));
+  rs.onAck(ackFrom(2, 2, F + 3000));
+  TEST_ASSERT_EQUAL_UINT32(2, rs.stats().delivered);
+  TEST_ASSERT_EQUAL_UINT32(F + 3000, rs.stats().latencyMaxUs);
+  TEST_ASSERT_NULL(rs.due(10 * F));
+}
+
+static void test_silent_peer_is_forgotten() {
+  ReliableSender<> rs;
+  rs.track(spell(1), 0);
+  rs.onAck(ackFrom(1, 1, 0));
+  uint32_t t = 0;
+  for (uint32_t seq = 2; seq < 2 + ReliableSender<>::PEER_MISS_LIMIT; seq++) {
+    TEST_ASSERT_EQUAL_UINT8(1, rs.peers());
+    rs.track(spell(seq), t);
+    t = exhaust(rs, t);
+  }
+  TEST_ASSERT_EQUAL_UINT8(0, rs.peers());
+  TEST_ASSERT_EQUAL_UINT32(ReliableSender<>::PEER_MISS_LIMIT, rs.stats().failed);
+}
+
+static void test_reused_peer_slot_starts_clean() {
+  // One peer slot: A is forgotten while spells it never answered are still
+  // pending, then B takes the slot. Those spells must neither count B's bit
+  // as acknowledged nor charge B for them.
+  ReliableSender<1, 8> rs;
+  uint32_t t = 0;
+  rs.track(spell(1), t);
+  rs.onAck(ackFrom(0xA, 1, t));
+  for (uint32_t seq = 2; seq <= 4; seq++) rs.track(spell(seq), t);
+  t += 1000;
+  for (uint32_t seq = 5; seq <= 7; seq++) rs.track(spell(seq), t);
+  while (rs.peers() == 1) {
+    t += 1000;
+    while (rs.due(t)) {}
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, rs.stats().failed);
+
+  rs.track(spell(8), t);
+  rs.onAck(ackFrom(0xB, 8, t));
+  TEST_ASSERT_EQUAL_UINT8(1, rs.peers());
+  t = exhaust(rs, t);
+  TEST_ASSERT_EQUAL_UINT8(1, rs.peers());
+  TEST_ASSERT_EQUAL_UINT32(2, rs.stats().delivered);
+  TEST_ASSERT_EQUAL_UINT32(6, rs.stats().failed);
+
+  // B is still trusted: it alone decides the next spell
+  rs.track(spell(9), t);
+  rs.onAck(ackFrom(0xB, 9, t + 500));
+  TEST_ASSERT_EQUAL_UINT32(3, rs.stats().delivered);
+}
+
+static void test_take_interval() {
+  ReliableSender<> rs;
+  rs.track(spell(1), 0);
+  rs.onAck(ackFrom(1, 1, 700));
+  ReliableSender<>::Stats d = rs.takeInterval();
+  TEST_ASSERT_EQUAL_UINT32(1, d.sent);
+  TEST_ASSERT_EQUAL_UINT32(1, d.delivered);
+  TEST_ASSERT_EQUAL_UINT32(700, d.latencyMaxUs);
+
+  rs.track(spell(2), 1000);
+  rs.onAck(ackFrom(1, 2, 1300));
+  d = rs.takeInterval();
+  TEST_ASSERT_EQUAL_UINT32(1, d.sent);
+  TEST_ASSERT_EQUAL_UINT32(300, d.latencySumUs);
+  TEST_ASSERT_EQUAL_UINT32(300, d.latencyMaxUs);  // max restarts every interval
+  TEST_ASSERT_EQUAL_UINT32(2, rs.stats().sent);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_seq_window_rejects_duplicates);
+  RUN_TEST(test_seq_window_wraps);
+  RUN_TEST(test_seq_window_restarts_far_back);
+  RUN_TEST(test_link_health_tracks_seq_across_wrap);
+  RUN_TEST(test_link_health_detects_restarts);
+  RUN_TEST(test_ack_round_trip);
+  RUN_TEST(test_no_peers_first_ack_delivers);
+  RUN_TEST(test_retries_back_off_then_fail);
+  RUN_TEST(test_every_known_peer_must_ack);
+  RUN_TEST(test_silent_peer_is_forgotten);
+  RUN_TEST(test_reused_peer_slot_starts_clean);
+  RUN_TEST(test_take_interval);
+  return UNITY_END();
+}
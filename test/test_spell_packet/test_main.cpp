@@ -0,0 +1,119 @@
+// Spell wire format (SpellPacket.h, decodeSpell in SpellQueue.h): v1 and v2
+// decoding, and every way a frame is rejected.
+
+#include <SpellQueue.h>
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+static SpellPacketV2 makeSpell() {
+  SpellPacketV2 p = {};
+  p.spell = 7;
+  p.flags = SPELL_HAS_BRIGHTNESS | SPELL_HAS_TEMPO | SPELL_ACK_REQUESTED;
+  p.brightness = 200;
+  p.tempoQ16 = 0x18000;  // 1.5x
+  sealSpellPacket(p, 42, 0x0123456789ULL);
+  return p;
+}
+
+static const uint8_t* bytes(const SpellPacketV2& p) { return reinterpret_cast<const uint8_t*>(&p); }
+
+static void test_crc16_check_value() {
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, spellCrc16(check, sizeof(check)));  // CRC-16/CCITT-FALSE
+}
+
+static void test_v1_decodes_bare_int() {
+  const int32_t id = 3;
+  SpellEvent ev;
+  SpellParseResult r;
+  TEST_ASSERT_TRUE(decodeSpell(reinterpret_cast<const uint8_t*>(&id), sizeof(id), 1234, ev, &r));
+  TEST_ASSERT_EQUAL(SPELL_OK_V1, r);
+  TEST_ASSERT_EQUAL_INT32(3, ev.spell);
+  TEST_ASSERT_EQUAL_UINT8(1, ev.version);
+  TEST_ASSERT_EQUAL_UINT8(0, ev.flags);
+  TEST_ASSERT_EQUAL_UINT32(1234, ev.rxUs);
+}
+
+static void test_v2_decodes_fields() {
+  const SpellPacketV2 p = makeSpell();
+  SpellEvent ev;
+  SpellParseResult r;
+  TEST_ASSERT_TRUE(decodeSpell(bytes(p), sizeof(p), 99, ev, &r));
+  TEST_ASSERT_EQUAL(SPELL_OK_V2, r);
+  TEST_ASSERT_EQUAL_INT32(7, ev.spell);
+  TEST_ASSERT_EQUAL_UINT8(2, ev.version);
+  TEST_ASSERT_EQUAL_UINT32(42, ev.seq);
+  TEST_ASSERT_TRUE(ev.senderUs == 0x0123456789ULL);
+  TEST_ASSERT_EQUAL_UINT8(SPELL_HAS_BRIGHTNESS | SPELL_HAS_TEMPO | SPELL_ACK_REQUESTED, ev.flags);
+  TEST_ASSERT_EQUAL_UINT8(200, ev.brightness);
+  TEST_ASSERT_EQUAL_UINT32(0x18000, ev.tempoQ16);
+}
+
+static void test_v2_rejects_any_flipped_bit() {
+  const SpellPacketV2 good = makeSpell();
+  // Every bit after the header's magic/version/type bytes is covered by the CRC
+  for (size_t i = offsetof(SpellHeader, seq); i < sizeof(good); i++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      SpellPacketV2 p = good;
+      reinterpret_cast<uint8_t*>(&p)[i] ^= (uint8_t)(1u << bit);
+      SpellEvent ev;
+      SpellParseResult r;
+      TEST_ASSERT_FALSE(decodeSpell(bytes(p), sizeof(p), 0, ev, &r));
+      TEST_ASSERT_EQUAL(SPELL_BAD_CRC, r);
+    }
+  }
+}
+
+static void test_v2_rejects_bad_header() {
+  SpellEvent ev;
+  SpellParseResult r;
+
+  SpellPacketV2 p = makeSpell();
+  p.hdr.magic ^= 1;
+  TEST_ASSERT_FALSE(decodeSpell(bytes(p), sizeof(p), 0, ev, &r));
+  TEST_ASSERT_EQUAL(SPELL_BAD_MAGIC, r);
+
+  p = makeSpell();
+  p.hdr.version = 3;
+  TEST_ASSERT_FALSE(decodeSpell(bytes(p), sizeof(p), 0, ev, &r));
+  TEST_ASSERT_EQUAL(SPELL_BAD_VERSION, r);
+}
+
+static void test_v2_rejects_bad_lengths() {
+  const SpellPacketV2 p = makeSpell();
+  SpellEvent ev;
+  SpellParseResult r;
+  for (int len = 0; len < (int)sizeof(p); len++) {
+    if (len == SPELL_V1_LEN) continue;  // any 4 bytes are a v1 spell
+    TEST_ASSERT_FALSE(decodeSpell(bytes(p), len, 0, ev, &r));
+    TEST_ASSERT_EQUAL(SPELL_BAD_LENGTH, r);
+  }
+}
+
+static void test_other_message_types_are_not_spells() {
+  SyncBeacon beacon = {};
+  sealFrame(beacon, SPELL_MSG_SYNC, 5, 1000);
+  SpellEvent ev;
+  SpellParseResult r;
+  TEST_ASSERT_FALSE(decodeSpell(reinterpret_cast<const uint8_t*>(&beacon), sizeof(beacon), 0, ev, &r));
+  TEST_ASSERT_EQUAL(SPELL_OTHER_TYPE, r);
+
+  const SyncBeacon* parsed = nullptr;
+  TEST_ASSERT_EQUAL(SPELL_OK_V2, parseFrame(reinterpret_cast<const uint8_t*>(&beacon), sizeof(beacon),
+                                            SPELL_MSG_SYNC, &parsed));
+  TEST_ASSERT_EQUAL_UINT32(5, parsed->hdr.seq);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc16_check_value);
+  RUN_TEST(test_v1_decodes_bare_int);
+  RUN_TEST(test_v2_decodes_fields);
+  RUN_TEST(test_v2_rejects_any_flipped_bit);
+  RUN_TEST(test_v2_rejects_bad_header);
+  RUN_TEST(test_v2_rejects_bad_lengths);
+  RUN_TEST(test_other_message_types_are_not_spells);
+  return UNITY_END();
+}
@@ -0,0 +1,126 @@
+// Scheduled spells (SpellSchedule.h): the execution instant, on-time versus
+// late and implausible leads, ordering, overflow and the 32-bit clock wrap.
+
+#include <SpellSchedule.h>
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+static SpellEvent scheduled(int32_t spell, uint64_t senderUs, uint8_t leadMs) {
+  SpellEvent ev = {};
+  ev.spell = spell;
+  ev.version = 2;
+  ev.flags = SPELL_HAS_EXEC_AT;
+  ev.senderUs = senderUs;
+  ev.leadMs = leadMs;
+  return ev;
+}
+
+static void test_execute_at() {
+  TEST_ASSERT_EQUAL_UINT32(1150000, SpellSchedule<>::executeAt(scheduled(1, 1000000, 150)));
+  // Only the low 32 bits count, like micros()
+  TEST_ASSERT_EQUAL_UINT32(49999, SpellSchedule<>::executeAt(scheduled(1, 0x1FFFFFFFFULL, 50)));
+}
+
+static void test_on_time_waits_for_its_slot() {
+  SpellSchedule<> s;
+  const SpellEvent ev = scheduled(4, 1000000, 100);
+  const uint32_t at = SpellSchedule<>::executeAt(ev);
+  TEST_ASSERT_TRUE(s.add(ev, at, at - 30000));
+  TEST_ASSERT_EQUAL_UINT8(1, s.pending());
+
+  SpellEvent out;
+  TEST_ASSERT_FALSE(s.popDue(at - 1, out));
+  TEST_ASSERT_TRUE(s.popDue(at, out));
+  TEST_ASSERT_EQUAL_INT32(4, out.spell);
+  TEST_ASSERT_FALSE(s.popDue(at, out));
+  TEST_ASSERT_EQUAL_UINT32(1, s.stats().scheduled);
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats().late);
+}
+
+static void test_late_applies_now() {
+  SpellSchedule<> s;
+  const SpellEvent ev = scheduled(4, 1000000, 10);
+  const uint32_t at = SpellSchedule<>::executeAt(ev);
+  TEST_ASSERT_FALSE(s.add(ev, at, at));  // due this very frame
+  TEST_ASSERT_FALSE(s.add(ev, at, at + 2500));
+  TEST_ASSERT_FALSE(s.add(ev, at, at + 800));
+  TEST_ASSERT_EQUAL_UINT8(0, s.pending());
+  TEST_ASSERT_EQUAL_UINT32(3, s.stats().late);
+  TEST_ASSERT_EQUAL_UINT32(2500, s.stats().worstLateUs);
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats().scheduled);
+}
+
+static void test_implausible_lead_applies_now() {
+  SpellSchedule<> s;
+  const SpellEvent ev = scheduled(4, 0, 0);
+  TEST_ASSERT_TRUE(s.add(ev, SpellSchedule<>::MAX_LEAD_US, 0));
+  TEST_ASSERT_FALSE(s.add(ev, SpellSchedule<>::MAX_LEAD_US + 1, 0));  // unsynced clock, not a real lead
+  TEST_ASSERT_EQUAL_UINT8(1, s.pending());
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats().late);
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats().overflow);
+}
+
+static void test_pops_in_time_order() {
+  SpellSchedule<> s;
+  TEST_ASSERT_TRUE(s.add(scheduled(3, 0, 0), 3000, 0));
+  TEST_ASSERT_TRUE(s.add(scheduled(1, 0, 0), 1000, 0));
+  TEST_ASSERT_TRUE(s.add(scheduled(2, 0, 0), 2000, 0));
+  TEST_ASSERT_TRUE(s.add(scheduled(4, 0, 0), 2000, 0));  // same instant: after spell 2
+
+  SpellEvent out;
+  TEST_ASSERT_TRUE(s.popDue(2500, out));
+  TEST_ASSERT_EQUAL_INT32(1, out.spell);
+  TEST_ASSERT_TRUE(s.popDue(2500, out));
+  TEST_ASSERT_EQUAL_INT32(2, out.spell);
+  TEST_ASSERT_TRUE(s.popDue(2500, out));
+  TEST_ASSERT_EQUAL_INT32(4, out.spell);
+  TEST_ASSERT_FALSE(s.popDue(2500, out));
+  TEST_ASSERT_TRUE(s.popDue(3000, out));
+  TEST_ASSERT_EQUAL_INT32(3, out.spell);
+  TEST_ASSERT_EQUAL_UINT8(0, s.pending());
+}
+
+static void test_overflow_applies_now() {
+  SpellSchedule<2> s;
+  TEST_ASSERT_TRUE(s.add(scheduled(1, 0, 0), 1000, 0));
+  TEST_ASSERT_TRUE(s.add(scheduled(2, 0, 0), 2000, 0));
+  TEST_ASSERT_FALSE(s.add(scheduled(3, 0, 0), 500, 0));
+  TEST_ASSERT_EQUAL_UINT32(1, s.stats().overflow);
+  TEST_ASSERT_EQUAL_UINT8(2, s.pending());
+}
+
+static void test_clock_wrap() {
+  // micros() wraps every 71.6 minutes; the slot just past zero is still ahead
+  SpellSchedule<> s;
+  const uint32_t now = 0xFFFFF000;
+  TEST_ASSERT_TRUE(s.add(scheduled(2, 0, 0), 0x1000, now));
+  TEST_ASSERT_TRUE(s.add(scheduled(1, 0, 0), 0xFFFFFF00, now));
+  TEST_ASSERT_FALSE(s.add(scheduled(9, 0, 0), 0xFFFFE000, now));  // late, before the wrap
+  TEST_ASSERT_EQUAL_UINT32(0x1000, s.stats().worstLateUs);
+
+  SpellEvent out;
+  TEST_ASSERT_FALSE(s.popDue(0xFFFFFEFF, out));
+  TEST_ASSERT_TRUE(s.popDue(0xFFFFFF00, out));
+  TEST_ASSERT_EQUAL_INT32(1, out.spell);
+  TEST_ASSERT_FALSE(s.popDue(0xFFF, out));
+  TEST_ASSERT_TRUE(s.popDue(0x1000, out));
+  TEST_ASSERT_EQUAL_INT32(2, out.spell);
+
+  // Late by a few microseconds across the wrap
+  TEST_ASSERT_FALSE(s.add(scheduled(3, 0, 0), 0xFFFFFFF0, 0x10));
+  TEST_ASSERT_EQUAL_UINT32(2, s.stats().late);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_execute_at);
+  RUN_TEST(test_on_time_waits_for_its_slot);
+  RUN_TEST(test_late_applies_now);
+  RUN_TEST(test_implausible_lead_applies_now);
+  RUN_TEST(test_pops_in_time_order);
+  RUN_TEST(test_overflow_applies_now);
+  RUN_TEST(test_clock_wrap);
+  return UNITY_END();
+}
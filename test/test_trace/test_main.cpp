@@ -0,0 +1,126 @@
+// Trace wire format (Trace.h): encode/decode round trips, truncated records,
+// and garbage the decoder must reject without reading past the buffer.
+
+#include <Trace.h>
+#include <unity.h>
+
+#include <vector>
+
+using Bytes = std::vector<uint8_t>;
+
+void setUp() {}
+void tearDown() {}
+
+static TraceRecord makeRecord(uint8_t nargs) {
+  TraceRecord r = {0xDEADBEEF, TRACE_SPELL_RECEIVED, nargs, {-1, 0x7FFFFFFF, INT32_MIN, 12345}};
+  return r;
+}
+
+static Bytes encode(const TraceRecord& r) {
+  uint8_t buf[TRACE_MAX_BYTES];
+  const size_t n = encodeTrace(r, buf);
+  return Bytes(buf, buf + n);
+}
+
+// Heap copy of exactly len bytes, so a read past the end trips ASan
+static int decode(const Bytes& b, size_t len, TraceRecord& r) {
+  Bytes exact(b.begin(), b.begin() + len);
+  return decodeTrace(exact.data(), exact.size(), r);
+}
+
+static void test_round_trip() {
+  for (uint8_t nargs = 0; nargs <= TRACE_MAX_ARGS; nargs++) {
+    const TraceRecord in = makeRecord(nargs);
+    const Bytes b = encode(in);
+    TEST_ASSERT_EQUAL(TRACE_HEADER_BYTES + 4 * nargs, b.size());
+    TEST_ASSERT_EQUAL_HEX8(TRACE_SYNC, b[0]);
+
+    TraceRecord out = {};
+    TEST_ASSERT_EQUAL_INT((int)b.size(), decode(b, b.size(), out));
+    TEST_ASSERT_EQUAL_UINT32(in.tUs, out.tUs);
+    TEST_ASSERT_EQUAL_UINT8(in.event, out.event);
+    TEST_ASSERT_EQUAL_UINT8(nargs, out.nargs);
+    TEST_ASSERT_EQUAL_MEMORY(in.args, out.args, 4 * nargs);
+  }
+}
+
+static void test_wire_is_little_endian() {
+  const TraceRecord r = {0x04030201, TRACE_PAD_PRESS, 1, {0x08070605}};
+  const uint8_t expected[] = {TRACE_SYNC, TRACE_PAD_PRESS, 1, 1, 2, 3, 4, 5, 6, 7, 8};
+  const Bytes b = encode(r);
+  TEST_ASSERT_EQUAL(sizeof(expected), b.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected, b.data(), sizeof(expected));
+}
+
+static void test_back_to_back_records() {
+  Bytes stream;
+  for (uint8_t nargs = 0; nargs <= TRACE_MAX_ARGS; nargs++) {
+    const Bytes b = encode(makeRecord(nargs));
+    stream.insert(stream.end(), b.begin(), b.end());
+  }
+  size_t pos = 0;
+  for (uint8_t nargs = 0; nargs <= TRACE_MAX_ARGS; nargs++) {
+    TraceRecord r;
+    const int used = decodeTrace(stream.data() + pos, stream.size() - pos, r);
+    TEST_ASSERT_EQUAL_INT((int)(TRACE_HEADER_BYTES + 4 * nargs), used);
+    TEST_ASSERT_EQUAL_UINT8(nargs, r.nargs);
+    pos += used;
+  }
+  TEST_ASSERT_EQUAL(stream.size(), pos);
+}
+
+static void test_truncated_needs_more() {
+  const Bytes b = encode(makeRecord(TRACE_MAX_ARGS));
+  for (size_t len = 0; len < b.size(); len++) {
+    TraceRecord r;
+    TEST_ASSERT_EQUAL_INT(0, decode(b, len, r));
+  }
+}
+
+static void test_invalid_header_rejected() {
+  const Bytes good = encode(makeRecord(2));
+  TraceRecord r;
+
+  Bytes b = good;
+  b[0] = 'T';  // plain log text
+  TEST_ASSERT_EQUAL_INT(-1, decode(b, b.size(), r));
+
+  b = good;
+  b[1] = TRACE_EVENT_COUNT;  // event from a newer firmware
+  TEST_ASSERT_EQUAL_INT(-1, decode(b, b.size(), r));
+
+  b = good;
+  b[2] = TRACE_MAX_ARGS + 1;
+  b.resize(TRACE_HEADER_BYTES + 4 * b[2], 0);
+  TEST_ASSERT_EQUAL_INT(-1, decode(b, b.size(), r));
+  TEST_ASSERT_EQUAL_INT(-1, decode(b, TRACE_HEADER_BYTES, r));  // rejected before waiting for args
+}
+
+static void test_garbage_stays_in_bounds() {
+  Bytes b(64);
+  uint32_t x = 7;
+  for (int round = 0; round < 2000; round++) {
+    for (uint8_t& v : b) v = (uint8_t)((x = x * 1664525u + 1013904223u) >> 24);
+    b[0] = TRACE_SYNC;  // past the sync byte, so the header checks do the work
+    const size_t len = x % b.size();
+    TraceRecord r;
+    const int used = decode(b, len, r);
+    TEST_ASSERT_TRUE(used >= -1 && used <= (int)len);
+    if (used > 0) {
+      TEST_ASSERT_TRUE(r.event < TRACE_EVENT_COUNT);
+      TEST_ASSERT_TRUE(r.nargs <= TRACE_MAX_ARGS);
+      TEST_ASSERT_EQUAL_INT((int)(TRACE_HEADER_BYTES + 4 * r.nargs), used);
+    }
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_wire_is_little_endian);
+  RUN_TEST(test_back_to_back_records);
+  RUN_TEST(test_truncated_needs_more);
+  RUN_TEST(test_invalid_header_rejected);
+  RUN_TEST(test_garbage_stays_in_bounds);
+  return UNITY_END();
+}
@@ -0,0 +1,64 @@
+// Host-side check for lib/WizardFx/src/DmxInput.h: listens for sACN and
+// Art-Net like the cape does (same strand map) and prints what it receives.
+//
+//   g++ -std=gnu++17 -O2 -Ilib/WizardFx/src tools/dmx_listen.cpp -o dmx_listen
+//   ./dmx_listen [first-universe]
+//
+// Point any sACN/Art-Net sender at this machine (unicast, or sACN multicast),
+// e.g. sACNView, QLC+ or xLights, and watch frames, syncs and per-universe
+// sequence gaps once a second.
+
+#include <DmxInput.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Cape layout: four back strips and the stole, 250 pixels each
+static const uint16_t kStrandPixels[] = {250, 250, 250, 250, 250};
+static constexpr uint8_t kStrands = sizeof(kStrandPixels) / sizeof(kStrandPixels[0]);
+
+static DmxInput<1250> input;
+
+static uint32_t nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+int main(int argc, char** argv) {
+  const uint16_t first = argc > 1 ? (uint16_t)atoi(argv[1]) : 1;
+  if (!input.begin(kStrandPixels, kStrands, first)) {
+    fprintf(stderr, "strand map does not fit\n");
+    return 1;
+  }
+  DmxSocket sock;
+  if (!sock.begin()) {
+    perror("bind");
+    return 1;
+  }
+  for (uint8_t i = 0; i < input.universes(); i++) sock.joinUniverse(input.universeStats(i).universe);
+  printf("Listening on UDP %u (sACN) and %u (Art-Net), universes %u-%u\n", SACN_PORT, ARTNET_PORT, first,
+         first + input.universes() - 1);
+
+  uint8_t buf[DMX_MAX_PACKET];
+  uint32_t nextReport = nowMs() + 1000;
+  uint32_t lastFrames = 0;
+  for (;;) {
+    const int n = sock.receive(buf, sizeof(buf), 100);
+    if (n > 0) input.onPacket(buf, (size_t)n, nowMs());
+    if ((int32_t)(nowMs() - nextReport) < 0) continue;
+    nextReport += 1000;
+    bool fresh;
+    const uint8_t* frame = input.frame(&fresh);
+    const auto st = input.stats();
+    printf("%u fps, %s, %u syncs, %u unmapped, %u ignored | pixel 0 = %02x%02x%02x\n", st.frames - lastFrames,
+           input.synced() ? "synced" : "unsynced", st.syncs, st.unmapped, st.ignored, frame[0], frame[1], frame[2]);
+    lastFrames = st.frames;
+    for (uint8_t i = 0; i < input.universes(); i++) {
+      const auto u = input.universeStats(i);
+      if (u.packets) printf("  universe %u: %u packets, %u gaps, %u out of order\n", u.universe, u.packets, u.gaps,
+                            u.outOfOrder);
+    }
+  }
+}
@@ -0,0 +1,213 @@
+// Host-side decoder for the binary trace stream (lib/WizardFx/src/Trace.h,
+// firmware built with -DTRACE_LOG=1). Text logs in the stream are printed as
+// they are; trace records become log lines with the format strings from
+// TraceEvents.def, stamped with the device's micros().
+//
+//   g++ -std=gnu++17 -O2 -Ilib/WizardFx/src tools/trace_decode.cpp -o trace_decode
+//   ./trace_decode wizard-staff.local:23     # NetSerial (cape, staff)
+//   ./trace_decode /dev/ttyUSB0              # UART at 115200 (hat, receiver)
+//   ./trace_decode < capture.bin             # saved stream
+//
+// Options:
+//   -c  CSV timeline instead of log lines: t_us,event,arg0..arg3
+//   -s  on exit (Ctrl-C or end of input), per-event counts and the
+//       min/avg/max time between consecutive events of each kind
+//
+// Rebuild the decoder whenever TraceEvents.def changes: event ids are
+// positions in that file.
+
+#include <Trace.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const char* const kEventNames[] = {
+#define TRACE_EVENT(name, fmt) #name,
+#include "TraceEvents.def"
+#undef TRACE_EVENT
+};
+
+struct EventStats {
+  uint32_t count = 0;
+  uint64_t lastUs = 0;
+  uint64_t minGapUs = UINT64_MAX;
+  uint64_t maxGapUs = 0;
+  uint64_t sumGapUs = 0;
+};
+
+static bool csv = false;
+static bool stats = false;
+static EventStats eventStats[TRACE_EVENT_COUNT];
+static volatile sig_atomic_t stop = 0;
+
+// micros() wraps every 71.6 minutes; keep a running 64-bit clock
+static uint64_t unwrap(uint32_t tUs) {
+  static bool first = true;
+  static uint32_t last = 0;
+  static uint64_t high = 0;
+  if (!first && tUs < last && last - tUs > 0x80000000u) high += 1ull << 32;
+  first = false;
+  last = tUs;
+  return high | tUs;
+}
+
+static void printRecord(const TraceRecord& r) {
+  const uint64_t t = unwrap(r.tUs);
+  EventStats& st = eventStats[r.event];
+  if (st.count) {
+    const uint64_t gap = t - st.lastUs;
+    if (gap < st.minGapUs) st.minGapUs = gap;
+    if (gap > st.maxGapUs) st.maxGapUs = gap;
+    st.sumGapUs += gap;
+  }
+  st.count++;
+  st.lastUs = t;
+
+  // The device passes int32_t; give %lu/%lx the 32-bit unsigned value it would print
+  const char* fmt = kTraceFormats[r.event];
+  long a[TRACE_MAX_ARGS] = {};
+  uint8_t n = 0;
+  for (const char* p = strchr(fmt, '%'); p && n < r.nargs; p = strchr(p + 1, '%')) {
+    if (p[1] == '%') {
+      p++;
+      continue;
+    }
+    const char* conv = p + strcspn(p + 1, "diuxXc") + 1;
+    a[n] = (*conv == 'd' || *conv == 'i') ? (long)r.args[n] : (long)(uint32_t)r.args[n];
+    n++;
+  }
+  if (csv) {
+    printf("%llu,%s", (unsigned long long)t, kEventNames[r.event]);
+    for (uint8_t i = 0; i < TRACE_MAX_ARGS; i++) {
+      if (i < r.nargs) printf(",%ld", (long)r.args[i]);
+      else printf(",");
+    }
+    printf("\n");
+    return;
+  }
+  printf("[%10.6f] ", t / 1e6);
+  printf(fmt, a[0], a[1], a[2], a[3]);
+  printf("\n");
+}
+
+static void printStats() {
+  fprintf(stderr, "%-18s %8s %12s %12s %12s\n", "event", "count", "min gap us", "avg gap us", "max gap us");
+  for (int e = 0; e < TRACE_EVENT_COUNT; e++) {
+    const EventStats& st = eventStats[e];
+    if (!st.count) continue;
+    if (st.count < 2) {
+      fprintf(stderr, "%-18s %8u\n", kEventNames[e], st.count);
+      continue;
+    }
+    fprintf(stderr, "%-18s %8u %12llu %12llu %12llu\n", kEventNames[e], st.count, (unsigned long long)st.minGapUs,
+            (unsigned long long)(st.sumGapUs / (st.count - 1)), (unsigned long long)st.maxGapUs);
+  }
+}
+
+// Text bytes are echoed (suppressed in CSV mode); records are decoded.
+// Returns how many bytes of buf were consumed.
+static size_t decode(const uint8_t* buf, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if (buf[i] != TRACE_SYNC) {
+      const uint8_t* next = (const uint8_t*)memchr(buf + i, TRACE_SYNC, len - i);
+      const size_t textEnd = next ? (size_t)(next - buf) : len;
+      if (!csv) fwrite(buf + i, 1, textEnd - i, stdout);
+      i = textEnd;
+      continue;
+    }
+    TraceRecord r;
+    const int used = decodeTrace(buf + i, len - i, r);
+    if (used == 0) break;  // record split across reads
+    if (used < 0) {
+      i++;  // stray byte, resync on the next marker
+      continue;
+    }
+    printRecord(r);
+    i += (size_t)used;
+  }
+  fflush(stdout);
+  return i;
+}
+
+static int openTcp(const char* hostPort) {
+  char host[256];
+  const char* colon = strrchr(hostPort, ':');
+  const size_t hostLen = (size_t)(colon - hostPort);
+  if (hostLen >= sizeof(host)) return -1;
+  memcpy(host, hostPort, hostLen);
+  host[hostLen] = '\0';
+  addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(host, colon + 1, &hints, &res) != 0) return -1;
+  int fd = -1;
+  for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+static int openSource(const char* src) {
+  if (!src || strcmp(src, "-") == 0) return STDIN_FILENO;
+  if (src[0] != '/' && strchr(src, ':')) return openTcp(src);
+  const int fd = open(src, O_RDONLY | O_NOCTTY);
+  if (fd >= 0 && isatty(fd)) {
+    termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, B115200);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+static void onSignal(int) { stop = 1; }
+
+int main(int argc, char** argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "cs")) != -1) {
+    if (opt == 'c') csv = true;
+    else if (opt == 's') stats = true;
+    else {
+      fprintf(stderr, "usage: %s [-c] [-s] [host:port | device | -]\n", argv[0]);
+      return 2;
+    }
+  }
+  const char* src = optind < argc ? argv[optind] : nullptr;
+  const int fd = openSource(src);
+  if (fd < 0) {
+    fprintf(stderr, "cannot open %s: %s\n", src, strerror(errno));
+    return 1;
+  }
+  struct sigaction sa = {};
+  sa.sa_handler = onSignal;
+  sigaction(SIGINT, &sa, nullptr);  // no SA_RESTART: read() returns on Ctrl-C
+  if (csv) printf("t_us,event,arg0,arg1,arg2,arg3\n");
+
+  uint8_t buf[4096];
+  size_t held = 0;
+  while (!stop) {
+    const ssize_t n = read(fd, buf + held, sizeof(buf) - held);
+    if (n <= 0) break;
+    held += (size_t)n;
+    const size_t used = decode(buf, held);
+    memmove(buf, buf + used, held - used);
+    held -= used;
+  }
+  if (stats) printStats();
+  return 0;
+}